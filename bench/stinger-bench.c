@@ -0,0 +1,513 @@
+/* Headless benchmark of the stinger decode pipeline: demux and decode
+ * (stinger_decoder, with read-ahead), conversion to something the texture
+ * ring takes (the same choice playback makes) and a mock upload that copies
+ * the planes the way mapping a texture would. No graphics context is
+ * created. Results are written as JSON, so runs can be compared in CI.
+ *
+ * usage: stinger-bench [options] <clip or directory>...
+ *   --threads N[,N...]      decoder thread counts to run each clip with
+ *   --threading MODE        auto, frame or slice
+ *   --max-size WxH          fit frames into this size, like decoding at the
+ *                           output resolution
+ *   --force-bgra            convert every frame to BGRA on the CPU
+ *   --output FILE           write the JSON there instead of stdout
+ *   --verbose               pass plugin log messages through to stderr */
+
+#include <obs-module.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "stinger-decoder.h"
+#include "stinger-convert.h"
+#include "stinger-threadpool.h"
+
+#define MAX_THREAD_COUNTS 16
+
+struct bench_options {
+	int threads[MAX_THREAD_COUNTS];
+	size_t thread_counts;
+	enum stinger_decoder_threading threading;
+	uint32_t max_width;
+	uint32_t max_height;
+	bool force_bgra;
+	bool verbose;
+	const char *output;
+};
+
+struct clip_list {
+	DARRAY(char *) paths;
+};
+
+struct stage {
+	DARRAY(uint64_t) samples;
+};
+
+struct bench_run {
+	const char *path;
+	int threads;
+	const char *error;
+
+	int width;
+	int height;
+	const char *pix_fmt;
+	const char *conversion;
+
+	uint64_t open_ns;
+	uint64_t first_frame_ns;
+	uint64_t total_ns;
+	struct stage decode;
+	struct stage convert;
+	struct stage upload;
+};
+
+/* what the pipeline keeps between frames, like a playback does */
+struct pipeline {
+	struct SwsContext *sws;
+	uint8_t *bgra;
+	int bgra_linesize;
+	uint8_t *staging;
+	size_t staging_size;
+};
+
+static bool verbose = false;
+
+static void log_handler(int level, const char *msg, va_list args, void *param)
+{
+	if (verbose || level <= LOG_WARNING) {
+		vfprintf(stderr, msg, args);
+		fputc('\n', stderr);
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double percentile_ms(struct stage *stage, double p)
+{
+	size_t index = (size_t)(p * (double)(stage->samples.num - 1) + 0.5);
+	return (double)stage->samples.array[index] / 1e6;
+}
+
+/* Mock upload: copies each plane into a staging buffer, which is what
+ * filling a mapped dynamic texture costs on the CPU side */
+static void mock_upload(struct pipeline *p, const uint8_t *const data[],
+		const int linesize[], int format, int width, int height)
+{
+	int size = av_image_get_buffer_size(format, width, height, 1);
+
+	if (size <= 0)
+		return;
+
+	if ((size_t)size > p->staging_size) {
+		p->staging = brealloc(p->staging, (size_t)size);
+		p->staging_size = (size_t)size;
+	}
+
+	av_image_copy_to_buffer(p->staging, size, data, linesize, format,
+			width, height, 1);
+}
+
+static bool alloc_bgra(struct pipeline *p, const AVFrame *frame)
+{
+	int linesize = FFALIGN(frame->width * 4, 32);
+
+	if (p->bgra && p->bgra_linesize == linesize)
+		return true;
+
+	bfree(p->bgra);
+	p->bgra_linesize = linesize;
+	p->bgra = bmalloc((size_t)linesize * frame->height);
+	return p->bgra != NULL;
+}
+
+/* Prepares and uploads a decoded frame with the conversion playback
+ * picks for it */
+static bool process_frame(struct pipeline *p, struct bench_run *run,
+		const AVFrame *frame, bool force_bgra)
+{
+	enum stinger_conversion conversion =
+		stinger_convert_choose(frame->format, force_bgra);
+	const uint8_t *planes[1];
+	uint64_t start = os_gettime_ns();
+	uint64_t converted;
+	AVFrame *clone;
+
+	run->conversion = stinger_conversion_name(conversion);
+
+	if (conversion == STINGER_CONVERSION_YUVA) {
+		if (!alloc_bgra(p, frame) ||
+		    !stinger_convert_frame(frame, p->bgra, p->bgra_linesize))
+			return false;
+
+	} else if (conversion == STINGER_CONVERSION_PLANES) {
+		/* playback hands a reference to the renderer */
+		clone = av_frame_clone(frame);
+		converted = os_gettime_ns();
+		da_push_back(run->convert.samples, &(uint64_t){
+				converted - start});
+
+		mock_upload(p, (const uint8_t *const *)clone->data,
+				clone->linesize, frame->format, frame->width,
+				frame->height);
+		av_frame_free(&clone);
+
+		da_push_back(run->upload.samples, &(uint64_t){
+				os_gettime_ns() - converted});
+		return true;
+
+	} else {
+		p->sws = sws_getCachedContext(p->sws,
+				frame->width, frame->height, frame->format,
+				frame->width, frame->height, AV_PIX_FMT_BGRA,
+				SWS_BILINEAR, NULL, NULL, NULL);
+		if (!p->sws || !alloc_bgra(p, frame))
+			return false;
+
+		sws_scale(p->sws, (const uint8_t *const *)frame->data,
+				frame->linesize, 0, frame->height,
+				(uint8_t *const[]){p->bgra}, &p->bgra_linesize);
+	}
+
+	converted = os_gettime_ns();
+	da_push_back(run->convert.samples, &(uint64_t){converted - start});
+
+	planes[0] = p->bgra;
+	mock_upload(p, planes, &p->bgra_linesize, AV_PIX_FMT_BGRA,
+			frame->width, frame->height);
+	da_push_back(run->upload.samples, &(uint64_t){
+			os_gettime_ns() - converted});
+	return true;
+}
+
+static void pipeline_free(struct pipeline *p)
+{
+	if (p->sws)
+		sws_freeContext(p->sws);
+	bfree(p->bgra);
+	bfree(p->staging);
+}
+
+static void run_clip(struct bench_run *run, const struct bench_options *opts)
+{
+	struct stinger_decoder_options options = {
+		.max_width = opts->max_width,
+		.max_height = opts->max_height,
+		.threads = run->threads,
+		.threading = opts->threading,
+		.read_ahead = true
+	};
+	struct stinger_decoder d;
+	struct pipeline p = {0};
+	uint64_t start = os_gettime_ns();
+	uint64_t decode_start;
+
+	if (!stinger_decoder_open(&d, run->path, &options)) {
+		run->error = "couldn't open the clip";
+		return;
+	}
+	run->open_ns = os_gettime_ns() - start;
+
+	for (;;) {
+		decode_start = os_gettime_ns();
+		if (!stinger_decoder_next(&d))
+			break;
+		da_push_back(run->decode.samples, &(uint64_t){
+				os_gettime_ns() - decode_start});
+
+		if (!process_frame(&p, run, d.frame, opts->force_bgra)) {
+			run->error = "couldn't convert a frame";
+			break;
+		}
+
+		if (!run->first_frame_ns) {
+			run->first_frame_ns = os_gettime_ns() - start;
+			run->width = d.frame->width;
+			run->height = d.frame->height;
+			run->pix_fmt = av_get_pix_fmt_name(d.frame->format);
+		}
+	}
+
+	run->total_ns = os_gettime_ns() - start;
+	if (!run->decode.samples.num && !run->error)
+		run->error = "no frames decoded";
+
+	pipeline_free(&p);
+	stinger_decoder_close(&d);
+}
+
+static void json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (const char *c = str ? str : ""; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+static void json_stage(FILE *f, const char *name, struct stage *stage)
+{
+	uint64_t total = 0;
+
+	fprintf(f, "\t\t\t\t\"%s\": ", name);
+	if (!stage->samples.num) {
+		fprintf(f, "null");
+		return;
+	}
+
+	for (size_t i = 0; i < stage->samples.num; i++)
+		total += stage->samples.array[i];
+	qsort(stage->samples.array, stage->samples.num, sizeof(uint64_t),
+			compare_u64);
+
+	fprintf(f, "{\"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+			"\"p99_ms\": %.3f, \"max_ms\": %.3f}",
+			(double)total / (double)stage->samples.num / 1e6,
+			percentile_ms(stage, 0.5), percentile_ms(stage, 0.9),
+			percentile_ms(stage, 0.99),
+			percentile_ms(stage, 1.0));
+}
+
+static void json_run(FILE *f, struct bench_run *run,
+		const struct bench_options *opts, bool last)
+{
+	size_t frames = run->decode.samples.num;
+
+	fprintf(f, "\t\t{\n\t\t\t\"clip\": ");
+	json_string(f, run->path);
+	fprintf(f, ",\n\t\t\t\"threads\": %d,\n\t\t\t\"threading\": \"%s\","
+			"\n", run->threads,
+			stinger_decoder_threading_name(opts->threading));
+
+	if (run->error) {
+		fprintf(f, "\t\t\t\"error\": ");
+		json_string(f, run->error);
+		fprintf(f, ",\n");
+	}
+
+	fprintf(f, "\t\t\t\"frames\": %d,\n\t\t\t\"width\": %d,\n"
+			"\t\t\t\"height\": %d,\n\t\t\t\"pix_fmt\": ",
+			(int)frames, run->width, run->height);
+	json_string(f, run->pix_fmt);
+	fprintf(f, ",\n\t\t\t\"conversion\": ");
+	json_string(f, run->conversion);
+	fprintf(f, ",\n\t\t\t\"open_ms\": %.3f,\n"
+			"\t\t\t\"first_frame_ms\": %.3f,\n"
+			"\t\t\t\"total_ms\": %.3f,\n\t\t\t\"fps\": %.2f,\n"
+			"\t\t\t\"stages\": {\n",
+			(double)run->open_ns / 1e6,
+			(double)run->first_frame_ns / 1e6,
+			(double)run->total_ns / 1e6,
+			run->total_ns ? (double)frames * 1e9 /
+				(double)run->total_ns : 0.0);
+
+	json_stage(f, "decode", &run->decode);
+	fprintf(f, ",\n");
+	json_stage(f, "convert", &run->convert);
+	fprintf(f, ",\n");
+	json_stage(f, "upload", &run->upload);
+	fprintf(f, "\n\t\t\t}\n\t\t}%s\n", last ? "" : ",");
+}
+
+static long peak_rss_kb(void)
+{
+#ifndef _WIN32
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+static void add_clips(struct clip_list *clips, const char *path)
+{
+	struct os_dirent *entry;
+	struct dstr file = {0};
+	os_dir_t *dir = os_opendir(path);
+
+	if (!dir) {
+		char *copy = bstrdup(path);
+		da_push_back(clips->paths, &copy);
+		return;
+	}
+
+	while ((entry = os_readdir(dir)) != NULL) {
+		char *copy;
+
+		if (entry->directory || entry->d_name[0] == '.')
+			continue;
+
+		dstr_printf(&file, "%s/%s", path, entry->d_name);
+		copy = bstrdup(file.array);
+		da_push_back(clips->paths, &copy);
+	}
+
+	os_closedir(dir);
+	dstr_free(&file);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool parse_threads(struct bench_options *opts, const char *list)
+{
+	char *end;
+
+	opts->thread_counts = 0;
+	while (*list && opts->thread_counts < MAX_THREAD_COUNTS) {
+		long threads = strtol(list, &end, 10);
+		if (end == list || threads < 0)
+			return false;
+
+		opts->threads[opts->thread_counts++] = (int)threads;
+		list = *end == ',' ? end + 1 : end;
+	}
+
+	return opts->thread_counts > 0;
+}
+
+static bool parse_threading(struct bench_options *opts, const char *mode)
+{
+	if (strcmp(mode, "auto") == 0)
+		opts->threading = STINGER_THREADING_AUTO;
+	else if (strcmp(mode, "frame") == 0)
+		opts->threading = STINGER_THREADING_FRAME;
+	else if (strcmp(mode, "slice") == 0)
+		opts->threading = STINGER_THREADING_SLICE;
+	else
+		return false;
+	return true;
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--threads N[,N...]] "
+			"[--threading auto|frame|slice] [--max-size WxH] "
+			"[--force-bgra] [--output FILE] [--verbose] "
+			"<clip or directory>...\n", name);
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {
+		.threads = {0},
+		.thread_counts = 1,
+		.threading = STINGER_THREADING_AUTO
+	};
+	struct clip_list clips;
+	DARRAY(struct bench_run) runs;
+	FILE *f = stdout;
+	int i;
+
+	da_init(clips.paths);
+	da_init(runs);
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--force-bgra") == 0) {
+			opts.force_bgra = true;
+		} else if (strcmp(arg, "--verbose") == 0) {
+			opts.verbose = true;
+		} else if (strncmp(arg, "--", 2) != 0) {
+			add_clips(&clips, arg);
+		} else if (!value) {
+			return usage(argv[0]);
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (!parse_threads(&opts, value))
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--threading") == 0) {
+			if (!parse_threading(&opts, value))
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--max-size") == 0) {
+			if (sscanf(value, "%ux%u", &opts.max_width,
+						&opts.max_height) != 2)
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--output") == 0) {
+			opts.output = value;
+			i++;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	if (!clips.paths.num)
+		return usage(argv[0]);
+
+	verbose = opts.verbose;
+	base_set_log_handler(log_handler, NULL);
+
+	stinger_threadpool_global_init();
+	stinger_convert_init();
+
+	qsort(clips.paths.array, clips.paths.num, sizeof(char *), compare_paths);
+
+	for (size_t c = 0; c < clips.paths.num; c++) {
+		for (size_t t = 0; t < opts.thread_counts; t++) {
+			struct bench_run *run = da_push_back_new(runs);
+
+			run->path = clips.paths.array[c];
+			run->threads = opts.threads[t];
+			run_clip(run, &opts);
+		}
+	}
+
+	if (opts.output) {
+		f = fopen(opts.output, "w");
+		if (!f) {
+			fprintf(stderr, "couldn't write '%s'\n", opts.output);
+			return 1;
+		}
+	}
+
+	fprintf(f, "{\n\t\"cores\": %d,\n\t\"convert_kernel\": ",
+			os_get_logical_cores());
+	json_string(f, stinger_convert_kernel_name());
+	fprintf(f, ",\n\t\"runs\": [\n");
+	for (size_t r = 0; r < runs.num; r++)
+		json_run(f, &runs.array[r], &opts, r + 1 == runs.num);
+	fprintf(f, "\t],\n\t\"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+
+	if (f != stdout)
+		fclose(f);
+
+	for (size_t r = 0; r < runs.num; r++) {
+		da_free(runs.array[r].decode.samples);
+		da_free(runs.array[r].convert.samples);
+		da_free(runs.array[r].upload.samples);
+	}
+	for (size_t c = 0; c < clips.paths.num; c++)
+		bfree(clips.paths.array[c]);
+	da_free(runs);
+	da_free(clips.paths);
+
+	stinger_threadpool_global_free();
+	return 0;
+}
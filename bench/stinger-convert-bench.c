@@ -0,0 +1,378 @@
+/* YUVA to premultiplied BGRA conversion: checks every kernel this CPU runs
+ * against swscale and times each of them per format. The check converts a
+ * synthetic frame with stinger_convert_frame and with swscale (point chroma
+ * sampling, straight alpha), premultiplies the swscale output here and
+ * fails if any channel is more than CHECK_TOLERANCE levels apart. The
+ * synthetic chroma is a slow gradient, so chroma siting differences between
+ * the two don't show up as errors. Exits with 1 if a check fails.
+ *
+ * usage: stinger-convert-bench [options]
+ *   --check                 only run the check
+ *   --size WxH              frame size, 1920x1080 by default
+ *   --iterations N          conversions timed per kernel and format
+ *   --output FILE           write the JSON there instead of stdout
+ *   --verbose               pass plugin log messages through to stderr */
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stinger-convert.h"
+#include "stinger-threadpool.h"
+
+/* both sides are fixed point with their own coefficient precision and
+ * rounding, which is worth a level each; 10 bit alpha rounds to 8 bit
+ * differently too, which is another after premultiplying */
+#define CHECK_TOLERANCE 3
+
+#define DEFAULT_ITERATIONS 200
+
+static const int formats[] = {
+	AV_PIX_FMT_YUVA420P,
+	AV_PIX_FMT_YUVA422P,
+	AV_PIX_FMT_YUVA444P,
+	AV_PIX_FMT_YUVA420P10,
+	AV_PIX_FMT_YUVA422P10,
+	AV_PIX_FMT_YUVA444P10,
+};
+
+static const char *kernels[] = {"c", "sse2", "avx2"};
+
+#define FORMAT_COUNT (sizeof(formats) / sizeof(*formats))
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(*kernels))
+
+struct bench_options {
+	int width;
+	int height;
+	int iterations;
+	bool check_only;
+	bool verbose;
+	const char *output;
+};
+
+struct check_result {
+	const char *kernel;
+	int format;
+	bool full_range;
+	bool bt709;
+	int max_diff;
+};
+
+struct time_result {
+	const char *kernel;
+	int format;
+	double ms_per_frame;
+};
+
+static bool verbose = false;
+
+static void log_handler(int level, const char *msg, va_list args, void *param)
+{
+	if (verbose || level <= LOG_WARNING) {
+		vfprintf(stderr, msg, args);
+		fputc('\n', stderr);
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static inline void put_sample(AVFrame *frame, int plane, int x, int y,
+		int depth, int value)
+{
+	uint8_t *row = frame->data[plane] + (size_t)y * frame->linesize[plane];
+
+	if (depth > 8)
+		((uint16_t *)row)[x] = (uint16_t)value;
+	else
+		row[x] = (uint8_t)value;
+}
+
+/* luma and alpha change every pixel, chroma only slowly */
+static AVFrame *make_frame(int format, int width, int height)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+	AVFrame *frame = av_frame_alloc();
+	int depth = desc->comp[0].depth;
+	int max = (1 << depth) - 1;
+	int cw, ch;
+	uint32_t seed = 0x5717u;
+
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	if (av_frame_get_buffer(frame, 32) < 0) {
+		av_frame_free(&frame);
+		return NULL;
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			seed = seed * 1664525u + 1013904223u;
+			put_sample(frame, 0, x, y, depth,
+					(int)((seed >> 8) & (uint32_t)max));
+			put_sample(frame, 3, x, y, depth,
+					(int)((seed >> 16) & (uint32_t)max));
+		}
+	}
+
+	cw = AV_CEIL_RSHIFT(width, desc->log2_chroma_w);
+	ch = AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+	for (int y = 0; y < ch; y++) {
+		for (int x = 0; x < cw; x++) {
+			put_sample(frame, 1, x, y, depth, max * x / cw);
+			put_sample(frame, 2, x, y, depth, max * y / ch);
+		}
+	}
+
+	return frame;
+}
+
+static inline int premultiply(int v, int a)
+{
+	return (v * a + 127) / 255;
+}
+
+static bool convert_sws(const AVFrame *frame, uint8_t *dst, int linesize)
+{
+	struct SwsContext *sws;
+	const int *coeffs;
+	int full = frame->color_range == AVCOL_RANGE_JPEG;
+
+	sws = sws_getContext(frame->width, frame->height, frame->format,
+			frame->width, frame->height, AV_PIX_FMT_BGRA,
+			SWS_POINT | SWS_ACCURATE_RND | SWS_FULL_CHR_H_INT,
+			NULL, NULL, NULL);
+	if (!sws)
+		return false;
+
+	coeffs = sws_getCoefficients(frame->colorspace == AVCOL_SPC_BT709 ?
+			SWS_CS_ITU709 : SWS_CS_ITU601);
+	sws_setColorspaceDetails(sws, coeffs, full, coeffs, 1, 0, 1 << 16,
+			1 << 16);
+	sws_scale(sws, (const uint8_t *const *)frame->data, frame->linesize,
+			0, frame->height, &dst, &linesize);
+	sws_freeContext(sws);
+
+	for (int y = 0; y < frame->height; y++) {
+		uint8_t *px = dst + (size_t)y * linesize;
+
+		for (int x = 0; x < frame->width; x++, px += 4) {
+			px[0] = (uint8_t)premultiply(px[0], px[3]);
+			px[1] = (uint8_t)premultiply(px[1], px[3]);
+			px[2] = (uint8_t)premultiply(px[2], px[3]);
+		}
+	}
+
+	return true;
+}
+
+static int max_diff(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	int diff = 0;
+
+	for (size_t i = 0; i < size; i++) {
+		int d = abs((int)a[i] - (int)b[i]);
+		if (d > diff)
+			diff = d;
+	}
+
+	return diff;
+}
+
+static bool run_check(struct check_result *result, AVFrame *frame,
+		uint8_t *expected, uint8_t *actual)
+{
+	int linesize = frame->width * 4;
+	size_t size = (size_t)linesize * frame->height;
+
+	frame->color_range = result->full_range ? AVCOL_RANGE_JPEG :
+		AVCOL_RANGE_MPEG;
+	frame->colorspace = result->bt709 ? AVCOL_SPC_BT709 :
+		AVCOL_SPC_BT470BG;
+
+	if (!convert_sws(frame, expected, linesize) ||
+	    !stinger_convert_frame(frame, actual, linesize)) {
+		result->max_diff = -1;
+		return false;
+	}
+
+	result->max_diff = max_diff(expected, actual, size);
+	return result->max_diff <= CHECK_TOLERANCE;
+}
+
+static double time_kernel(const AVFrame *frame, uint8_t *dst, int iterations)
+{
+	int linesize = frame->width * 4;
+	uint64_t start;
+
+	/* first one warms the pool and the caches */
+	stinger_convert_frame(frame, dst, linesize);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < iterations; i++)
+		stinger_convert_frame(frame, dst, linesize);
+
+	return (double)(os_gettime_ns() - start) / 1000000.0 / iterations;
+}
+
+static void json_checks(FILE *f, const struct check_result *checks,
+		size_t count)
+{
+	fprintf(f, "\t\"tolerance\": %d,\n\t\"checks\": [\n", CHECK_TOLERANCE);
+	for (size_t i = 0; i < count; i++) {
+		const struct check_result *c = &checks[i];
+
+		fprintf(f, "\t\t{\"kernel\": \"%s\", \"format\": \"%s\", "
+				"\"range\": \"%s\", \"colorspace\": \"%s\", "
+				"\"max_diff\": %d, \"pass\": %s}%s\n",
+				c->kernel, av_get_pix_fmt_name(c->format),
+				c->full_range ? "full" : "limited",
+				c->bt709 ? "bt709" : "bt601", c->max_diff,
+				c->max_diff >= 0 &&
+				c->max_diff <= CHECK_TOLERANCE ?
+				"true" : "false",
+				i + 1 == count ? "" : ",");
+	}
+	fprintf(f, "\t]");
+}
+
+static void json_times(FILE *f, const struct time_result *times, size_t count)
+{
+	fprintf(f, ",\n\t\"times\": [\n");
+	for (size_t i = 0; i < count; i++) {
+		const struct time_result *t = &times[i];
+
+		fprintf(f, "\t\t{\"kernel\": \"%s\", \"format\": \"%s\", "
+				"\"ms_per_frame\": %.3f}%s\n",
+				t->kernel, av_get_pix_fmt_name(t->format),
+				t->ms_per_frame, i + 1 == count ? "" : ",");
+	}
+	fprintf(f, "\t]");
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--check] [--size WxH] [--iterations N] "
+			"[--output FILE] [--verbose]\n", name);
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {
+		.width = 1920,
+		.height = 1080,
+		.iterations = DEFAULT_ITERATIONS
+	};
+	struct check_result checks[KERNEL_COUNT * FORMAT_COUNT * 4];
+	struct time_result times[KERNEL_COUNT * FORMAT_COUNT];
+	size_t check_count = 0;
+	size_t time_count = 0;
+	uint8_t *expected, *actual;
+	bool pass = true;
+	FILE *f = stdout;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--check") == 0) {
+			opts.check_only = true;
+		} else if (strcmp(arg, "--verbose") == 0) {
+			opts.verbose = true;
+		} else if (!value) {
+			return usage(argv[0]);
+		} else if (strcmp(arg, "--size") == 0) {
+			if (sscanf(value, "%dx%d", &opts.width,
+						&opts.height) != 2 ||
+			    opts.width <= 0 || opts.height <= 0)
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--iterations") == 0) {
+			opts.iterations = atoi(value);
+			if (opts.iterations <= 0)
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--output") == 0) {
+			opts.output = value;
+			i++;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	verbose = opts.verbose;
+	base_set_log_handler(log_handler, NULL);
+
+	stinger_threadpool_global_init();
+	stinger_convert_init();
+
+	expected = bmalloc((size_t)opts.width * opts.height * 4);
+	actual = bmalloc((size_t)opts.width * opts.height * 4);
+
+	for (size_t fmt = 0; fmt < FORMAT_COUNT; fmt++) {
+		AVFrame *frame = make_frame(formats[fmt], opts.width,
+				opts.height);
+
+		if (!frame) {
+			fprintf(stderr, "couldn't allocate a %s frame\n",
+					av_get_pix_fmt_name(formats[fmt]));
+			pass = false;
+			continue;
+		}
+
+		for (size_t k = 0; k < KERNEL_COUNT; k++) {
+			if (!stinger_convert_set_kernel(kernels[k]))
+				continue;
+
+			for (int variant = 0; variant < 4; variant++) {
+				struct check_result *c =
+					&checks[check_count++];
+
+				c->kernel = kernels[k];
+				c->format = formats[fmt];
+				c->full_range = (variant & 1) != 0;
+				c->bt709 = (variant & 2) != 0;
+				if (!run_check(c, frame, expected, actual))
+					pass = false;
+			}
+
+			if (!opts.check_only) {
+				struct time_result *t = &times[time_count++];
+
+				t->kernel = kernels[k];
+				t->format = formats[fmt];
+				t->ms_per_frame = time_kernel(frame, actual,
+						opts.iterations);
+			}
+		}
+
+		av_frame_free(&frame);
+	}
+
+	if (opts.output) {
+		f = fopen(opts.output, "w");
+		if (!f) {
+			fprintf(stderr, "couldn't write '%s'\n", opts.output);
+			return 1;
+		}
+	}
+
+	fprintf(f, "{\n\t\"cores\": %d,\n\t\"width\": %d,\n\t\"height\": %d,\n",
+			os_get_logical_cores(), opts.width, opts.height);
+	json_checks(f, checks, check_count);
+	if (!opts.check_only)
+		json_times(f, times, time_count);
+	fprintf(f, "\n}\n");
+
+	if (f != stdout)
+		fclose(f);
+
+	bfree(expected);
+	bfree(actual);
+	stinger_threadpool_global_free();
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/* Probe benchmark: how long stinger_probe_file takes to count a clip's
+ * frames, against the way the transition used to count them (stream info,
+ * then decoding every frame, which stinger_probe_count_decoded still does).
+ * Each method runs on every clip the given number of times and the JSON
+ * has the mean ms per method, the frame counts both found and which method
+ * the probe settled on, so a clip where they disagree stands out.
+ *
+ * usage: stinger-probe-bench [options] <clip>...
+ *   --repeat N              runs of each method per clip
+ *   --output FILE           write the JSON there instead of stdout
+ *   --verbose               pass plugin log messages through to stderr */
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stinger-probe.h"
+#include "stinger-threadpool.h"
+
+struct bench_options {
+	int repeat;
+	bool verbose;
+	const char *output;
+};
+
+struct bench_run {
+	const char *path;
+	int64_t probe_frames;
+	int64_t decoded_frames;
+	enum stinger_probe_method method;
+	bool probed;
+	double probe_ms;
+	double decode_ms;
+};
+
+static bool verbose = false;
+
+static void log_handler(int level, const char *msg, va_list args, void *param)
+{
+	if (verbose || level <= LOG_WARNING) {
+		vfprintf(stderr, msg, args);
+		fputc('\n', stderr);
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static void run_clip(struct bench_run *run, const struct bench_options *opts)
+{
+	uint64_t probe_ns = 0;
+	uint64_t decode_ns = 0;
+	uint64_t start;
+
+	for (int i = 0; i < opts->repeat; i++) {
+		struct stinger_probe_info info;
+
+		start = os_gettime_ns();
+		run->probed = stinger_probe_file(run->path,
+				STINGER_COVERAGE_NONE, NULL, &info);
+		probe_ns += os_gettime_ns() - start;
+
+		if (run->probed) {
+			run->probe_frames = info.frame_count;
+			run->method = info.method;
+			stinger_probe_info_free(&info);
+		}
+
+		start = os_gettime_ns();
+		run->decoded_frames = stinger_probe_count_decoded(run->path);
+		decode_ns += os_gettime_ns() - start;
+	}
+
+	run->probe_ms = (double)probe_ns / 1e6 / opts->repeat;
+	run->decode_ms = (double)decode_ns / 1e6 / opts->repeat;
+}
+
+static void json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (const char *c = str ? str : ""; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+static void json_run(FILE *f, const struct bench_run *run, bool last)
+{
+	fprintf(f, "\t\t{\n\t\t\t\"path\": ");
+	json_string(f, run->path);
+	fprintf(f, ",\n\t\t\t\"probe\": {\"method\": ");
+	json_string(f, run->probed ?
+			stinger_probe_method_name(run->method) : NULL);
+	fprintf(f, ", \"frames\": %lld, \"ms\": %.3f},\n",
+			(long long)run->probe_frames, run->probe_ms);
+	fprintf(f, "\t\t\t\"decode_count\": {\"frames\": %lld, "
+			"\"ms\": %.3f},\n",
+			(long long)run->decoded_frames, run->decode_ms);
+	fprintf(f, "\t\t\t\"frames_match\": %s\n",
+			run->probed && run->probe_frames == run->decoded_frames ?
+			"true" : "false");
+	fprintf(f, "\t\t}%s\n", last ? "" : ",");
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--repeat N] [--output FILE] [--verbose] "
+			"<clip>...\n", name);
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {.repeat = 3};
+	struct bench_run *runs;
+	size_t run_count = 0;
+	FILE *f = stdout;
+
+	runs = bzalloc(sizeof(*runs) * (size_t)argc);
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--verbose") == 0) {
+			opts.verbose = true;
+		} else if (strncmp(arg, "--", 2) != 0) {
+			runs[run_count++].path = arg;
+		} else if (!value) {
+			return usage(argv[0]);
+		} else if (strcmp(arg, "--repeat") == 0) {
+			opts.repeat = atoi(value);
+			if (opts.repeat < 1)
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--output") == 0) {
+			opts.output = value;
+			i++;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	if (!run_count)
+		return usage(argv[0]);
+
+	verbose = opts.verbose;
+	base_set_log_handler(log_handler, NULL);
+
+	stinger_threadpool_global_init();
+
+	for (size_t r = 0; r < run_count; r++)
+		run_clip(&runs[r], &opts);
+
+	if (opts.output) {
+		f = fopen(opts.output, "w");
+		if (!f) {
+			fprintf(stderr, "couldn't write '%s'\n", opts.output);
+			return 1;
+		}
+	}
+
+	fprintf(f, "{\n\t\"repeat\": %d,\n\t\"runs\": [\n", opts.repeat);
+	for (size_t r = 0; r < run_count; r++)
+		json_run(f, &runs[r], r + 1 == run_count);
+	fprintf(f, "\t]\n}\n");
+
+	if (f != stdout)
+		fclose(f);
+
+	bfree(runs);
+	stinger_threadpool_global_free();
+	return 0;
+}
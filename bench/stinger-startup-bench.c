@@ -0,0 +1,278 @@
+/* Startup benchmark: how long loading stinger transitions takes, the way
+ * loading a scene collection creates them, and how long until they've all
+ * warmed up in the background. libobs is started without video or audio
+ * and the plugin module is loaded from the given path. The clip is probed
+ * once up front, like the properties dialog would have, and every
+ * transition is created with the settings that leaves behind. Creation
+ * time should stay flat per transition however many there are; the
+ * warm-up includes the STINGER_WARMUP_SETTLE_MS wait before it starts.
+ *
+ * usage: stinger-startup-bench [options] <plugin module> <clip>
+ *   --counts N[,N...]       transitions to load in each run
+ *   --legacy                leave the saved duration out of the settings,
+ *                           like collections saved before it was kept
+ *   --output FILE           write the JSON there instead of stdout
+ *   --verbose               pass plugin log messages through to stderr */
+
+#include <obs-module.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stinger-probe.h"
+#include "stinger-threadpool.h"
+#include "stinger-warmup.h"
+
+#define MAX_COUNTS 16
+
+/* longest to wait for the warm-ups of one run */
+#define WARM_TIMEOUT_MS 120000
+
+struct bench_options {
+	int counts[MAX_COUNTS];
+	size_t count_num;
+	bool legacy;
+	bool verbose;
+	const char *output;
+};
+
+struct bench_run {
+	int transitions;
+	uint64_t create_ns;
+	uint64_t warm_ns;
+	bool warm;
+};
+
+static bool verbose = false;
+
+static void log_handler(int level, const char *msg, va_list args, void *param)
+{
+	if (verbose || level <= LOG_WARNING) {
+		vfprintf(stderr, msg, args);
+		fputc('\n', stderr);
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool is_warm(obs_source_t *source)
+{
+	proc_handler_t *ph = obs_source_get_proc_handler(source);
+	calldata_t cd;
+	bool warm;
+
+	calldata_init(&cd);
+	warm = proc_handler_call(ph, "is_warm", &cd) &&
+		calldata_bool(&cd, "warm");
+	calldata_free(&cd);
+	return warm;
+}
+
+static bool all_warm(obs_source_t **sources, int count)
+{
+	for (int i = 0; i < count; i++) {
+		if (sources[i] && !is_warm(sources[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static void run_count(struct bench_run *run, obs_data_t *settings)
+{
+	obs_source_t **sources = bzalloc(sizeof(*sources) *
+			(size_t)run->transitions);
+	struct dstr name = {0};
+	uint64_t start;
+	uint64_t deadline;
+
+	start = os_gettime_ns();
+	for (int i = 0; i < run->transitions; i++) {
+		dstr_printf(&name, "Stinger %d", i + 1);
+		sources[i] = obs_source_create("stinger_transition",
+				name.array, settings, NULL);
+	}
+	run->create_ns = os_gettime_ns() - start;
+
+	deadline = start + (uint64_t)WARM_TIMEOUT_MS * 1000000ULL;
+	while (!(run->warm = all_warm(sources, run->transitions)) &&
+	       os_gettime_ns() < deadline)
+		os_sleep_ms(5);
+	run->warm_ns = os_gettime_ns() - start;
+
+	for (int i = 0; i < run->transitions; i++)
+		obs_source_release(sources[i]);
+
+	dstr_free(&name);
+	bfree(sources);
+}
+
+static void json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (const char *c = str ? str : ""; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+static void json_run(FILE *f, struct bench_run *run, bool last)
+{
+	fprintf(f, "\t\t{\n");
+	fprintf(f, "\t\t\t\"transitions\": %d,\n", run->transitions);
+	fprintf(f, "\t\t\t\"create_ms\": %.3f,\n",
+			(double)run->create_ns / 1e6);
+	fprintf(f, "\t\t\t\"create_ms_per_transition\": %.3f,\n",
+			(double)run->create_ns / 1e6 / run->transitions);
+	fprintf(f, "\t\t\t\"warm\": %s,\n", run->warm ? "true" : "false");
+	fprintf(f, "\t\t\t\"warm_ms\": %.3f\n", (double)run->warm_ns / 1e6);
+	fprintf(f, "\t\t}%s\n", last ? "" : ",");
+}
+
+static bool parse_counts(struct bench_options *opts, const char *list)
+{
+	char *end;
+
+	opts->count_num = 0;
+	while (*list && opts->count_num < MAX_COUNTS) {
+		long count = strtol(list, &end, 10);
+		if (end == list || count < 1)
+			return false;
+
+		opts->counts[opts->count_num++] = (int)count;
+		list = *end == ',' ? end + 1 : end;
+	}
+
+	return opts->count_num != 0 && !*list;
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--counts N[,N...]] [--legacy] "
+			"[--output FILE] [--verbose] <plugin module> <clip>\n",
+			name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {
+		.counts = {1, 10, 50},
+		.count_num = 3
+	};
+	struct bench_run runs[MAX_COUNTS] = {0};
+	struct stinger_probe_info info;
+	struct stat st;
+	const char *plugin = NULL;
+	const char *clip = NULL;
+	obs_module_t *module = NULL;
+	obs_data_t *settings;
+	FILE *f = stdout;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--legacy") == 0) {
+			opts.legacy = true;
+		} else if (strcmp(arg, "--verbose") == 0) {
+			opts.verbose = true;
+		} else if (strncmp(arg, "--", 2) != 0) {
+			if (!plugin)
+				plugin = arg;
+			else if (!clip)
+				clip = arg;
+			else
+				return usage(argv[0]);
+		} else if (!value) {
+			return usage(argv[0]);
+		} else if (strcmp(arg, "--counts") == 0) {
+			if (!parse_counts(&opts, value))
+				return usage(argv[0]);
+			i++;
+		} else if (strcmp(arg, "--output") == 0) {
+			opts.output = value;
+			i++;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	if (!plugin || !clip)
+		return usage(argv[0]);
+
+	verbose = opts.verbose;
+	base_set_log_handler(log_handler, NULL);
+
+	stinger_threadpool_global_init();
+	if (!stinger_probe_file(clip, STINGER_COVERAGE_NONE, NULL, &info)) {
+		fprintf(stderr, "couldn't probe '%s'\n", clip);
+		return 1;
+	}
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		fprintf(stderr, "couldn't start libobs\n");
+		return 1;
+	}
+
+	if (obs_open_module(&module, plugin, NULL) != MODULE_SUCCESS ||
+	    !obs_init_module(module)) {
+		fprintf(stderr, "couldn't load '%s'\n", plugin);
+		obs_shutdown();
+		return 1;
+	}
+
+	settings = obs_data_create();
+	obs_data_set_string(settings, "stingerPath", clip);
+	obs_data_set_string(settings, "prevPath", clip);
+	obs_data_set_int(settings, "numberOfFrames", info.frame_count);
+	obs_data_set_int(settings, "cutFrame", info.frame_count / 2);
+	if (!opts.legacy && os_stat(clip, &st) == 0) {
+		obs_data_set_int(settings, "durationMs", info.duration_ms);
+		obs_data_set_int(settings, "durationFileSize", st.st_size);
+		obs_data_set_int(settings, "durationFileMtime", st.st_mtime);
+	}
+
+	for (size_t c = 0; c < opts.count_num; c++) {
+		runs[c].transitions = opts.counts[c];
+		run_count(&runs[c], settings);
+	}
+
+	obs_data_release(settings);
+
+	if (opts.output) {
+		f = fopen(opts.output, "w");
+		if (!f) {
+			fprintf(stderr, "couldn't write '%s'\n", opts.output);
+			obs_shutdown();
+			return 1;
+		}
+	}
+
+	fprintf(f, "{\n\t\"cores\": %d,\n\t\"clip\": ",
+			os_get_logical_cores());
+	json_string(f, clip);
+	fprintf(f, ",\n\t\"frames\": %lld,\n", (long long)info.frame_count);
+	fprintf(f, "\t\"saved_duration\": %s,\n",
+			opts.legacy ? "false" : "true");
+	fprintf(f, "\t\"settle_ms\": %d,\n", STINGER_WARMUP_SETTLE_MS);
+	fprintf(f, "\t\"runs\": [\n");
+	for (size_t c = 0; c < opts.count_num; c++)
+		json_run(f, &runs[c], c + 1 == opts.count_num);
+	fprintf(f, "\t]\n}\n");
+
+	if (f != stdout)
+		fclose(f);
+
+	stinger_probe_info_free(&info);
+	obs_shutdown();
+	stinger_threadpool_global_free();
+	return 0;
+}
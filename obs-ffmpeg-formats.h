@@ -44,6 +44,19 @@ static inline enum video_format ffmpeg_to_obs_video_format(
 	}
 }
 
+static inline enum video_colorspace convert_color_space(
+		enum AVColorSpace space)
+{
+	return space == AVCOL_SPC_BT709 ? VIDEO_CS_709 : VIDEO_CS_601;
+}
+
+static inline enum video_range_type convert_color_range(
+		enum AVColorRange range)
+{
+	return range == AVCOL_RANGE_JPEG ? VIDEO_RANGE_FULL :
+		VIDEO_RANGE_PARTIAL;
+}
+
 static inline enum audio_format convert_ffmpeg_sample_format(
 		enum AVSampleFormat format)
 {
@@ -61,3 +74,17 @@ static inline enum audio_format convert_ffmpeg_sample_format(
 	/* shouldn't get here */
 	return AUDIO_FORMAT_16BIT;
 }
+
+static inline enum speaker_layout convert_speaker_layout(int channels)
+{
+	switch (channels) {
+	case 1:  return SPEAKERS_MONO;
+	case 2:  return SPEAKERS_STEREO;
+	case 3:  return SPEAKERS_2POINT1;
+	case 4:  return SPEAKERS_QUAD;
+	case 5:  return SPEAKERS_4POINT1;
+	case 6:  return SPEAKERS_5POINT1;
+	case 8:  return SPEAKERS_7POINT1;
+	default: return SPEAKERS_UNKNOWN;
+	}
+}
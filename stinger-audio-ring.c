@@ -0,0 +1,175 @@
+#include <util/platform.h>
+
+#include "stinger-audio-ring.h"
+
+void stinger_audio_ring_init(struct stinger_audio_ring *ring,
+		size_t channels, size_t min_frames)
+{
+	size_t capacity = 1;
+
+	memset(ring, 0, sizeof(*ring));
+
+	while (capacity < min_frames)
+		capacity <<= 1;
+
+	if (channels > MAX_AUDIO_CHANNELS)
+		channels = MAX_AUDIO_CHANNELS;
+
+	for (size_t i = 0; i < channels; i++)
+		ring->planes[i] = bzalloc(capacity * sizeof(float));
+
+	ring->channels = channels;
+	ring->capacity = capacity;
+
+	if (os_event_init(&ring->space, OS_EVENT_TYPE_MANUAL) != 0)
+		ring->space = NULL;
+}
+
+void stinger_audio_ring_free(struct stinger_audio_ring *ring)
+{
+	for (size_t i = 0; i < ring->channels; i++)
+		bfree(ring->planes[i]);
+	if (ring->space)
+		os_event_destroy(ring->space);
+
+	memset(ring, 0, sizeof(*ring));
+}
+
+/* Copies frames into or out of the ring starting at position pos, split in
+ * two where the storage wraps around */
+static void copy_frames(struct stinger_audio_ring *ring, long pos,
+		const float *const src[], float *const dst[], size_t frames)
+{
+	size_t start = (unsigned long)pos & (ring->capacity - 1);
+	size_t first = ring->capacity - start;
+
+	if (first > frames)
+		first = frames;
+
+	for (size_t ch = 0; ch < ring->channels; ch++) {
+		float *plane = ring->planes[ch];
+
+		if (src) {
+			if (src[ch]) {
+				memcpy(plane + start, src[ch],
+						first * sizeof(float));
+				memcpy(plane, src[ch] + first,
+						(frames - first) * sizeof(float));
+			} else {
+				memset(plane + start, 0, first * sizeof(float));
+				memset(plane, 0,
+						(frames - first) * sizeof(float));
+			}
+		} else if (dst[ch]) {
+			memcpy(dst[ch], plane + start, first * sizeof(float));
+			memcpy(dst[ch] + first, plane,
+					(frames - first) * sizeof(float));
+		}
+	}
+}
+
+static size_t writable(struct stinger_audio_ring *ring, long write_pos)
+{
+	long read_pos = os_atomic_load_long(&ring->read_pos);
+	return ring->capacity - stinger_audio_ring_distance(read_pos,
+			write_pos);
+}
+
+size_t stinger_audio_ring_write(struct stinger_audio_ring *ring,
+		const float *const data[], size_t frames)
+{
+	long pos = ring->write_pos;
+	size_t space = writable(ring, pos);
+
+	if (frames > space)
+		frames = space;
+	if (!frames)
+		return 0;
+
+	copy_frames(ring, pos, data, NULL, frames);
+	os_atomic_set_long(&ring->write_pos,
+			(long)((unsigned long)pos + frames));
+	return frames;
+}
+
+size_t stinger_audio_ring_write_silence(struct stinger_audio_ring *ring,
+		size_t frames)
+{
+	const float *silence[MAX_AUDIO_CHANNELS] = {0};
+	return stinger_audio_ring_write(ring, silence, frames);
+}
+
+void stinger_audio_ring_wait(struct stinger_audio_ring *ring,
+		size_t frames, volatile bool *cancel)
+{
+	if (frames > ring->capacity)
+		frames = ring->capacity;
+
+	if (!ring->space) {
+		os_sleep_ms(5);
+		return;
+	}
+
+	/* reset before checking, so a signal after the check isn't lost */
+	os_event_reset(ring->space);
+	if (os_atomic_load_bool(cancel) || writable(ring, ring->write_pos) >=
+			frames)
+		return;
+
+	os_event_wait(ring->space);
+}
+
+void stinger_audio_ring_wake(struct stinger_audio_ring *ring)
+{
+	if (ring->space)
+		os_event_signal(ring->space);
+}
+
+void stinger_audio_ring_begin_clip(struct stinger_audio_ring *ring,
+		long clip)
+{
+	os_atomic_set_long(&ring->start_pos, ring->write_pos);
+	os_atomic_set_long(&ring->start_clip, clip);
+}
+
+void stinger_audio_ring_end_clip(struct stinger_audio_ring *ring, long clip)
+{
+	os_atomic_set_long(&ring->end_pos, ring->write_pos);
+	os_atomic_set_long(&ring->end_clip, clip);
+}
+
+size_t stinger_audio_ring_read(struct stinger_audio_ring *ring,
+		float *const data[], size_t frames)
+{
+	long pos = ring->read_pos;
+	size_t available = stinger_audio_ring_distance(pos,
+			os_atomic_load_long(&ring->write_pos));
+
+	if (frames > available)
+		frames = available;
+	if (!frames)
+		return 0;
+
+	copy_frames(ring, pos, NULL, data, frames);
+	os_atomic_set_long(&ring->read_pos,
+			(long)((unsigned long)pos + frames));
+	stinger_audio_ring_wake(ring);
+	return frames;
+}
+
+size_t stinger_audio_ring_skip(struct stinger_audio_ring *ring,
+		size_t frames)
+{
+	long pos = ring->read_pos;
+	size_t available = stinger_audio_ring_distance(pos,
+			os_atomic_load_long(&ring->write_pos));
+
+	if (frames > available)
+		frames = available;
+
+	os_atomic_set_long(&ring->read_pos,
+			(long)((unsigned long)pos + frames));
+	if (frames)
+		stinger_audio_ring_wake(ring);
+	return frames;
+}
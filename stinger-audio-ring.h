@@ -0,0 +1,77 @@
+#pragma once
+
+#include <obs-module.h>
+#include <util/threading.h>
+
+/* Single-producer/single-consumer ring of planar float samples at the
+ * output sample rate. The decoder thread writes and the audio thread reads
+ * without taking a lock: each side only advances its own position, and
+ * positions are published with atomic stores. The storage is allocated
+ * once, when the ring is created. Positions are running frame counts that
+ * are allowed to wrap. A producer that has to wait for room sleeps on an
+ * event the consumer signals whenever it frees some.
+ *
+ * Clips are numbered by whoever starts them. The producer marks where each
+ * clip begins and ends, so the consumer can find the start of the clip it
+ * was asked to play and knows when that clip is over rather than starved. */
+
+struct stinger_audio_ring {
+	float *planes[MAX_AUDIO_CHANNELS];
+	size_t channels;
+	size_t capacity;
+
+	volatile long write_pos;
+	volatile long read_pos;
+
+	/* manual reset, signaled by reads and skips */
+	os_event_t *space;
+
+	/* producer side markers, the position is stored before the clip */
+	volatile long start_clip;
+	volatile long start_pos;
+	volatile long end_clip;
+	volatile long end_pos;
+};
+
+extern void stinger_audio_ring_init(struct stinger_audio_ring *ring,
+		size_t channels, size_t min_frames);
+extern void stinger_audio_ring_free(struct stinger_audio_ring *ring);
+
+/* producer side, return the number of frames actually stored */
+extern size_t stinger_audio_ring_write(struct stinger_audio_ring *ring,
+		const float *const data[], size_t frames);
+extern size_t stinger_audio_ring_write_silence(
+		struct stinger_audio_ring *ring, size_t frames);
+
+/* Blocks until there is room for frames (at most the capacity), another
+ * read or skip happened, or stinger_audio_ring_wake() was called; returns
+ * right away once cancel is set. Callers check for room again. */
+extern void stinger_audio_ring_wait(struct stinger_audio_ring *ring,
+		size_t frames, volatile bool *cancel);
+
+/* Wakes a waiting producer, after setting its cancel flag */
+extern void stinger_audio_ring_wake(struct stinger_audio_ring *ring);
+
+extern void stinger_audio_ring_begin_clip(struct stinger_audio_ring *ring,
+		long clip);
+extern void stinger_audio_ring_end_clip(struct stinger_audio_ring *ring,
+		long clip);
+
+/* consumer side */
+extern size_t stinger_audio_ring_read(struct stinger_audio_ring *ring,
+		float *const data[], size_t frames);
+extern size_t stinger_audio_ring_skip(struct stinger_audio_ring *ring,
+		size_t frames);
+
+static inline size_t stinger_audio_ring_distance(long from, long to)
+{
+	return (size_t)((unsigned long)to - (unsigned long)from);
+}
+
+static inline size_t stinger_audio_ring_readable(
+		struct stinger_audio_ring *ring)
+{
+	return stinger_audio_ring_distance(
+			os_atomic_load_long(&ring->read_pos),
+			os_atomic_load_long(&ring->write_pos));
+}
@@ -0,0 +1,293 @@
+#include <obs-module.h>
+#include <util/threading.h>
+#include <util/platform.h>
+
+#include "stinger-cache-prefetch.h"
+
+struct prefetch_slot {
+	uint8_t *data;
+	int64_t index;
+	bool busy;
+};
+
+struct stinger_cache_prefetch {
+	pthread_t thread;
+	bool thread_active;
+	os_event_t *wake;
+	os_event_t *idle;
+	volatile bool exit;
+
+	/* everything below is protected by the mutex, except the contents
+	 * of a busy slot, which belong to the thread filling it */
+	pthread_mutex_t mutex;
+	const struct stinger_frame_cache *cache;
+	size_t frame_size;
+	int64_t next;
+	struct prefetch_slot slots[STINGER_PREFETCH_FRAMES];
+	uint8_t *scratch;
+
+	uint64_t prefetched;
+	uint64_t unpacked_inline;
+	uint64_t unpack_ns_total;
+	uint64_t unpack_ns_max;
+	uint64_t unpacks;
+};
+
+static void record_unpack(struct stinger_cache_prefetch *pf, uint64_t ns)
+{
+	pf->unpacks++;
+	pf->unpack_ns_total += ns;
+	if (ns > pf->unpack_ns_max)
+		pf->unpack_ns_max = ns;
+}
+
+static struct prefetch_slot *find_slot(struct stinger_cache_prefetch *pf,
+		int64_t index)
+{
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+		if (pf->slots[i].index == index && !pf->slots[i].busy)
+			return &pf->slots[i];
+	return NULL;
+}
+
+static bool is_queued(struct stinger_cache_prefetch *pf, int64_t index)
+{
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+		if (pf->slots[i].index == index)
+			return true;
+	return false;
+}
+
+/* Picks the next frame to unpack and a slot that doesn't hold one of the
+ * frames about to be shown. Called with the mutex held. */
+static struct prefetch_slot *next_job(struct stinger_cache_prefetch *pf,
+		int64_t *index)
+{
+	int64_t end;
+
+	if (!pf->cache || pf->next < 0)
+		return NULL;
+
+	end = pf->next + STINGER_PREFETCH_FRAMES;
+	if (end > (int64_t)pf->cache->frames.num)
+		end = (int64_t)pf->cache->frames.num;
+
+	for (*index = pf->next; *index < end; (*index)++) {
+		if (is_queued(pf, *index))
+			continue;
+
+		for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++) {
+			struct prefetch_slot *slot = &pf->slots[i];
+
+			if (!slot->busy && (slot->index < pf->next ||
+			                    slot->index >= end))
+				return slot;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct stinger_cache_prefetch *pf = data;
+
+	os_set_thread_name("stinger: cache prefetch");
+
+	pthread_mutex_lock(&pf->mutex);
+	while (!os_atomic_load_bool(&pf->exit)) {
+		const struct stinger_frame_cache *cache = pf->cache;
+		struct prefetch_slot *slot;
+		uint64_t start;
+		int64_t index;
+		bool success;
+
+		slot = next_job(pf, &index);
+		if (!slot) {
+			pthread_mutex_unlock(&pf->mutex);
+			os_event_wait(pf->wake);
+			pthread_mutex_lock(&pf->mutex);
+			continue;
+		}
+
+		slot->busy = true;
+		slot->index = index;
+		pthread_mutex_unlock(&pf->mutex);
+
+		start = os_gettime_ns();
+		success = stinger_frame_cache_unpack(cache, (size_t)index,
+				slot->data, (int)cache->linesize);
+
+		pthread_mutex_lock(&pf->mutex);
+		slot->busy = false;
+		if (!success)
+			slot->index = -1;
+		else
+			record_unpack(pf, os_gettime_ns() - start);
+		os_event_signal(pf->idle);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return NULL;
+}
+
+struct stinger_cache_prefetch *stinger_cache_prefetch_create(void)
+{
+	struct stinger_cache_prefetch *pf = bzalloc(sizeof(*pf));
+
+	pthread_mutex_init(&pf->mutex, NULL);
+	pf->next = -1;
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+		pf->slots[i].index = -1;
+
+	if (os_event_init(&pf->wake, OS_EVENT_TYPE_AUTO) != 0 ||
+	    os_event_init(&pf->idle, OS_EVENT_TYPE_AUTO) != 0 ||
+	    pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0) {
+		blog(LOG_WARNING, "stinger: failed to start cache prefetch "
+				"thread, frames will be unpacked on display");
+		return pf;
+	}
+
+	pf->thread_active = true;
+	return pf;
+}
+
+static void free_buffers(struct stinger_cache_prefetch *pf)
+{
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++) {
+		bfree(pf->slots[i].data);
+		pf->slots[i].data = NULL;
+		pf->slots[i].index = -1;
+	}
+
+	bfree(pf->scratch);
+	pf->scratch = NULL;
+	pf->frame_size = 0;
+}
+
+void stinger_cache_prefetch_destroy(struct stinger_cache_prefetch *pf)
+{
+	if (!pf)
+		return;
+
+	if (pf->thread_active) {
+		os_atomic_set_bool(&pf->exit, true);
+		os_event_signal(pf->wake);
+		pthread_join(pf->thread, NULL);
+	}
+
+	free_buffers(pf);
+	os_event_destroy(pf->wake);
+	os_event_destroy(pf->idle);
+	pthread_mutex_destroy(&pf->mutex);
+	bfree(pf);
+}
+
+static bool any_busy(struct stinger_cache_prefetch *pf)
+{
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+		if (pf->slots[i].busy)
+			return true;
+	return false;
+}
+
+void stinger_cache_prefetch_set_cache(struct stinger_cache_prefetch *pf,
+		const struct stinger_frame_cache *cache)
+{
+	size_t frame_size = cache ? stinger_frame_cache_frame_size(cache) : 0;
+
+	pthread_mutex_lock(&pf->mutex);
+
+	/* the thread only reads the cache while a slot is busy, and signals
+	 * idle each time it's done with one */
+	pf->cache = NULL;
+	while (any_busy(pf)) {
+		pthread_mutex_unlock(&pf->mutex);
+		os_event_wait(pf->idle);
+		pthread_mutex_lock(&pf->mutex);
+	}
+
+	if (frame_size != pf->frame_size) {
+		free_buffers(pf);
+		if (frame_size) {
+			for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+				pf->slots[i].data = bmalloc(frame_size);
+			pf->scratch = bmalloc(frame_size);
+		}
+		pf->frame_size = frame_size;
+	}
+
+	for (size_t i = 0; i < STINGER_PREFETCH_FRAMES; i++)
+		pf->slots[i].index = -1;
+	pf->cache = cache;
+	pf->next = -1;
+
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+const uint8_t *stinger_cache_prefetch_lock(struct stinger_cache_prefetch *pf,
+		size_t index)
+{
+	struct prefetch_slot *slot;
+	const uint8_t *data = NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+
+	if (!pf->cache) {
+		pthread_mutex_unlock(&pf->mutex);
+		return NULL;
+	}
+
+	slot = find_slot(pf, (int64_t)index);
+	if (slot) {
+		pf->prefetched++;
+		data = slot->data;
+	} else {
+		uint64_t start = os_gettime_ns();
+
+		if (stinger_frame_cache_unpack(pf->cache, index, pf->scratch,
+					(int)pf->cache->linesize)) {
+			record_unpack(pf, os_gettime_ns() - start);
+			data = pf->scratch;
+		}
+		pf->unpacked_inline++;
+	}
+
+	pf->next = (int64_t)index + 1;
+	if (pf->thread_active)
+		os_event_signal(pf->wake);
+
+	if (!data)
+		pthread_mutex_unlock(&pf->mutex);
+	return data;
+}
+
+void stinger_cache_prefetch_unlock(struct stinger_cache_prefetch *pf)
+{
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+void stinger_cache_prefetch_log_stats(struct stinger_cache_prefetch *pf,
+		const char *name)
+{
+	pthread_mutex_lock(&pf->mutex);
+
+	if (pf->unpacks)
+		blog(LOG_INFO, "stinger '%s': unpacked cached frames in "
+				"%.3f ms avg, %.3f ms max, %llu ready in "
+				"time, %llu unpacked on display", name,
+				(double)pf->unpack_ns_total /
+					(double)pf->unpacks / 1e6,
+				(double)pf->unpack_ns_max / 1e6,
+				(unsigned long long)pf->prefetched,
+				(unsigned long long)pf->unpacked_inline);
+
+	pf->prefetched = 0;
+	pf->unpacked_inline = 0;
+	pf->unpack_ns_total = 0;
+	pf->unpack_ns_max = 0;
+	pf->unpacks = 0;
+
+	pthread_mutex_unlock(&pf->mutex);
+}
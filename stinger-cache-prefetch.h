@@ -0,0 +1,31 @@
+#pragma once
+
+#include "stinger-frame-cache.h"
+
+/* Unpacks frames of a compact frame cache just ahead of display. Each time
+ * the renderer asks for a frame, the frames after it are unpacked into a
+ * few BGRA buffers on a background thread, so the render thread normally
+ * only uploads. A frame that wasn't ready in time is unpacked on the
+ * calling thread instead. */
+
+#define STINGER_PREFETCH_FRAMES 3
+
+struct stinger_cache_prefetch;
+
+extern struct stinger_cache_prefetch *stinger_cache_prefetch_create(void);
+extern void stinger_cache_prefetch_destroy(struct stinger_cache_prefetch *pf);
+
+/* Switches to another cache (or none), waiting for unpacking of the
+ * previous one to finish, so the previous one can be released after */
+extern void stinger_cache_prefetch_set_cache(struct stinger_cache_prefetch *pf,
+		const struct stinger_frame_cache *cache);
+
+/* Returns the unpacked frame, which stays valid until
+ * stinger_cache_prefetch_unlock() is called. NULL (and nothing to unlock)
+ * if there's no cache or unpacking failed. */
+extern const uint8_t *stinger_cache_prefetch_lock(
+		struct stinger_cache_prefetch *pf, size_t index);
+extern void stinger_cache_prefetch_unlock(struct stinger_cache_prefetch *pf);
+
+extern void stinger_cache_prefetch_log_stats(struct stinger_cache_prefetch *pf,
+		const char *name);
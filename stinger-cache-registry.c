@@ -0,0 +1,338 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include <sys/stat.h>
+
+#include "stinger-cache-registry.h"
+
+struct stinger_cache_entry {
+	char *path;
+	int64_t file_size;
+	int64_t file_mtime;
+	enum stinger_cache_storage storage;
+	uint32_t max_width;
+	uint32_t max_height;
+
+	/* protected by the registry mutex; unlinked once the entry is out of
+	 * the registry and only waits to be destroyed */
+	long refs;
+	uint64_t last_used;
+	bool unlinked;
+
+	struct stinger_frame_cache cache;
+	pthread_t fill_thread;
+	bool fill_thread_active;
+	volatile bool ready;
+	volatile bool abort;
+};
+
+/* entries taken out of the registry under the mutex, destroyed once it's
+ * released: destroying joins the fill thread, which may be waiting for the
+ * mutex itself */
+struct evicted_entries {
+	DARRAY(struct stinger_cache_entry *) entries;
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DARRAY(struct stinger_cache_entry *) entries;
+static size_t budget = 1024 * 1024 * 1024;
+static size_t resident = 0;
+static uint64_t use_clock = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t evictions = 0;
+
+void stinger_cache_registry_init(void)
+{
+	da_init(entries);
+}
+
+static void entry_destroy(struct stinger_cache_entry *entry)
+{
+	if (entry->fill_thread_active) {
+		os_atomic_set_bool(&entry->abort, true);
+		pthread_join(entry->fill_thread, NULL);
+	}
+
+	stinger_frame_cache_free(&entry->cache);
+	bfree(entry->path);
+	bfree(entry);
+}
+
+static void destroy_evicted(struct evicted_entries *evicted)
+{
+	for (size_t i = 0; i < evicted->entries.num; i++)
+		entry_destroy(evicted->entries.array[i]);
+	da_free(evicted->entries);
+}
+
+void stinger_cache_registry_free(void)
+{
+	stinger_cache_registry_log_stats();
+
+	/* every transition has been destroyed, nothing references these */
+	for (size_t i = 0; i < entries.num; i++)
+		entry_destroy(entries.array[i]);
+	da_free(entries);
+	resident = 0;
+}
+
+/* Takes the least recently used entries nobody references out of the
+ * registry until the cached clips fit the budget again. Called with the
+ * mutex held; the entries are destroyed after it's released. */
+static void evict_entries(struct evicted_entries *evicted)
+{
+	while (resident > budget) {
+		struct stinger_cache_entry *lru = NULL;
+		size_t lru_idx = 0;
+
+		for (size_t i = 0; i < entries.num; i++) {
+			struct stinger_cache_entry *entry = entries.array[i];
+
+			if (entry->refs || !entry->ready)
+				continue;
+			if (!lru || entry->last_used < lru->last_used) {
+				lru = entry;
+				lru_idx = i;
+			}
+		}
+
+		if (!lru)
+			break;
+
+		blog(LOG_INFO, "stinger: evicting cached '%s' (%.1f MiB)",
+				lru->path, (double)lru->cache.memory_used /
+				(1024.0 * 1024.0));
+
+		resident -= lru->cache.memory_used;
+		evictions++;
+		lru->unlinked = true;
+		da_erase(entries, lru_idx);
+		da_push_back(evicted->entries, &lru);
+	}
+}
+
+void stinger_cache_registry_set_budget(size_t new_budget)
+{
+	struct evicted_entries evicted = {0};
+
+	pthread_mutex_lock(&registry_mutex);
+	budget = new_budget;
+	evict_entries(&evicted);
+	pthread_mutex_unlock(&registry_mutex);
+
+	destroy_evicted(&evicted);
+}
+
+/* What a new clip may use: the budget less what referenced clips hold,
+ * since only unreferenced ones can be evicted to make room */
+static size_t available_budget(void)
+{
+	size_t pinned = 0;
+
+	for (size_t i = 0; i < entries.num; i++) {
+		struct stinger_cache_entry *entry = entries.array[i];
+
+		if (entry->refs && entry->ready)
+			pinned += entry->cache.memory_used;
+	}
+
+	return pinned < budget ? budget - pinned : 0;
+}
+
+static void *fill_thread(void *data)
+{
+	struct stinger_cache_entry *entry = data;
+	struct stinger_frame_cache cache = {0};
+	struct evicted_entries evicted = {0};
+	enum stinger_cache_result result;
+	uint64_t start = os_gettime_ns();
+	size_t fill_budget;
+	double elapsed;
+	bool linked;
+
+	os_set_thread_name("stinger: frame cache");
+
+	pthread_mutex_lock(&registry_mutex);
+	fill_budget = available_budget();
+	pthread_mutex_unlock(&registry_mutex);
+
+	result = stinger_frame_cache_fill(&cache, entry->path, entry->storage,
+			entry->max_width, entry->max_height, fill_budget,
+			&entry->abort);
+
+	switch (result) {
+	case STINGER_CACHE_FILLED:
+		elapsed = (double)(os_gettime_ns() - start) / 1e9;
+		blog(LOG_INFO, "stinger: cached %d frames (%ux%u) of '%s' "
+				"as %s using %.1f MiB (%.0f%% of BGRA) "
+				"in %.2f s (%.1f fps on %d cores)",
+				(int)cache.frames.num, cache.width,
+				cache.height, entry->path,
+				stinger_cache_storage_name(cache.storage),
+				(double)cache.memory_used / (1024.0 * 1024.0),
+				100.0 * (double)cache.memory_used /
+				(double)(stinger_frame_cache_frame_size(&cache) *
+					cache.frames.num),
+				elapsed, (double)cache.frames.num / elapsed,
+				os_get_logical_cores());
+
+		/* an entry released while it was filling is already on its
+		 * way out, its frames go with it and never count as
+		 * resident */
+		pthread_mutex_lock(&registry_mutex);
+		entry->cache = cache;
+		linked = !entry->unlinked &&
+			!os_atomic_load_bool(&entry->abort);
+		if (linked) {
+			resident += cache.memory_used;
+			os_atomic_set_bool(&entry->ready, true);
+			evict_entries(&evicted);
+		}
+		pthread_mutex_unlock(&registry_mutex);
+
+		destroy_evicted(&evicted);
+		if (linked)
+			stinger_cache_registry_log_stats();
+		break;
+	case STINGER_CACHE_OVER_BUDGET:
+		blog(LOG_INFO, "stinger: '%s' does not fit into the %d MiB "
+				"left in the frame cache budget, using "
+				"streaming decode", entry->path,
+				(int)(fill_budget / (1024 * 1024)));
+		break;
+	case STINGER_CACHE_FAILED:
+		blog(LOG_WARNING, "stinger: failed to cache '%s', using "
+				"streaming decode", entry->path);
+		break;
+	case STINGER_CACHE_ABORTED:
+		break;
+	}
+
+	return NULL;
+}
+
+static struct stinger_cache_entry *find_entry(const char *path,
+		const struct stat *st, enum stinger_cache_storage storage,
+		uint32_t max_width, uint32_t max_height)
+{
+	for (size_t i = 0; i < entries.num; i++) {
+		struct stinger_cache_entry *entry = entries.array[i];
+
+		if (entry->storage == storage &&
+		    entry->max_width == max_width &&
+		    entry->max_height == max_height &&
+		    entry->file_size == (int64_t)st->st_size &&
+		    entry->file_mtime == (int64_t)st->st_mtime &&
+		    strcmp(entry->path, path) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+struct stinger_cache_entry *stinger_cache_registry_acquire(const char *path,
+		enum stinger_cache_storage storage, uint32_t max_width,
+		uint32_t max_height)
+{
+	struct stinger_cache_entry *entry;
+	struct stat st;
+
+	if (!path || !*path || os_stat(path, &st) != 0)
+		return NULL;
+
+	pthread_mutex_lock(&registry_mutex);
+
+	entry = find_entry(path, &st, storage, max_width, max_height);
+	if (entry) {
+		hits++;
+	} else {
+		misses++;
+
+		entry = bzalloc(sizeof(*entry));
+		entry->path = bstrdup(path);
+		entry->file_size = (int64_t)st.st_size;
+		entry->file_mtime = (int64_t)st.st_mtime;
+		entry->storage = storage;
+		entry->max_width = max_width;
+		entry->max_height = max_height;
+		da_push_back(entries, &entry);
+
+		if (pthread_create(&entry->fill_thread, NULL, fill_thread,
+					entry) != 0)
+			blog(LOG_WARNING, "stinger: failed to create frame "
+					"cache thread");
+		else
+			entry->fill_thread_active = true;
+	}
+
+	entry->refs++;
+	entry->last_used = ++use_clock;
+	pthread_mutex_unlock(&registry_mutex);
+
+	return entry;
+}
+
+void stinger_cache_registry_release(struct stinger_cache_entry *entry)
+{
+	struct evicted_entries evicted = {0};
+	bool destroy = false;
+
+	if (!entry)
+		return;
+
+	pthread_mutex_lock(&registry_mutex);
+	if (--entry->refs == 0) {
+		/* keep filled clips around for the next user, but don't hold
+		 * on to clips that are still decoding or couldn't be cached */
+		if (!entry->ready) {
+			entry->unlinked = true;
+			da_erase_item(entries, &entry);
+			destroy = true;
+		} else {
+			evict_entries(&evicted);
+		}
+	}
+	pthread_mutex_unlock(&registry_mutex);
+
+	/* joins the fill thread, which takes the mutex when it's done */
+	if (destroy)
+		entry_destroy(entry);
+	destroy_evicted(&evicted);
+}
+
+const struct stinger_frame_cache *stinger_cache_entry_frames(
+		struct stinger_cache_entry *entry)
+{
+	return entry && os_atomic_load_bool(&entry->ready) ?
+		&entry->cache : NULL;
+}
+
+void stinger_cache_entry_touch(struct stinger_cache_entry *entry)
+{
+	pthread_mutex_lock(&registry_mutex);
+	entry->last_used = ++use_clock;
+	pthread_mutex_unlock(&registry_mutex);
+}
+
+void stinger_cache_registry_log_stats(void)
+{
+	size_t referenced = 0;
+
+	pthread_mutex_lock(&registry_mutex);
+	for (size_t i = 0; i < entries.num; i++)
+		if (entries.array[i]->refs)
+			referenced++;
+
+	blog(LOG_INFO, "stinger: frame cache %.1f of %.1f MiB resident in "
+			"%d clips (%d in use), %llu hits, %llu misses, "
+			"%llu evictions",
+			(double)resident / (1024.0 * 1024.0),
+			(double)budget / (1024.0 * 1024.0),
+			(int)entries.num, (int)referenced,
+			(unsigned long long)hits,
+			(unsigned long long)misses,
+			(unsigned long long)evictions);
+	pthread_mutex_unlock(&registry_mutex);
+}
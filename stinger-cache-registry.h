@@ -0,0 +1,36 @@
+#pragma once
+
+#include "stinger-frame-cache.h"
+
+/* Module-wide registry of decoded clips, shared by every transition that
+ * preloads the same file. Entries are keyed by path, the file's size and
+ * modification time, the storage layout and the size frames are fitted
+ * into, and are refcounted by the transitions using them.
+ * Entries nobody references stay resident until the decoded frames of all
+ * entries exceed the global budget, then the least recently used ones are
+ * evicted. */
+
+struct stinger_cache_entry;
+
+extern void stinger_cache_registry_init(void);
+extern void stinger_cache_registry_free(void);
+
+/* Budget in bytes for every cached clip together */
+extern void stinger_cache_registry_set_budget(size_t budget);
+
+/* Takes a reference to the entry for path, starting to decode it in the
+ * background on a miss. NULL if the file doesn't exist. */
+extern struct stinger_cache_entry *stinger_cache_registry_acquire(
+		const char *path, enum stinger_cache_storage storage,
+		uint32_t max_width, uint32_t max_height);
+extern void stinger_cache_registry_release(struct stinger_cache_entry *entry);
+
+/* The decoded frames once the entry is filled, NULL before that or if the
+ * clip couldn't be cached. Stays valid while the reference is held. */
+extern const struct stinger_frame_cache *stinger_cache_entry_frames(
+		struct stinger_cache_entry *entry);
+
+/* Marks the entry as used, for LRU eviction */
+extern void stinger_cache_entry_touch(struct stinger_cache_entry *entry);
+
+extern void stinger_cache_registry_log_stats(void);
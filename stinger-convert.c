@@ -0,0 +1,659 @@
+#include <obs-module.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/cpu.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "obs-ffmpeg-formats.h"
+#include "stinger-convert.h"
+#include "stinger-texture-ring.h"
+#include "stinger-threadpool.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || \
+	defined(__i386__)
+#define STINGER_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+#define ROWS_PER_BAND 32
+
+/* Samples are scaled to 8 bit Q6 (10 bit samples << 4), coefficients are
+ * Q13, so every product fits the 16 bit lanes and mulhi leaves Q3 results */
+struct yuv_coeffs {
+	int16_t y_offset;
+	int16_t cy;
+	int16_t crv;
+	int16_t cgu;
+	int16_t cgv;
+	int16_t cbu;
+};
+
+#define C_OFFSET (128 << 6)
+#define Q13(x) ((int16_t)((x) * 8192.0 + 0.5))
+
+struct yuva_format {
+	int format;
+	int hshift;
+	int vshift;
+	int depth;
+};
+
+static const struct yuva_format yuva_formats[] = {
+	{AV_PIX_FMT_YUVA420P,   1, 1, 8},
+	{AV_PIX_FMT_YUVA422P,   1, 0, 8},
+	{AV_PIX_FMT_YUVA444P,   0, 0, 8},
+	{AV_PIX_FMT_YUVA420P10, 1, 1, 10},
+	{AV_PIX_FMT_YUVA422P10, 1, 0, 10},
+	{AV_PIX_FMT_YUVA444P10, 0, 0, 10},
+};
+
+typedef void (*convert_row_t)(uint8_t *dst, const void *y, const void *u,
+		const void *v, const void *a, int start, int width,
+		int hshift, const struct yuv_coeffs *c);
+
+struct convert_kernel {
+	const char *name;
+	convert_row_t row8;
+	convert_row_t row16;
+};
+
+static const struct yuva_format *find_format(int format)
+{
+	for (size_t i = 0; i < sizeof(yuva_formats) / sizeof(*yuva_formats);
+			i++) {
+		if (yuva_formats[i].format == format)
+			return &yuva_formats[i];
+	}
+
+	return NULL;
+}
+
+static void get_coeffs(struct yuv_coeffs *c, const AVFrame *frame)
+{
+	bool full = frame->color_range == AVCOL_RANGE_JPEG;
+	bool bt709 = frame->colorspace == AVCOL_SPC_BT709;
+
+	c->y_offset = full ? 0 : (16 << 6);
+	c->cy = full ? Q13(1.0) : Q13(255.0 / 219.0);
+
+	if (bt709) {
+		c->crv = full ? Q13(1.5748) : Q13(1.7927);
+		c->cgu = full ? Q13(0.1873) : Q13(0.2132);
+		c->cgv = full ? Q13(0.4681) : Q13(0.5329);
+		c->cbu = full ? Q13(1.8556) : Q13(2.1124);
+	} else {
+		c->crv = full ? Q13(1.4020) : Q13(1.5960);
+		c->cgu = full ? Q13(0.3441) : Q13(0.3917);
+		c->cgv = full ? Q13(0.7141) : Q13(0.8129);
+		c->cbu = full ? Q13(1.7720) : Q13(2.0172);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar reference */
+
+static inline int mulhi(int a, int b)
+{
+	return (a * b) >> 16;
+}
+
+static inline int clamp_u8(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* exact round(v * a / 255) */
+static inline uint8_t premultiply(int v, int a)
+{
+	int t = v * a + 128;
+	return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static inline void convert_pixel(uint8_t *dst, int y, int u, int v, int a,
+		const struct yuv_coeffs *c)
+{
+	int yy = mulhi(y - c->y_offset, c->cy);
+	int uu = u - C_OFFSET;
+	int vv = v - C_OFFSET;
+	int r = clamp_u8((yy + mulhi(vv, c->crv) + 4) >> 3);
+	int g = clamp_u8((yy - mulhi(uu, c->cgu) - mulhi(vv, c->cgv) + 4) >> 3);
+	int b = clamp_u8((yy + mulhi(uu, c->cbu) + 4) >> 3);
+
+	dst[0] = premultiply(b, a);
+	dst[1] = premultiply(g, a);
+	dst[2] = premultiply(r, a);
+	dst[3] = (uint8_t)a;
+}
+
+static void row8_c(uint8_t *dst, const void *y_, const void *u_,
+		const void *v_, const void *a_, int start, int width,
+		int hshift, const struct yuv_coeffs *c)
+{
+	const uint8_t *y = y_, *u = u_, *v = v_, *a = a_;
+
+	for (int x = start; x < width; x++)
+		convert_pixel(dst + x * 4, y[x] << 6, u[x >> hshift] << 6,
+				v[x >> hshift] << 6, a[x], c);
+}
+
+static void row16_c(uint8_t *dst, const void *y_, const void *u_,
+		const void *v_, const void *a_, int start, int width,
+		int hshift, const struct yuv_coeffs *c)
+{
+	const uint16_t *y = y_, *u = u_, *v = v_, *a = a_;
+
+	for (int x = start; x < width; x++)
+		convert_pixel(dst + x * 4, y[x] << 4, u[x >> hshift] << 4,
+				v[x >> hshift] << 4, a[x] >> 2, c);
+}
+
+#ifdef STINGER_X86
+
+/* ------------------------------------------------------------------------- */
+/* SSE2, 8 pixels per iteration */
+
+struct coeffs_sse2 {
+	__m128i y_offset, c_offset, cy, crv, cgu, cgv, cbu;
+	__m128i four, bias, max;
+};
+
+static inline void load_coeffs_sse2(struct coeffs_sse2 *k,
+		const struct yuv_coeffs *c)
+{
+	k->y_offset = _mm_set1_epi16(c->y_offset);
+	k->c_offset = _mm_set1_epi16(C_OFFSET);
+	k->cy = _mm_set1_epi16(c->cy);
+	k->crv = _mm_set1_epi16(c->crv);
+	k->cgu = _mm_set1_epi16(c->cgu);
+	k->cgv = _mm_set1_epi16(c->cgv);
+	k->cbu = _mm_set1_epi16(c->cbu);
+	k->four = _mm_set1_epi16(4);
+	k->bias = _mm_set1_epi16(128);
+	k->max = _mm_set1_epi16(255);
+}
+
+static inline __m128i clamp_sse2(__m128i v, const struct coeffs_sse2 *k)
+{
+	v = _mm_srai_epi16(_mm_add_epi16(v, k->four), 3);
+	v = _mm_max_epi16(v, _mm_setzero_si128());
+	return _mm_min_epi16(v, k->max);
+}
+
+static inline __m128i premultiply_sse2(__m128i v, __m128i a,
+		const struct coeffs_sse2 *k)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), k->bias);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline void convert8_sse2(uint8_t *dst, __m128i y, __m128i u,
+		__m128i v, __m128i a, const struct coeffs_sse2 *k)
+{
+	__m128i yy, r, g, b, bg, ra;
+
+	y = _mm_sub_epi16(y, k->y_offset);
+	u = _mm_sub_epi16(u, k->c_offset);
+	v = _mm_sub_epi16(v, k->c_offset);
+
+	yy = _mm_mulhi_epi16(y, k->cy);
+	r = _mm_add_epi16(yy, _mm_mulhi_epi16(v, k->crv));
+	g = _mm_sub_epi16(_mm_sub_epi16(yy, _mm_mulhi_epi16(u, k->cgu)),
+			_mm_mulhi_epi16(v, k->cgv));
+	b = _mm_add_epi16(yy, _mm_mulhi_epi16(u, k->cbu));
+
+	r = premultiply_sse2(clamp_sse2(r, k), a, k);
+	g = premultiply_sse2(clamp_sse2(g, k), a, k);
+	b = premultiply_sse2(clamp_sse2(b, k), a, k);
+
+	bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+	ra = _mm_or_si128(r, _mm_slli_epi16(a, 8));
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+static inline __m128i load8_u8(const uint8_t *p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p),
+			_mm_setzero_si128());
+}
+
+static inline __m128i load4_u8_dup(const uint8_t *p)
+{
+	int32_t v;
+	__m128i x;
+
+	memcpy(&v, p, sizeof(v));
+	x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128());
+	return _mm_unpacklo_epi16(x, x);
+}
+
+static void row8_sse2(uint8_t *dst, const void *y_, const void *u_,
+		const void *v_, const void *a_, int start, int width,
+		int hshift, const struct yuv_coeffs *c)
+{
+	const uint8_t *y = y_, *u = u_, *v = v_, *a = a_;
+	struct coeffs_sse2 k;
+	int x = start;
+
+	load_coeffs_sse2(&k, c);
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i uu, vv;
+
+		if (hshift) {
+			uu = load4_u8_dup(u + (x >> 1));
+			vv = load4_u8_dup(v + (x >> 1));
+		} else {
+			uu = load8_u8(u + x);
+			vv = load8_u8(v + x);
+		}
+
+		convert8_sse2(dst + x * 4,
+				_mm_slli_epi16(load8_u8(y + x), 6),
+				_mm_slli_epi16(uu, 6),
+				_mm_slli_epi16(vv, 6),
+				load8_u8(a + x), &k);
+	}
+
+	row8_c(dst, y_, u_, v_, a_, x, width, hshift, c);
+}
+
+static inline __m128i load4_u16_dup(const uint16_t *p)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i *)p);
+	return _mm_unpacklo_epi16(x, x);
+}
+
+static void row16_sse2(uint8_t *dst, const void *y_, const void *u_,
+		const void *v_, const void *a_, int start, int width,
+		int hshift, const struct yuv_coeffs *c)
+{
+	const uint16_t *y = y_, *u = u_, *v = v_, *a = a_;
+	struct coeffs_sse2 k;
+	int x = start;
+
+	load_coeffs_sse2(&k, c);
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i uu, vv;
+
+		if (hshift) {
+			uu = load4_u16_dup(u + (x >> 1));
+			vv = load4_u16_dup(v + (x >> 1));
+		} else {
+			uu = _mm_loadu_si128((const __m128i *)(u + x));
+			vv = _mm_loadu_si128((const __m128i *)(v + x));
+		}
+
+		convert8_sse2(dst + x * 4,
+				_mm_slli_epi16(_mm_loadu_si128(
+						(const __m128i *)(y + x)), 4),
+				_mm_slli_epi16(uu, 4),
+				_mm_slli_epi16(vv, 4),
+				_mm_srli_epi16(_mm_loadu_si128(
+						(const __m128i *)(a + x)), 2),
+				&k);
+	}
+
+	row16_c(dst, y_, u_, v_, a_, x, width, hshift, c);
+}
+
+/* ------------------------------------------------------------------------- */
+/* AVX2, 16 pixels per iteration */
+
+struct coeffs_avx2 {
+	__m256i y_offset, c_offset, cy, crv, cgu, cgv, cbu;
+	__m256i four, bias, max;
+};
+
+static inline TARGET_AVX2 void load_coeffs_avx2(struct coeffs_avx2 *k,
+		const struct yuv_coeffs *c)
+{
+	k->y_offset = _mm256_set1_epi16(c->y_offset);
+	k->c_offset = _mm256_set1_epi16(C_OFFSET);
+	k->cy = _mm256_set1_epi16(c->cy);
+	k->crv = _mm256_set1_epi16(c->crv);
+	k->cgu = _mm256_set1_epi16(c->cgu);
+	k->cgv = _mm256_set1_epi16(c->cgv);
+	k->cbu = _mm256_set1_epi16(c->cbu);
+	k->four = _mm256_set1_epi16(4);
+	k->bias = _mm256_set1_epi16(128);
+	k->max = _mm256_set1_epi16(255);
+}
+
+static inline TARGET_AVX2 __m256i clamp_avx2(__m256i v,
+		const struct coeffs_avx2 *k)
+{
+	v = _mm256_srai_epi16(_mm256_add_epi16(v, k->four), 3);
+	v = _mm256_max_epi16(v, _mm256_setzero_si256());
+	return _mm256_min_epi16(v, k->max);
+}
+
+static inline TARGET_AVX2 __m256i premultiply_avx2(__m256i v, __m256i a,
+		const struct coeffs_avx2 *k)
+{
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), k->bias);
+	return _mm256_srli_epi16(
+			_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+static inline TARGET_AVX2 void convert16_avx2(uint8_t *dst, __m256i y,
+		__m256i u, __m256i v, __m256i a, const struct coeffs_avx2 *k)
+{
+	__m256i yy, r, g, b, bg, ra, lo, hi;
+
+	y = _mm256_sub_epi16(y, k->y_offset);
+	u = _mm256_sub_epi16(u, k->c_offset);
+	v = _mm256_sub_epi16(v, k->c_offset);
+
+	yy = _mm256_mulhi_epi16(y, k->cy);
+	r = _mm256_add_epi16(yy, _mm256_mulhi_epi16(v, k->crv));
+	g = _mm256_sub_epi16(
+			_mm256_sub_epi16(yy, _mm256_mulhi_epi16(u, k->cgu)),
+			_mm256_mulhi_epi16(v, k->cgv));
+	b = _mm256_add_epi16(yy, _mm256_mulhi_epi16(u, k->cbu));
+
+	r = premultiply_avx2(clamp_avx2(r, k), a, k);
+	g = premultiply_avx2(clamp_avx2(g, k), a, k);
+	b = premultiply_avx2(clamp_avx2(b, k), a, k);
+
+	bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+	ra = _mm256_or_si256(r, _mm256_slli_epi16(a, 8));
+
+	/* unpack works per 128 bit lane: lo = pixels 0-3, 8-11 and
+	 * hi = pixels 4-7, 12-15 */
+	lo = _mm256_unpacklo_epi16(bg, ra);
+	hi = _mm256_unpackhi_epi16(bg, ra);
+	_mm256_storeu_si256((__m256i *)dst,
+			_mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i *)(dst + 32),
+			_mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static inline TARGET_AVX2 __m256i dup_u16_avx2(__m128i x)
+{
+	return _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_unpacklo_epi16(x, x)),
+			_mm_unpackhi_epi16(x, x), 1);
+}
+
+static TARGET_AVX2 void row8_avx2(uint8_t *dst, const void *y_,
+		const void *u_, const void *v_, const void *a_, int start,
+		int width, int hshift, const struct yuv_coeffs *c)
+{
+	const uint8_t *y = y_, *u = u_, *v = v_, *a = a_;
+	struct coeffs_avx2 k;
+	int x = start;
+
+	load_coeffs_avx2(&k, c);
+
+	for (; x + 16 <= width; x += 16) {
+		__m256i uu, vv;
+
+		if (hshift) {
+			uu = dup_u16_avx2(_mm_cvtepu8_epi16(_mm_loadl_epi64(
+					(const __m128i *)(u + (x >> 1)))));
+			vv = dup_u16_avx2(_mm_cvtepu8_epi16(_mm_loadl_epi64(
+					(const __m128i *)(v + (x >> 1)))));
+		} else {
+			uu = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i *)(u + x)));
+			vv = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i *)(v + x)));
+		}
+
+		convert16_avx2(dst + x * 4,
+				_mm256_slli_epi16(_mm256_cvtepu8_epi16(
+					_mm_loadu_si128(
+						(const __m128i *)(y + x))), 6),
+				_mm256_slli_epi16(uu, 6),
+				_mm256_slli_epi16(vv, 6),
+				_mm256_cvtepu8_epi16(_mm_loadu_si128(
+						(const __m128i *)(a + x))),
+				&k);
+	}
+
+	row8_sse2(dst, y_, u_, v_, a_, x, width, hshift, c);
+}
+
+static TARGET_AVX2 void row16_avx2(uint8_t *dst, const void *y_,
+		const void *u_, const void *v_, const void *a_, int start,
+		int width, int hshift, const struct yuv_coeffs *c)
+{
+	const uint16_t *y = y_, *u = u_, *v = v_, *a = a_;
+	struct coeffs_avx2 k;
+	int x = start;
+
+	load_coeffs_avx2(&k, c);
+
+	for (; x + 16 <= width; x += 16) {
+		__m256i uu, vv;
+
+		if (hshift) {
+			uu = dup_u16_avx2(_mm_loadu_si128(
+					(const __m128i *)(u + (x >> 1))));
+			vv = dup_u16_avx2(_mm_loadu_si128(
+					(const __m128i *)(v + (x >> 1))));
+		} else {
+			uu = _mm256_loadu_si256((const __m256i *)(u + x));
+			vv = _mm256_loadu_si256((const __m256i *)(v + x));
+		}
+
+		convert16_avx2(dst + x * 4,
+				_mm256_slli_epi16(_mm256_loadu_si256(
+					(const __m256i *)(y + x)), 4),
+				_mm256_slli_epi16(uu, 4),
+				_mm256_slli_epi16(vv, 4),
+				_mm256_srli_epi16(_mm256_loadu_si256(
+					(const __m256i *)(a + x)), 2),
+				&k);
+	}
+
+	row16_sse2(dst, y_, u_, v_, a_, x, width, hshift, c);
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+static const struct convert_kernel kernel_c = {"c", row8_c, row16_c};
+#ifdef STINGER_X86
+static const struct convert_kernel kernel_sse2 = {
+	"sse2", row8_sse2, row16_sse2};
+static const struct convert_kernel kernel_avx2 = {
+	"avx2", row8_avx2, row16_avx2};
+#endif
+
+static const struct convert_kernel *kernel = &kernel_c;
+
+#ifdef STINGER_X86
+/* Runs a kernel over synthetic rows of every layout and compares it against
+ * the scalar reference */
+static bool kernel_matches_reference(const struct convert_kernel *k)
+{
+	enum { WIDTH = 77 };
+	uint16_t y16[WIDTH], u16[WIDTH], v16[WIDTH], a16[WIDTH];
+	uint8_t y8[WIDTH], u8[WIDTH], v8[WIDTH], a8[WIDTH];
+	uint8_t expected[WIDTH * 4], actual[WIDTH * 4];
+	struct yuv_coeffs c;
+	AVFrame frame = {0};
+	uint32_t seed = 0x5717u;
+
+	for (int i = 0; i < WIDTH; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		y16[i] = (uint16_t)((seed >> 8) & 1023);
+		u16[i] = (uint16_t)((seed >> 12) & 1023);
+		v16[i] = (uint16_t)((seed >> 16) & 1023);
+		a16[i] = (uint16_t)((seed >> 20) & 1023);
+		y8[i] = (uint8_t)(y16[i] >> 2);
+		u8[i] = (uint8_t)(u16[i] >> 2);
+		v8[i] = (uint8_t)(v16[i] >> 2);
+		a8[i] = (uint8_t)(a16[i] >> 2);
+	}
+
+	for (int variant = 0; variant < 8; variant++) {
+		int hshift = variant & 1;
+
+		frame.color_range = (variant & 2) ? AVCOL_RANGE_JPEG :
+			AVCOL_RANGE_MPEG;
+		frame.colorspace = (variant & 4) ? AVCOL_SPC_BT709 :
+			AVCOL_SPC_BT470BG;
+		get_coeffs(&c, &frame);
+
+		row8_c(expected, y8, u8, v8, a8, 0, WIDTH, hshift, &c);
+		k->row8(actual, y8, u8, v8, a8, 0, WIDTH, hshift, &c);
+		if (memcmp(expected, actual, sizeof(expected)) != 0)
+			return false;
+
+		row16_c(expected, y16, u16, v16, a16, 0, WIDTH, hshift, &c);
+		k->row16(actual, y16, u16, v16, a16, 0, WIDTH, hshift, &c);
+		if (memcmp(expected, actual, sizeof(expected)) != 0)
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+void stinger_convert_init(void)
+{
+#ifdef STINGER_X86
+	int flags = av_get_cpu_flags();
+	const struct convert_kernel *candidates[2];
+	size_t count = 0;
+
+	if ((flags & AV_CPU_FLAG_AVX2) != 0)
+		candidates[count++] = &kernel_avx2;
+	if ((flags & AV_CPU_FLAG_SSE2) != 0)
+		candidates[count++] = &kernel_sse2;
+
+	for (size_t i = 0; i < count; i++) {
+		if (kernel_matches_reference(candidates[i])) {
+			kernel = candidates[i];
+			break;
+		}
+
+		blog(LOG_WARNING, "stinger: %s YUVA conversion doesn't match "
+				"the reference, not using it",
+				candidates[i]->name);
+	}
+#endif
+
+	blog(LOG_INFO, "stinger: using %s YUVA conversion", kernel->name);
+}
+
+bool stinger_convert_supported(int format)
+{
+	return find_format(format) != NULL;
+}
+
+enum stinger_conversion stinger_convert_choose(int format, bool force_bgra)
+{
+	if (force_bgra)
+		return STINGER_CONVERSION_SWSCALE;
+	if (find_format(format))
+		return STINGER_CONVERSION_YUVA;
+	if (stinger_texture_ring_format_supported(
+				ffmpeg_to_obs_video_format(format)))
+		return STINGER_CONVERSION_PLANES;
+	return STINGER_CONVERSION_SWSCALE;
+}
+
+const char *stinger_conversion_name(enum stinger_conversion conversion)
+{
+	switch (conversion) {
+	case STINGER_CONVERSION_YUVA:    return "yuva";
+	case STINGER_CONVERSION_PLANES:  return "planes";
+	case STINGER_CONVERSION_SWSCALE: return "swscale";
+	}
+
+	return "unknown";
+}
+
+const char *stinger_convert_kernel_name(void)
+{
+	return kernel->name;
+}
+
+bool stinger_convert_set_kernel(const char *name)
+{
+#ifdef STINGER_X86
+	int flags = av_get_cpu_flags();
+
+	if (strcmp(name, kernel_avx2.name) == 0 &&
+			(flags & AV_CPU_FLAG_AVX2) != 0) {
+		kernel = &kernel_avx2;
+		return true;
+	}
+	if (strcmp(name, kernel_sse2.name) == 0 &&
+			(flags & AV_CPU_FLAG_SSE2) != 0) {
+		kernel = &kernel_sse2;
+		return true;
+	}
+#endif
+	if (strcmp(name, kernel_c.name) == 0) {
+		kernel = &kernel_c;
+		return true;
+	}
+
+	return false;
+}
+
+struct convert_job {
+	const AVFrame *frame;
+	const struct yuva_format *format;
+	struct yuv_coeffs coeffs;
+	convert_row_t row;
+	uint8_t *dst;
+	int dst_linesize;
+};
+
+static void convert_band(void *param, size_t index)
+{
+	struct convert_job *job = param;
+	const AVFrame *frame = job->frame;
+	int start = (int)index * ROWS_PER_BAND;
+	int end = start + ROWS_PER_BAND;
+
+	if (end > frame->height)
+		end = frame->height;
+
+	for (int y = start; y < end; y++) {
+		int cy = y >> job->format->vshift;
+
+		job->row(job->dst + (size_t)y * job->dst_linesize,
+				frame->data[0] + (size_t)y * frame->linesize[0],
+				frame->data[1] + (size_t)cy * frame->linesize[1],
+				frame->data[2] + (size_t)cy * frame->linesize[2],
+				frame->data[3] + (size_t)y * frame->linesize[3],
+				0, frame->width, job->format->hshift,
+				&job->coeffs);
+	}
+}
+
+bool stinger_convert_frame(const AVFrame *frame, uint8_t *dst,
+		int dst_linesize)
+{
+	struct convert_job job;
+	size_t bands;
+
+	job.format = find_format(frame->format);
+	if (!job.format)
+		return false;
+
+	job.frame = frame;
+	job.row = job.format->depth > 8 ? kernel->row16 : kernel->row8;
+	job.dst = dst;
+	job.dst_linesize = dst_linesize;
+	get_coeffs(&job.coeffs, frame);
+
+	bands = (frame->height + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+	stinger_threadpool_run(stinger_threadpool_global(), bands,
+			convert_band, &job);
+	return true;
+}
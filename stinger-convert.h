@@ -0,0 +1,39 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <libavutil/frame.h>
+
+/* YUVA to premultiplied BGRA conversion for the alpha formats stinger codecs
+ * decode to (yuva420p/422p/444p, 8 and 10 bit), which have no GPU path. Rows
+ * are split across the module thread pool and converted with SSE2 or AVX2
+ * kernels picked at runtime; the scalar kernel is the bit-exact reference
+ * the SIMD kernels are checked against on init. */
+
+enum stinger_conversion {
+	/* to premultiplied BGRA by stinger_convert_frame */
+	STINGER_CONVERSION_YUVA,
+	/* uploaded as planes, converted to RGB by the effect */
+	STINGER_CONVERSION_PLANES,
+	/* to BGRA by swscale */
+	STINGER_CONVERSION_SWSCALE
+};
+
+extern void stinger_convert_init(void);
+
+/* How a decoded frame of this format gets into the texture ring, the same
+ * choice for playback and the benchmark. force_bgra skips the GPU path
+ * and the YUVA conversion. */
+extern enum stinger_conversion stinger_convert_choose(int format,
+		bool force_bgra);
+extern const char *stinger_conversion_name(enum stinger_conversion conversion);
+
+extern bool stinger_convert_supported(int format);
+
+extern bool stinger_convert_frame(const AVFrame *frame, uint8_t *dst,
+		int dst_linesize);
+
+extern const char *stinger_convert_kernel_name(void);
+
+/* Switches to the named kernel ("c", "sse2" or "avx2") if this CPU runs it,
+ * for benchmarking the kernels against each other */
+extern bool stinger_convert_set_kernel(const char *name);
@@ -0,0 +1,254 @@
+#include <obs-module.h>
+#include <libavutil/pixdesc.h>
+
+#include "stinger-coverage.h"
+#include "stinger-threadpool.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define STINGER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define ROWS_PER_BAND 32
+
+/* a pixel counts as covered from 95% opacity up */
+#define OPAQUE_LEVEL 0.95
+
+struct coverage_job {
+	const uint8_t *data;
+	int linesize;
+	int step;
+	int x;
+	int width;
+	int y;
+	int height;
+	bool wide;
+	uint16_t threshold;
+	uint64_t *counts;
+};
+
+/* ------------------------------------------------------------------------- */
+/* scalar */
+
+static uint64_t count_u8_c(const uint8_t *p, int width, int step,
+		uint16_t threshold)
+{
+	uint64_t count = 0;
+
+	for (int x = 0; x < width; x++)
+		count += p[x * step] >= threshold;
+	return count;
+}
+
+static uint64_t count_u16_c(const uint16_t *p, int width, int step,
+		uint16_t threshold)
+{
+	uint64_t count = 0;
+
+	for (int x = 0; x < width; x++)
+		count += p[x * step] >= threshold;
+	return count;
+}
+
+/* ------------------------------------------------------------------------- */
+/* SSE2, for planes and for the alpha of 32 bit packed pixels */
+
+#ifdef STINGER_SSE2
+
+static inline uint64_t count_mask_bytes(__m128i mask)
+{
+	/* every matching byte of the mask is 0xff */
+	__m128i sum = _mm_sad_epu8(_mm_and_si128(mask, _mm_set1_epi8(1)),
+			_mm_setzero_si128());
+	return (uint64_t)_mm_cvtsi128_si32(sum) +
+		(uint64_t)_mm_extract_epi16(sum, 4);
+}
+
+static uint64_t count_u8_sse2(const uint8_t *p, int width, int step,
+		uint16_t threshold)
+{
+	/* unsigned a >= t is max(a, t) == a */
+	__m128i t = _mm_set1_epi8((char)threshold);
+	uint64_t count = 0;
+	int x = 0;
+
+	if (step == 1) {
+		for (; x + 16 <= width; x += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *)(p + x));
+			count += count_mask_bytes(_mm_cmpeq_epi8(
+					_mm_max_epu8(v, t), v));
+		}
+	} else if (step == 4) {
+		/* only the byte the pointer is at counts in each pixel */
+		__m128i lane = _mm_set1_epi32(0xff);
+
+		/* stop a pixel early, the last load reaches past the
+		 * alpha byte of its fourth pixel */
+		for (; x + 5 <= width; x += 4) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *)(p + x * 4));
+			__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+			count += count_mask_bytes(_mm_and_si128(ge, lane));
+		}
+	}
+
+	return count + count_u8_c(p + x * step, width - x, step,
+			threshold);
+}
+
+static uint64_t count_u16_sse2(const uint16_t *p, int width, int step,
+		uint16_t threshold)
+{
+	/* samples are at most 16 bit, flip the sign bit to compare them
+	 * as signed */
+	__m128i flip = _mm_set1_epi16((short)0x8000);
+	__m128i t = _mm_set1_epi16((short)((threshold - 1) ^ 0x8000));
+	uint64_t count = 0;
+	int x = 0;
+
+	if (step == 1 && threshold > 0) {
+		for (; x + 8 <= width; x += 8) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *)(p + x));
+			__m128i gt = _mm_cmpgt_epi16(_mm_xor_si128(v, flip),
+					t);
+			count += count_mask_bytes(gt) / 2;
+		}
+	}
+
+	return count + count_u16_c(p + x * step, width - x, step,
+			threshold);
+}
+
+#define count_u8 count_u8_sse2
+#define count_u16 count_u16_sse2
+#else
+#define count_u8 count_u8_c
+#define count_u16 count_u16_c
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+static void count_band(void *param, size_t index)
+{
+	struct coverage_job *job = param;
+	int start = job->y + (int)index * ROWS_PER_BAND;
+	int end = start + ROWS_PER_BAND;
+	uint64_t count = 0;
+
+	if (end > job->y + job->height)
+		end = job->y + job->height;
+
+	for (int y = start; y < end; y++) {
+		const uint8_t *row = job->data + (size_t)y * job->linesize;
+
+		if (job->wide)
+			count += count_u16((const uint16_t *)row + job->x *
+					job->step, job->width, job->step,
+					job->threshold);
+		else
+			count += count_u8(row + job->x * job->step,
+					job->width, job->step,
+					job->threshold);
+	}
+
+	job->counts[index] = count;
+}
+
+/* Picks the component to measure and the value from which it counts as
+ * covered; only little-endian samples of up to 16 bit are handled */
+static bool setup_job(struct coverage_job *job, const AVFrame *frame,
+		enum stinger_coverage_source source)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	const AVComponentDescriptor *comp;
+	bool luma = source != STINGER_COVERAGE_ALPHA;
+	double black, white;
+	int max;
+
+	if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BE |
+				AV_PIX_FMT_FLAG_HWACCEL)) != 0)
+		return false;
+	if (luma ? (desc->flags & AV_PIX_FMT_FLAG_RGB) != 0 :
+	           (desc->flags & AV_PIX_FMT_FLAG_ALPHA) == 0)
+		return false;
+
+	comp = &desc->comp[luma ? 0 : desc->nb_components - 1];
+	if (comp->depth > 16 || comp->shift != 0)
+		return false;
+
+	job->wide = comp->depth > 8;
+	if (comp->step % (job->wide ? 2 : 1) != 0)
+		return false;
+
+	job->step = job->wide ? comp->step / 2 : comp->step;
+	job->data = frame->data[comp->plane] + comp->offset;
+	job->linesize = frame->linesize[comp->plane];
+
+	max = (1 << comp->depth) - 1;
+	black = 0.0;
+	white = (double)max;
+
+	/* limited range luma runs from 16 to 235 */
+	if (luma && frame->color_range != AVCOL_RANGE_JPEG) {
+		black = (double)(16 << (comp->depth - 8));
+		white = (double)(235 << (comp->depth - 8));
+	}
+
+	job->threshold = (uint16_t)(black + (white - black) * OPAQUE_LEVEL +
+			0.5);
+
+	job->x = 0;
+	job->y = 0;
+	job->width = frame->width;
+	job->height = frame->height;
+
+	if (source == STINGER_COVERAGE_LUMA_RIGHT) {
+		job->x = frame->width / 2;
+		job->width -= job->x;
+	} else if (source == STINGER_COVERAGE_LUMA_BOTTOM) {
+		job->y = frame->height / 2;
+		job->height -= job->y;
+	}
+
+	return job->width > 0 && job->height > 0;
+}
+
+bool stinger_coverage_measure(const AVFrame *frame,
+		enum stinger_coverage_source source, uint16_t *coverage)
+{
+	struct coverage_job job;
+	uint64_t total = 0;
+	size_t bands;
+
+	if (source == STINGER_COVERAGE_NONE || !setup_job(&job, frame, source))
+		return false;
+
+	bands = (size_t)(job.height + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+	job.counts = bmalloc(bands * sizeof(*job.counts));
+
+	stinger_threadpool_run(stinger_threadpool_global(), bands,
+			count_band, &job);
+
+	for (size_t i = 0; i < bands; i++)
+		total += job.counts[i];
+	bfree(job.counts);
+
+	*coverage = (uint16_t)(total * STINGER_COVERAGE_SCALE /
+			((uint64_t)job.width * (uint64_t)job.height));
+	return true;
+}
+
+int64_t stinger_coverage_find(const uint16_t *curve, size_t count,
+		int percent)
+{
+	uint16_t wanted = (uint16_t)(percent * STINGER_COVERAGE_SCALE / 100);
+
+	for (size_t i = 0; i < count; i++) {
+		if (curve[i] >= wanted)
+			return (int64_t)i;
+	}
+
+	return -1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <libavutil/frame.h>
+
+/* How much of the frame a stinger covers, measured as the share of pixels
+ * that are (nearly) opaque. The curve over the clip tells where the stinger
+ * hides the scenes, which is where the cut belongs. Rows are counted in
+ * bands on the module thread pool, with SSE2 where available. */
+
+/* coverage values are in parts per thousand */
+#define STINGER_COVERAGE_SCALE 1000
+
+enum stinger_coverage_source {
+	STINGER_COVERAGE_NONE,
+
+	/* the frame's alpha channel */
+	STINGER_COVERAGE_ALPHA,
+
+	/* luma of the whole frame, of its right half or of its bottom half,
+	 * for track mattes */
+	STINGER_COVERAGE_LUMA,
+	STINGER_COVERAGE_LUMA_RIGHT,
+	STINGER_COVERAGE_LUMA_BOTTOM,
+};
+
+/* False if the frame's format has nothing to measure for the source */
+extern bool stinger_coverage_measure(const AVFrame *frame,
+		enum stinger_coverage_source source, uint16_t *coverage);
+
+/* Index of the first frame covering at least percent of the canvas, -1 if
+ * none does */
+extern int64_t stinger_coverage_find(const uint16_t *curve, size_t count,
+		int percent);
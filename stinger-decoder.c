@@ -0,0 +1,635 @@
+#include <obs-module.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <libavutil/hwcontext.h>
+#include <libswscale/swscale.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "stinger-decoder.h"
+#include "stinger-read-ahead.h"
+
+/* keyframes further ahead than this are sought rather than read up to */
+#define SEEK_AHEAD_FRAMES 48
+
+static const enum AVHWDeviceType hw_device_types[] = {
+	AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+	AV_HWDEVICE_TYPE_DXVA2,
+};
+
+/* Creates a device for the first hardware decoding method the codec
+ * supports on this platform */
+static bool create_hw_device(struct stinger_decoder *d, const AVCodec *codec)
+{
+	const AVCodecHWConfig *config;
+
+	for (size_t t = 0;
+	     t < sizeof(hw_device_types) / sizeof(*hw_device_types); t++) {
+		for (int i = 0; (config = avcodec_get_hw_config(codec, i)); i++) {
+			if ((config->methods &
+			     AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) == 0 ||
+			    config->device_type != hw_device_types[t])
+				continue;
+
+			if (av_hwdevice_ctx_create(&d->hw_device,
+						hw_device_types[t], NULL, NULL,
+						0) == 0) {
+				d->hw_format = config->pix_fmt;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/* Fits width x height into the maximum size, keeping the aspect ratio.
+ * Returns false if it already fits. */
+static bool get_fitted_size(struct stinger_decoder *d, int width, int height,
+		int *fit_width, int *fit_height)
+{
+	double scale, scale_y;
+
+	uint32_t max_width = d->options.max_width;
+	uint32_t max_height = d->options.max_height;
+
+	if (!max_width || !max_height || width <= 0 || height <= 0 ||
+	    ((uint32_t)width <= max_width && (uint32_t)height <= max_height))
+		return false;
+
+	scale = (double)max_width / (double)width;
+	scale_y = (double)max_height / (double)height;
+	if (scale_y < scale)
+		scale = scale_y;
+
+	/* even sizes keep subsampled chroma aligned */
+	*fit_width = (int)((double)width * scale) & ~1;
+	*fit_height = (int)((double)height * scale) & ~1;
+	if (*fit_width < 2)
+		*fit_width = 2;
+	if (*fit_height < 2)
+		*fit_height = 2;
+	return true;
+}
+
+/* Largest reduction the codec supports that doesn't go below the size the
+ * frames are going to be scaled to anyway */
+static int get_lowres(struct stinger_decoder *d, AVCodec *codec)
+{
+	int width = d->stream->codecpar->width;
+	int height = d->stream->codecpar->height;
+	int max_lowres = codec->max_lowres;
+	int fit_width, fit_height;
+	int lowres = 0;
+
+	if (!get_fitted_size(d, width, height, &fit_width, &fit_height))
+		return 0;
+
+	while (lowres < max_lowres &&
+	       (width >> (lowres + 1)) >= fit_width &&
+	       (height >> (lowres + 1)) >= fit_height)
+		lowres++;
+
+	return lowres;
+}
+
+static int get_thread_type(enum stinger_decoder_threading threading)
+{
+	switch (threading) {
+	case STINGER_THREADING_FRAME: return FF_THREAD_FRAME;
+	case STINGER_THREADING_SLICE: return FF_THREAD_SLICE;
+	default:                      return FF_THREAD_FRAME |
+	                                     FF_THREAD_SLICE;
+	}
+}
+
+const char *stinger_decoder_threading_name(
+		enum stinger_decoder_threading threading)
+{
+	switch (threading) {
+	case STINGER_THREADING_AUTO:  return "auto";
+	case STINGER_THREADING_FRAME: return "frame";
+	case STINGER_THREADING_SLICE: return "slice";
+	}
+
+	return "unknown";
+}
+
+static bool open_codec(struct stinger_decoder *d, AVCodec *codec, bool hw)
+{
+	d->codec = avcodec_alloc_context3(codec);
+	if (!d->codec)
+		return false;
+
+	if (avcodec_parameters_to_context(d->codec,
+				d->stream->codecpar) < 0) {
+		blog(LOG_ERROR, "stinger decoder: couldn't copy codec "
+				"parameters");
+		avcodec_free_context(&d->codec);
+		return false;
+	}
+
+	d->codec->pkt_timebase = d->stream->time_base;
+	d->codec->thread_count = d->options.threads;
+	d->codec->thread_type = get_thread_type(d->options.threading);
+
+	/* frames decoded into hardware surfaces are downloaded at full
+	 * size, lowres only applies to software decoding */
+	if (hw) {
+		d->codec->hw_device_ctx = av_buffer_ref(d->hw_device);
+	} else {
+		d->lowres = get_lowres(d, codec);
+		d->codec->lowres = d->lowres;
+	}
+
+	if (avcodec_open2(d->codec, codec, NULL) < 0) {
+		avcodec_free_context(&d->codec);
+		return false;
+	}
+
+	return true;
+}
+
+static bool aborted(const struct stinger_decoder_options *options)
+{
+	return (options->abort && os_atomic_load_bool(options->abort)) ||
+		(options->deadline_ns && os_gettime_ns() > options->deadline_ns);
+}
+
+static int abort_callback(void *opaque)
+{
+	return aborted(opaque) ? 1 : 0;
+}
+
+bool stinger_decoder_open(struct stinger_decoder *d, const char *path,
+		const struct stinger_decoder_options *options)
+{
+	AVCodec *codec = NULL;
+	int width, height;
+
+	memset(d, 0, sizeof(*d));
+	d->options = *options;
+
+	if (!path || !*path)
+		return false;
+
+	/* lets a read stuck on a slow share give up as well */
+	if (options->abort || options->deadline_ns) {
+		d->format = avformat_alloc_context();
+		d->format->interrupt_callback.callback = abort_callback;
+		d->format->interrupt_callback.opaque = &d->options;
+	}
+
+	if (avformat_open_input(&d->format, path, NULL, NULL) != 0) {
+		blog(LOG_WARNING, "stinger decoder: couldn't open '%s'", path);
+		return false;
+	}
+
+	if (avformat_find_stream_info(d->format, NULL) < 0) {
+		blog(LOG_WARNING, "stinger decoder: couldn't find stream "
+				"information of '%s'", path);
+		goto fail;
+	}
+
+	d->stream_index = av_find_best_stream(d->format, AVMEDIA_TYPE_VIDEO,
+			-1, -1, &codec, 0);
+	if (d->stream_index < 0 || !codec) {
+		blog(LOG_WARNING, "stinger decoder: no decodable video stream "
+				"in '%s'", path);
+		goto fail;
+	}
+
+	d->stream = d->format->streams[d->stream_index];
+
+	if (options->hw_decoding && create_hw_device(d, codec)) {
+		d->hw_decoding = open_codec(d, codec, true);
+		if (!d->hw_decoding)
+			blog(LOG_INFO, "stinger decoder: couldn't open "
+					"hardware decoding of '%s', falling "
+					"back to software", codec->name);
+	}
+
+	if (!d->codec && !open_codec(d, codec, false)) {
+		blog(LOG_ERROR, "stinger decoder: couldn't open codec");
+		goto fail;
+	}
+
+	d->frame = av_frame_alloc();
+	if (!d->frame)
+		goto fail;
+
+	d->frame_rate = av_guess_frame_rate(d->format, d->stream, NULL);
+	d->start_pts = options->index && options->index_size ?
+		options->index[0].pts : d->stream->start_time;
+	d->skip_pts = AV_NOPTS_VALUE;
+	d->audio_stream_index = -1;
+
+	stinger_decoder_get_output_size(d, &width, &height);
+	if (width != d->stream->codecpar->width ||
+	    height != d->stream->codecpar->height)
+		blog(LOG_INFO, "stinger decoder: decoding '%s' at %dx%d "
+				"(lowres %d) instead of %dx%d", path, width,
+				height, d->lowres, d->stream->codecpar->width,
+				d->stream->codecpar->height);
+
+	blog(LOG_DEBUG, "stinger decoder: '%s' uses %d %s threads%s", path,
+			d->codec->thread_count,
+			d->codec->active_thread_type == FF_THREAD_FRAME ?
+				"frame" :
+			d->codec->active_thread_type == FF_THREAD_SLICE ?
+				"slice" : "no",
+			options->read_ahead ? ", reading ahead" : "");
+
+	if (options->read_ahead)
+		d->read_ahead = stinger_read_ahead_create(d->format);
+	return true;
+
+fail:
+	stinger_decoder_close(d);
+	return false;
+}
+
+bool stinger_decoder_open_audio(struct stinger_decoder *d,
+		stinger_audio_callback_t callback, void *param)
+{
+	AVCodec *codec = NULL;
+	int index = av_find_best_stream(d->format, AVMEDIA_TYPE_AUDIO,
+			-1, d->stream_index, &codec, 0);
+
+	if (index < 0 || !codec)
+		return false;
+
+	d->audio_stream = d->format->streams[index];
+	d->audio_codec = avcodec_alloc_context3(codec);
+	if (!d->audio_codec)
+		return false;
+
+	if (avcodec_parameters_to_context(d->audio_codec,
+				d->audio_stream->codecpar) < 0 ||
+	    avcodec_open2(d->audio_codec, codec, NULL) < 0) {
+		blog(LOG_WARNING, "stinger decoder: couldn't open audio codec");
+		avcodec_free_context(&d->audio_codec);
+		return false;
+	}
+
+	d->audio_frame = av_frame_alloc();
+	if (!d->audio_frame) {
+		avcodec_free_context(&d->audio_codec);
+		return false;
+	}
+
+	d->audio_stream_index = index;
+	d->audio_callback = callback;
+	d->audio_param = param;
+	return true;
+}
+
+void stinger_decoder_close(struct stinger_decoder *d)
+{
+	uint64_t waits, wait_ns;
+
+	stinger_read_ahead_get_stats(d->read_ahead, &waits, &wait_ns);
+	if (waits)
+		blog(LOG_DEBUG, "stinger decoder: waited for packets %llu "
+				"times, %.1f ms in total",
+				(unsigned long long)waits,
+				(double)wait_ns / 1e6);
+
+	/* stops the demux thread before the format context goes away */
+	stinger_read_ahead_destroy(d->read_ahead);
+
+	if (d->audio_frame)
+		av_frame_free(&d->audio_frame);
+	if (d->audio_codec)
+		avcodec_free_context(&d->audio_codec);
+	if (d->frame)
+		av_frame_free(&d->frame);
+	if (d->scaler)
+		sws_freeContext(d->scaler);
+	if (d->codec)
+		avcodec_free_context(&d->codec);
+	if (d->hw_device)
+		av_buffer_unref(&d->hw_device);
+	if (d->format)
+		avformat_close_input(&d->format);
+
+	memset(d, 0, sizeof(*d));
+}
+
+bool stinger_decoder_rewind(struct stinger_decoder *d)
+{
+	return stinger_decoder_seek(d, 0);
+}
+
+/* Index of the last keyframe at or before frame */
+static size_t keyframe_before(struct stinger_decoder *d, size_t frame)
+{
+	while (frame > 0 && !d->options.index[frame].keyframe)
+		frame--;
+	return frame;
+}
+
+bool stinger_decoder_seek(struct stinger_decoder *d, int64_t frame)
+{
+	const struct stinger_index_entry *index = d->options.index;
+	bool indexed = index && frame >= 0 &&
+		(size_t)frame < d->options.index_size;
+	int64_t ts = d->stream->start_time != AV_NOPTS_VALUE ?
+		d->stream->start_time : 0;
+	int64_t pos = -1;
+	bool success;
+
+	if (indexed) {
+		ts = index[frame].pts;
+		pos = index[keyframe_before(d, (size_t)frame)].pos;
+	} else if (frame > 0) {
+		if (d->frame_rate.num <= 0 || d->frame_rate.den <= 0)
+			return false;
+		ts += av_rescale_q(frame, av_inv_q(d->frame_rate),
+				d->stream->time_base);
+	}
+
+	/* the demux thread owns the format context while it runs, and the
+	 * packets it read ahead are from the old position */
+	stinger_read_ahead_pause(d->read_ahead);
+
+	success = av_seek_frame(d->format, d->stream_index, ts,
+			AVSEEK_FLAG_BACKWARD) >= 0;
+
+	/* containers without a seek index can still go to the keyframe's
+	 * packet directly */
+	if (!success && pos >= 0 &&
+	    (d->format->iformat->flags & AVFMT_NO_BYTE_SEEK) == 0)
+		success = av_seek_frame(d->format, d->stream_index, pos,
+				AVSEEK_FLAG_BYTE) >= 0;
+
+	/* a failed seek leaves the file where it was, and the packets read
+	 * ahead are still the ones that come next */
+	stinger_read_ahead_resume(d->read_ahead, success);
+
+	if (!success) {
+		blog(LOG_WARNING, "stinger decoder: couldn't seek to frame "
+				"%lld", (long long)frame);
+		return false;
+	}
+
+	avcodec_flush_buffers(d->codec);
+	if (d->audio_codec)
+		avcodec_flush_buffers(d->audio_codec);
+
+	/* only a guess for files without timestamps, which rarely seek
+	 * accurately anyway */
+	d->next_index = frame;
+	d->frame_index = frame;
+	d->skip_pts = AV_NOPTS_VALUE;
+	d->draining = false;
+	d->eof = false;
+	return true;
+}
+
+void stinger_decoder_skip_to(struct stinger_decoder *d, int64_t frame)
+{
+	size_t keyframe;
+
+	if (!d->options.index || frame <= d->frame_index ||
+	    (size_t)frame >= d->options.index_size)
+		return;
+
+	/* nothing to leave out before the keyframe */
+	keyframe = keyframe_before(d, (size_t)frame);
+	if ((int64_t)keyframe <= d->frame_index + 1)
+		return;
+
+	/* a seek would leave out the audio in between as well */
+	if (d->audio_stream_index < 0 &&
+	    (int64_t)keyframe - d->frame_index > SEEK_AHEAD_FRAMES &&
+	    stinger_decoder_seek(d, frame))
+		return;
+
+	d->skip_pts = d->options.index[keyframe].pts;
+}
+
+/* Drops the packets stinger_decoder_skip_to() left out, up to the
+ * keyframe decoding resumes from */
+static bool skip_packet(struct stinger_decoder *d, const AVPacket *packet)
+{
+	int64_t pts = packet->pts != AV_NOPTS_VALUE ?
+		packet->pts : packet->dts;
+
+	if (d->skip_pts == AV_NOPTS_VALUE)
+		return false;
+
+	if ((packet->flags & AV_PKT_FLAG_KEY) != 0 && pts != AV_NOPTS_VALUE &&
+	    pts >= d->skip_pts) {
+		d->skip_pts = AV_NOPTS_VALUE;
+		return false;
+	}
+
+	return true;
+}
+
+/* Position of the decoded frame on the frame grid. Falls back to counting
+ * frames when the file has no usable timestamps or frame rate. */
+static int64_t get_frame_index(struct stinger_decoder *d)
+{
+	const struct stinger_index_entry *index = d->options.index;
+	int64_t pts = d->frame->best_effort_timestamp;
+	AVRational frame_duration;
+	size_t low, high, mid;
+
+	/* the last frame starting at or before pts */
+	if (pts != AV_NOPTS_VALUE && index && d->options.index_size) {
+		low = 0;
+		high = d->options.index_size;
+		while (high - low > 1) {
+			mid = low + (high - low) / 2;
+			if (index[mid].pts <= pts)
+				low = mid;
+			else
+				high = mid;
+		}
+		return (int64_t)low;
+	}
+
+	if (pts == AV_NOPTS_VALUE || d->frame_rate.num <= 0 ||
+	    d->frame_rate.den <= 0)
+		return d->next_index;
+
+	if (d->start_pts == AV_NOPTS_VALUE)
+		d->start_pts = pts;
+
+	frame_duration = av_inv_q(d->frame_rate);
+	return av_rescale_q(pts - d->start_pts, d->stream->time_base,
+			frame_duration);
+}
+
+void stinger_decoder_get_output_size(struct stinger_decoder *d,
+		int *width, int *height)
+{
+	*width = d->codec->width;
+	*height = d->codec->height;
+
+	get_fitted_size(d, *width, *height, width, height);
+}
+
+/* Replaces a frame decoded into a hardware surface with a copy in system
+ * memory; false if it couldn't be downloaded */
+static bool download_frame(struct stinger_decoder *d)
+{
+	AVFrame *src = d->frame;
+	AVFrame *sw;
+
+	if (!d->hw_decoding || src->format != d->hw_format)
+		return true;
+
+	sw = av_frame_alloc();
+	if (!sw)
+		return false;
+
+	if (av_hwframe_transfer_data(sw, src, 0) < 0) {
+		blog(LOG_WARNING, "stinger decoder: couldn't download a "
+				"hardware decoded frame");
+		av_frame_free(&sw);
+		return false;
+	}
+
+	av_frame_copy_props(sw, src);
+	av_frame_unref(src);
+	av_frame_move_ref(src, sw);
+	av_frame_free(&sw);
+	return true;
+}
+
+/* Replaces d->frame with a copy scaled into the maximum size. Frames the
+ * scaler can't output are passed on as they are. */
+static void scale_frame(struct stinger_decoder *d)
+{
+	AVFrame *src = d->frame;
+	AVFrame *scaled;
+	int width, height;
+
+	if (d->scale_failed ||
+	    !get_fitted_size(d, src->width, src->height, &width, &height))
+		return;
+
+	if (!sws_isSupportedOutput(src->format))
+		goto fail;
+
+	d->scaler = sws_getCachedContext(d->scaler,
+			src->width, src->height, src->format,
+			width, height, src->format,
+			SWS_AREA, NULL, NULL, NULL);
+	if (!d->scaler)
+		goto fail;
+
+	scaled = av_frame_alloc();
+	if (!scaled)
+		return;
+
+	scaled->format = src->format;
+	scaled->width = width;
+	scaled->height = height;
+
+	if (av_frame_get_buffer(scaled, 32) < 0) {
+		av_frame_free(&scaled);
+		return;
+	}
+
+	av_frame_copy_props(scaled, src);
+	sws_scale(d->scaler, (const uint8_t *const *)src->data, src->linesize,
+			0, src->height, scaled->data, scaled->linesize);
+
+	av_frame_unref(src);
+	av_frame_move_ref(src, scaled);
+	av_frame_free(&scaled);
+	return;
+
+fail:
+	blog(LOG_WARNING, "stinger decoder: can't scale frames of format %d, "
+			"keeping them at %dx%d", src->format, src->width,
+			src->height);
+	d->scale_failed = true;
+}
+
+static void send_packet(struct stinger_decoder *d, AVPacket *packet)
+{
+	if (avcodec_send_packet(d->codec, packet) < 0)
+		blog(LOG_DEBUG, "stinger decoder: error decoding packet");
+}
+
+/* Decodes an audio packet, or flushes the decoder if packet is NULL */
+static void decode_audio_packet(struct stinger_decoder *d, AVPacket *packet)
+{
+	if (avcodec_send_packet(d->audio_codec, packet) < 0)
+		return;
+
+	while (avcodec_receive_frame(d->audio_codec, d->audio_frame) == 0)
+		d->audio_callback(d->audio_param, d->audio_frame);
+}
+
+static bool read_packet(struct stinger_decoder *d, AVPacket *packet)
+{
+	if (d->read_ahead)
+		return stinger_read_ahead_get(d->read_ahead, packet,
+				d->interrupt);
+	return av_read_frame(d->format, packet) >= 0;
+}
+
+static inline bool interrupted(struct stinger_decoder *d)
+{
+	return (d->interrupt && os_atomic_load_bool(d->interrupt)) ||
+		aborted(&d->options);
+}
+
+bool stinger_decoder_next(struct stinger_decoder *d)
+{
+	AVPacket packet;
+	int ret;
+
+	while (!d->eof) {
+		if (interrupted(d))
+			return false;
+
+		ret = avcodec_receive_frame(d->codec, d->frame);
+		if (ret == 0)
+			break;
+
+		if (ret == AVERROR_EOF || (ret < 0 && d->draining)) {
+			d->eof = true;
+			return false;
+		}
+		if (ret != AVERROR(EAGAIN))
+			blog(LOG_DEBUG, "stinger decoder: error decoding frame");
+
+		if (read_packet(d, &packet)) {
+			if (packet.stream_index == d->stream_index) {
+				if (!skip_packet(d, &packet))
+					send_packet(d, &packet);
+			}
+			else if (packet.stream_index == d->audio_stream_index)
+				decode_audio_packet(d, &packet);
+			av_packet_unref(&packet);
+			continue;
+		}
+
+		if (interrupted(d))
+			return false;
+
+		/* flush frames still buffered inside the decoders */
+		if (d->audio_codec)
+			decode_audio_packet(d, NULL);
+		send_packet(d, NULL);
+		d->draining = true;
+	}
+
+	if (d->eof)
+		return false;
+
+	d->frame_index = get_frame_index(d);
+	d->next_index = d->frame_index + 1;
+
+	if (!download_frame(d))
+		return false;
+
+	scale_frame(d);
+	return true;
+}
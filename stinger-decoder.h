@@ -0,0 +1,143 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <libavformat/avformat.h>
+
+struct SwsContext;
+struct stinger_read_ahead;
+
+/* One frame of a clip's frame index, built by the probe */
+struct stinger_index_entry {
+	/* presentation timestamp, in the stream's time base */
+	int64_t pts;
+	/* byte offset of the frame's packet, -1 if unknown */
+	int64_t pos;
+	bool keyframe;
+};
+
+enum stinger_decoder_threading {
+	STINGER_THREADING_AUTO,
+	STINGER_THREADING_FRAME,
+	STINGER_THREADING_SLICE
+};
+
+struct stinger_decoder_options {
+	bool hw_decoding;
+
+	/* frames are fitted into this size, 0 for no limit */
+	uint32_t max_width;
+	uint32_t max_height;
+
+	/* decoder threads, 0 to use one per core. Frame threading has the
+	 * most throughput but holds back a frame per thread, slice threading
+	 * adds no delay but only helps codecs that code slices. */
+	int threads;
+	enum stinger_decoder_threading threading;
+
+	/* demux on a separate thread so reading overlaps decoding */
+	bool read_ahead;
+
+	/* gives up for good, opening included, once *abort is set or the
+	 * os_gettime_ns() deadline passes (NULL/0 for never). Unlike the
+	 * interrupt below this also cuts short blocking reads, so the
+	 * decoder is of no further use afterwards. */
+	volatile bool *abort;
+	uint64_t deadline_ns;
+
+	/* every frame in presentation order. Frames are then numbered by
+	 * their place in it rather than by the frame rate, which only works
+	 * for constant frame rates, and seeks go by its timestamps. NULL to
+	 * go by the frame rate; has to outlive the decoder. */
+	const struct stinger_index_entry *index;
+	size_t index_size;
+};
+
+/* Synchronous video decoder for stinger files. Frames come out one at a
+ * time in presentation order together with their index on the clip's frame
+ * grid, which is what playback is scheduled against. If audio is enabled,
+ * audio packets read on the way are decoded and passed to a callback.
+ *
+ * Clips larger than the size they're shown at can be limited to a maximum
+ * size: codecs that can decode at a reduced resolution (lowres) are asked
+ * to, and whatever is still too large is scaled down once, right after
+ * decoding, keeping its pixel format. */
+
+typedef void (*stinger_audio_callback_t)(void *param, AVFrame *frame);
+
+struct stinger_decoder {
+	AVFormatContext *format;
+	AVCodecContext *codec;
+	AVStream *stream;
+	int stream_index;
+	AVFrame *frame;
+
+	AVRational frame_rate;
+	int64_t start_pts;
+	int64_t next_index;
+
+	/* index of the frame in frame */
+	int64_t frame_index;
+
+	/* video packets are dropped until the keyframe at this timestamp,
+	 * AV_NOPTS_VALUE when nothing is skipped */
+	int64_t skip_pts;
+
+	AVCodecContext *audio_codec;
+	AVStream *audio_stream;
+	int audio_stream_index;
+	AVFrame *audio_frame;
+	stinger_audio_callback_t audio_callback;
+	void *audio_param;
+
+	/* when set, decoding gives up at the next packet */
+	volatile bool *interrupt;
+
+	struct stinger_decoder_options options;
+	struct stinger_read_ahead *read_ahead;
+	int lowres;
+	struct SwsContext *scaler;
+	bool scale_failed;
+
+	/* device hardware decoding uses, and the format of the surfaces it
+	 * decodes into */
+	AVBufferRef *hw_device;
+	enum AVPixelFormat hw_format;
+
+	bool hw_decoding;
+	bool draining;
+	bool eof;
+};
+
+extern bool stinger_decoder_open(struct stinger_decoder *d, const char *path,
+		const struct stinger_decoder_options *options);
+extern void stinger_decoder_close(struct stinger_decoder *d);
+
+/* Opens the clip's audio stream, false if it has none */
+extern bool stinger_decoder_open_audio(struct stinger_decoder *d,
+		stinger_audio_callback_t callback, void *param);
+
+/* Seeks back to the first keyframe, so the next frame decoded is the first
+ * frame of the clip again */
+extern bool stinger_decoder_rewind(struct stinger_decoder *d);
+
+/* Seeks to the keyframe at or before frame; decoding forward from there
+ * until frame_index reaches frame gets to the frame itself. Needs the
+ * frame index or the clip's frame rate for any frame but the first. */
+extern bool stinger_decoder_seek(struct stinger_decoder *d, int64_t frame);
+
+/* Tells the decoder the frames before frame aren't needed. Packets up to
+ * the keyframe before it are dropped without being decoded, or if that
+ * keyframe is far ahead and there's no audio to lose, the decoder seeks to
+ * it. Needs the frame index; frames from the keyframe on still come out. */
+extern void stinger_decoder_skip_to(struct stinger_decoder *d, int64_t frame);
+
+extern const char *stinger_decoder_threading_name(
+		enum stinger_decoder_threading threading);
+
+/* Size of the frames that will come out, after lowres and scaling */
+extern void stinger_decoder_get_output_size(struct stinger_decoder *d,
+		int *width, int *height);
+
+/* Decodes the next frame into d->frame, false at the end of the clip, on a
+ * fatal error or when interrupted */
+extern bool stinger_decoder_next(struct stinger_decoder *d);
@@ -0,0 +1,523 @@
+#include <obs-module.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "obs-ffmpeg-formats.h"
+#include "stinger-convert.h"
+#include "stinger-decoder.h"
+#include "stinger-frame-cache.h"
+#include "stinger-texture-ring.h"
+
+/* shorter runs are cheaper to keep as literals */
+#define MIN_RUN 4
+
+struct cache_decoder {
+	struct stinger_decoder decoder;
+	struct SwsContext *sws;
+
+	/* BGRA image frames are converted into before being compressed */
+	uint8_t *scratch;
+};
+
+static void cache_decoder_free(struct cache_decoder *d)
+{
+	if (d->sws)
+		sws_freeContext(d->sws);
+	bfree(d->scratch);
+	stinger_decoder_close(&d->decoder);
+}
+
+const char *stinger_cache_storage_name(enum stinger_cache_storage storage)
+{
+	switch (storage) {
+	case STINGER_CACHE_STORE_BGRA:       return "BGRA";
+	case STINGER_CACHE_STORE_PLANAR:     return "planar";
+	case STINGER_CACHE_STORE_COMPRESSED: return "compressed";
+	}
+
+	return "unknown";
+}
+
+/* Rough upper bound used to refuse oversized clips before decoding them.
+ * Compressed sizes can't be known up front, so only the other layouts are
+ * checked. */
+static size_t estimate_cache_size(struct cache_decoder *d,
+		enum stinger_cache_storage storage)
+{
+	AVFormatContext *format = d->decoder.format;
+	AVStream *stream = d->decoder.stream;
+	AVCodecContext *codec = d->decoder.codec;
+	int64_t frames = stream->nb_frames;
+	int width, height;
+	int frame_size;
+
+	stinger_decoder_get_output_size(&d->decoder, &width, &height);
+	frame_size = width * height * 4;
+
+	if (storage == STINGER_CACHE_STORE_COMPRESSED)
+		return 0;
+
+	if (frames <= 0 && format->duration > 0 &&
+	    stream->avg_frame_rate.den != 0)
+		frames = (int64_t)((double)format->duration /
+				AV_TIME_BASE * av_q2d(stream->avg_frame_rate));
+	if (frames <= 0)
+		return 0;
+
+	if (storage == STINGER_CACHE_STORE_PLANAR &&
+	    codec->pix_fmt != AV_PIX_FMT_NONE) {
+		int planar_size = av_image_get_buffer_size(codec->pix_fmt,
+				width, height, 1);
+		if (planar_size > 0 && planar_size < frame_size)
+			frame_size = planar_size;
+	}
+
+	return (size_t)frames * frame_size;
+}
+
+/* Planar storage keeps formats the texture ring uploads directly, and 8-bit
+ * YUVA, which is converted on display. Anything else (including 10-bit
+ * YUVA, which takes more room than BGRA) is stored as BGRA. */
+static bool can_store_planar(struct stinger_frame_cache *cache,
+		const AVFrame *frame)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	enum video_format format = ffmpeg_to_obs_video_format(frame->format);
+
+	if (format != VIDEO_FORMAT_NONE &&
+	    stinger_texture_ring_format_supported(format)) {
+		cache->format = format;
+		cache->premultiplied = false;
+		return true;
+	}
+
+	if (desc && desc->comp[0].depth == 8 &&
+	    stinger_convert_supported(frame->format)) {
+		cache->format = VIDEO_FORMAT_NONE;
+		cache->premultiplied = true;
+		return true;
+	}
+
+	return false;
+}
+
+static void init_layout(struct stinger_frame_cache *cache,
+		const AVFrame *frame, enum stinger_cache_storage storage)
+{
+	cache->width = frame->width;
+	cache->height = frame->height;
+	cache->linesize = frame->width * 4;
+	cache->pix_fmt = frame->format;
+	cache->colorspace = convert_color_space(frame->colorspace);
+	cache->range = convert_color_range(frame->color_range);
+	cache->storage = storage;
+
+	if (storage == STINGER_CACHE_STORE_PLANAR &&
+	    can_store_planar(cache, frame))
+		return;
+
+	if (storage == STINGER_CACHE_STORE_PLANAR) {
+		blog(LOG_INFO, "stinger cache: can't keep %s frames planar, "
+				"storing BGRA",
+				av_get_pix_fmt_name(frame->format));
+		cache->storage = STINGER_CACHE_STORE_BGRA;
+	}
+
+	cache->format = VIDEO_FORMAT_BGRA;
+	cache->premultiplied = stinger_convert_supported(frame->format);
+}
+
+static bool convert_to_bgra(struct stinger_frame_cache *cache,
+		struct cache_decoder *d, uint8_t *dst)
+{
+	AVFrame *frame = d->decoder.frame;
+	int linesize = (int)cache->linesize;
+
+	if (cache->premultiplied &&
+	    stinger_convert_frame(frame, dst, linesize))
+		return true;
+
+	d->sws = sws_getCachedContext(d->sws,
+			frame->width, frame->height, frame->format,
+			frame->width, frame->height, AV_PIX_FMT_BGRA,
+			SWS_BILINEAR, NULL, NULL, NULL);
+	if (!d->sws) {
+		blog(LOG_ERROR, "stinger cache: unable to create sws context");
+		return false;
+	}
+
+	sws_scale(d->sws, (const uint8_t *const *)frame->data,
+			frame->linesize, 0, frame->height, &dst, &linesize);
+	return true;
+}
+
+static inline uint8_t *write_count(uint8_t *out, size_t count)
+{
+	while (count >= 0x80) {
+		*(out++) = (uint8_t)(count | 0x80);
+		count >>= 7;
+	}
+	*(out++) = (uint8_t)count;
+	return out;
+}
+
+static inline const uint8_t *read_count(const uint8_t *in,
+		const uint8_t *end, size_t *count)
+{
+	size_t value = 0;
+	int shift = 0;
+
+	while (in < end && (*in & 0x80)) {
+		value |= (size_t)(*(in++) & 0x7F) << shift;
+		shift += 7;
+	}
+	if (in == end)
+		return NULL;
+
+	*count = value | ((size_t)*(in++) << shift);
+	return in;
+}
+
+/* Worst case output: every pixel as a literal plus a few bytes of counts */
+static inline size_t compress_bound(size_t pixels)
+{
+	return pixels * 4 + 32;
+}
+
+/* Codes the pixels as alternating (literal count, literals, run count,
+ * pixel) groups, so decoding is nothing but copies and fills */
+static size_t compress_pixels(const uint32_t *src, size_t pixels,
+		uint8_t *out_start)
+{
+	uint8_t *out = out_start;
+	size_t i = 0;
+
+	while (i < pixels) {
+		size_t literal_start = i;
+		size_t run = 0;
+
+		while (i < pixels) {
+			run = 1;
+			while (i + run < pixels && src[i + run] == src[i])
+				run++;
+			if (run >= MIN_RUN)
+				break;
+			i += run;
+			run = 0;
+		}
+
+		out = write_count(out, i - literal_start);
+		memcpy(out, src + literal_start, (i - literal_start) * 4);
+		out += (i - literal_start) * 4;
+
+		out = write_count(out, run);
+		if (run) {
+			memcpy(out, src + i, 4);
+			out += 4;
+			i += run;
+		}
+	}
+
+	return (size_t)(out - out_start);
+}
+
+static bool decompress_pixels(const uint8_t *in, size_t size, uint32_t *dst,
+		size_t pixels)
+{
+	const uint8_t *end = in + size;
+	size_t pos = 0;
+
+	while (pos < pixels) {
+		size_t literals;
+		size_t run;
+		uint32_t pixel;
+
+		in = read_count(in, end, &literals);
+		if (!in || literals > pixels - pos ||
+		    (size_t)(end - in) < literals * 4)
+			return false;
+		memcpy(dst + pos, in, literals * 4);
+		in += literals * 4;
+		pos += literals;
+
+		if (pos == pixels)
+			break;
+
+		in = read_count(in, end, &run);
+		if (!in || run > pixels - pos || (run && end - in < 4))
+			return false;
+		if (run) {
+			memcpy(&pixel, in, 4);
+			in += 4;
+			for (size_t i = 0; i < run; i++)
+				dst[pos + i] = pixel;
+			pos += run;
+		}
+	}
+
+	return true;
+}
+
+static bool store_bgra(struct stinger_frame_cache *cache,
+		struct cache_decoder *d, struct stinger_cached_frame *cached)
+{
+	cached->size = stinger_frame_cache_frame_size(cache);
+	cached->data = bmalloc(cached->size);
+
+	if (!convert_to_bgra(cache, d, cached->data)) {
+		bfree(cached->data);
+		return false;
+	}
+	return true;
+}
+
+static bool store_planar(struct stinger_frame_cache *cache,
+		struct cache_decoder *d, struct stinger_cached_frame *cached)
+{
+	AVFrame *frame = d->decoder.frame;
+	int size = av_image_get_buffer_size(cache->pix_fmt, frame->width,
+			frame->height, 1);
+
+	if (size <= 0)
+		return false;
+
+	cached->size = (size_t)size;
+	cached->data = bmalloc(cached->size);
+	av_image_copy_to_buffer(cached->data, size,
+			(const uint8_t *const *)frame->data, frame->linesize,
+			cache->pix_fmt, frame->width, frame->height, 1);
+	return true;
+}
+
+static bool store_compressed(struct stinger_frame_cache *cache,
+		struct cache_decoder *d, struct stinger_cached_frame *cached)
+{
+	size_t pixels = (size_t)cache->width * cache->height;
+	size_t bound = compress_bound(pixels);
+
+	if (!d->scratch)
+		d->scratch = bmalloc(stinger_frame_cache_frame_size(cache) +
+				bound);
+	if (!convert_to_bgra(cache, d, d->scratch))
+		return false;
+
+	/* compress behind the image, then keep only what was used */
+	cached->size = compress_pixels((const uint32_t *)d->scratch, pixels,
+			d->scratch + stinger_frame_cache_frame_size(cache));
+	cached->data = bmalloc(cached->size);
+	memcpy(cached->data, d->scratch + stinger_frame_cache_frame_size(cache),
+			cached->size);
+	return true;
+}
+
+static bool store_frame(struct stinger_frame_cache *layout,
+		struct cache_decoder *d, enum stinger_cache_storage storage,
+		struct stinger_cached_frame *cached)
+{
+	AVFrame *frame = d->decoder.frame;
+
+	if (!layout->width) {
+		init_layout(layout, frame, storage);
+	} else if ((uint32_t)frame->width != layout->width ||
+	           (uint32_t)frame->height != layout->height ||
+	           (layout->storage == STINGER_CACHE_STORE_PLANAR &&
+	            frame->format != layout->pix_fmt)) {
+		blog(LOG_WARNING, "stinger cache: frame format changed "
+				"mid-stream, not caching");
+		return false;
+	}
+
+	cached->pts = frame->best_effort_timestamp;
+
+	switch (layout->storage) {
+	case STINGER_CACHE_STORE_PLANAR:
+		return store_planar(layout, d, cached);
+	case STINGER_CACHE_STORE_COMPRESSED:
+		return store_compressed(layout, d, cached);
+	default:
+		return store_bgra(layout, d, cached);
+	}
+}
+
+enum stinger_cache_result stinger_frame_cache_decode(const char *path,
+		enum stinger_cache_storage storage, uint32_t max_width,
+		uint32_t max_height, size_t budget, volatile bool *abort,
+		stinger_cache_frame_cb callback, void *param)
+{
+	enum stinger_cache_result result = STINGER_CACHE_FILLED;
+	struct stinger_frame_cache layout = {0};
+	struct cache_decoder d = {0};
+	size_t frames = 0;
+	struct stinger_decoder_options options = {
+		.max_width = max_width,
+		.max_height = max_height,
+		.threading = STINGER_THREADING_FRAME,
+		.read_ahead = true
+	};
+
+	if (!stinger_decoder_open(&d.decoder, path, &options)) {
+		result = STINGER_CACHE_FAILED;
+		goto finish;
+	}
+
+	if (estimate_cache_size(&d, storage) > budget) {
+		result = STINGER_CACHE_OVER_BUDGET;
+		goto finish;
+	}
+
+	while (stinger_decoder_next(&d.decoder)) {
+		struct stinger_cached_frame cached;
+
+		if (*abort) {
+			result = STINGER_CACHE_ABORTED;
+			goto finish;
+		}
+
+		if (!store_frame(&layout, &d, storage, &cached)) {
+			result = STINGER_CACHE_FAILED;
+			goto finish;
+		}
+
+		if (!callback(param, &layout, &cached)) {
+			result = STINGER_CACHE_ABORTED;
+			goto finish;
+		}
+		frames++;
+	}
+
+	if (!frames)
+		result = STINGER_CACHE_FAILED;
+
+finish:
+	cache_decoder_free(&d);
+	return result;
+}
+
+struct fill_data {
+	struct stinger_frame_cache *cache;
+	size_t budget;
+	bool over_budget;
+};
+
+static bool fill_frame(void *param, const struct stinger_frame_cache *layout,
+		struct stinger_cached_frame *frame)
+{
+	struct fill_data *fill = param;
+	struct stinger_frame_cache *cache = fill->cache;
+
+	if (cache->memory_used + frame->size > fill->budget) {
+		bfree(frame->data);
+		fill->over_budget = true;
+		return false;
+	}
+
+	if (!cache->frames.num) {
+		size_t memory_used = cache->memory_used;
+
+		*cache = *layout;
+		da_init(cache->frames);
+		cache->memory_used = memory_used;
+	}
+
+	da_push_back(cache->frames, frame);
+	cache->memory_used += frame->size;
+	return true;
+}
+
+enum stinger_cache_result stinger_frame_cache_fill(
+		struct stinger_frame_cache *cache, const char *path,
+		enum stinger_cache_storage storage, uint32_t max_width,
+		uint32_t max_height, size_t budget, volatile bool *abort)
+{
+	struct fill_data fill = {cache, budget, false};
+	enum stinger_cache_result result;
+
+	stinger_frame_cache_free(cache);
+
+	result = stinger_frame_cache_decode(path, storage, max_width,
+			max_height, budget, abort, fill_frame, &fill);
+	if (fill.over_budget)
+		result = STINGER_CACHE_OVER_BUDGET;
+
+	if (result != STINGER_CACHE_FILLED)
+		stinger_frame_cache_free(cache);
+	return result;
+}
+
+void stinger_frame_cache_free(struct stinger_frame_cache *cache)
+{
+	for (size_t i = 0; i < cache->frames.num; i++)
+		bfree(cache->frames.array[i].data);
+	da_free(cache->frames);
+
+	cache->storage = STINGER_CACHE_STORE_BGRA;
+	cache->width = 0;
+	cache->height = 0;
+	cache->linesize = 0;
+	cache->premultiplied = false;
+	cache->format = VIDEO_FORMAT_NONE;
+	cache->memory_used = 0;
+}
+
+void stinger_frame_cache_get_planes(const struct stinger_frame_cache *cache,
+		size_t index, uint8_t *data[], int linesize[])
+{
+	uint8_t *planes[4];
+	int linesizes[4];
+
+	av_image_fill_arrays(planes, linesizes, cache->frames.array[index].data,
+			cache->pix_fmt, (int)cache->width, (int)cache->height,
+			1);
+
+	for (size_t i = 0; i < STINGER_MAX_PLANES; i++) {
+		data[i] = planes[i];
+		linesize[i] = linesizes[i];
+	}
+}
+
+static bool unpack_planar(const struct stinger_frame_cache *cache,
+		size_t index, uint8_t *dst, int linesize)
+{
+	AVFrame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.format = cache->pix_fmt;
+	frame.width = (int)cache->width;
+	frame.height = (int)cache->height;
+	frame.color_range = cache->range == VIDEO_RANGE_FULL ?
+		AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+	frame.colorspace = cache->colorspace == VIDEO_CS_709 ?
+		AVCOL_SPC_BT709 : AVCOL_SPC_BT470BG;
+
+	av_image_fill_arrays(frame.data, frame.linesize,
+			cache->frames.array[index].data, cache->pix_fmt,
+			frame.width, frame.height, 1);
+
+	return stinger_convert_frame(&frame, dst, linesize);
+}
+
+bool stinger_frame_cache_unpack(const struct stinger_frame_cache *cache,
+		size_t index, uint8_t *dst, int linesize)
+{
+	const struct stinger_cached_frame *frame = &cache->frames.array[index];
+
+	if (cache->storage == STINGER_CACHE_STORE_PLANAR)
+		return unpack_planar(cache, index, dst, linesize);
+
+	if (cache->storage == STINGER_CACHE_STORE_COMPRESSED &&
+	    linesize == (int)cache->linesize)
+		return decompress_pixels(frame->data, frame->size,
+				(uint32_t *)dst,
+				(size_t)cache->width * cache->height);
+
+	if (cache->storage == STINGER_CACHE_STORE_BGRA &&
+	    linesize == (int)cache->linesize) {
+		memcpy(dst, frame->data, frame->size);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/darray.h>
+#include <media-io/video-io.h>
+
+/* Fully decoded copy of a stinger clip, so the render callback can pick
+ * frames by index without touching the decoder. Frames are kept in one of
+ * three layouts:
+ *
+ * - BGRA: one image per frame, uploaded as it is. Clips with an alpha
+ *   plane are stored premultiplied.
+ * - planar: the decoder's own 8-bit YUV(A) planes, packed tightly. Formats
+ *   the texture ring takes are uploaded as they are; YUVA frames are
+ *   converted to premultiplied BGRA before display.
+ * - compressed: the BGRA image run-length coded per pixel, which collapses
+ *   the transparent and flat areas stingers are mostly made of.
+ *
+ * Formats a layout can't hold fall back to BGRA. */
+
+enum stinger_cache_storage {
+	STINGER_CACHE_STORE_BGRA,
+	STINGER_CACHE_STORE_PLANAR,
+	STINGER_CACHE_STORE_COMPRESSED
+};
+
+struct stinger_cached_frame {
+	uint8_t *data;
+	size_t size;
+	int64_t pts;
+};
+
+struct stinger_frame_cache {
+	DARRAY(struct stinger_cached_frame) frames;
+	enum stinger_cache_storage storage;
+	uint32_t width;
+	uint32_t height;
+
+	/* of the BGRA image a frame is stored as or unpacked to */
+	uint32_t linesize;
+	bool premultiplied;
+
+	/* planar frames only */
+	int pix_fmt;
+	enum video_format format;
+	enum video_colorspace colorspace;
+	enum video_range_type range;
+
+	size_t memory_used;
+};
+
+enum stinger_cache_result {
+	STINGER_CACHE_FILLED,
+	STINGER_CACHE_OVER_BUDGET,
+	STINGER_CACHE_ABORTED,
+	STINGER_CACHE_FAILED
+};
+
+/* Decodes the whole clip at path into the cache, fitting frames into
+ * max_width x max_height (0 for the clip's own size). Gives up (and leaves
+ * the cache empty) as soon as the stored frames would exceed budget
+ * bytes. */
+extern enum stinger_cache_result stinger_frame_cache_fill(
+		struct stinger_frame_cache *cache, const char *path,
+		enum stinger_cache_storage storage, uint32_t max_width,
+		uint32_t max_height, size_t budget, volatile bool *abort);
+
+extern void stinger_frame_cache_free(struct stinger_frame_cache *cache);
+
+/* Called for each decoded frame with the clip's layout (the cache fields
+ * other than the frames). The callback takes over frame->data; returning
+ * false stops decoding. */
+typedef bool (*stinger_cache_frame_cb)(void *param,
+		const struct stinger_frame_cache *layout,
+		struct stinger_cached_frame *frame);
+
+/* Decodes the clip at path frame by frame in the given layout, without
+ * keeping the frames. Clips estimated to take more than budget bytes are
+ * refused up front. */
+extern enum stinger_cache_result stinger_frame_cache_decode(const char *path,
+		enum stinger_cache_storage storage, uint32_t max_width,
+		uint32_t max_height, size_t budget, volatile bool *abort,
+		stinger_cache_frame_cb callback, void *param);
+
+extern const char *stinger_cache_storage_name(
+		enum stinger_cache_storage storage);
+
+/* True if frames have to be unpacked to BGRA before they can be uploaded */
+static inline bool stinger_frame_cache_needs_unpack(
+		const struct stinger_frame_cache *cache)
+{
+	return cache->storage == STINGER_CACHE_STORE_COMPRESSED ||
+		(cache->storage == STINGER_CACHE_STORE_PLANAR &&
+		 cache->format == VIDEO_FORMAT_NONE);
+}
+
+/* Planes of a planar frame the texture ring can upload directly */
+extern void stinger_frame_cache_get_planes(
+		const struct stinger_frame_cache *cache, size_t index,
+		uint8_t *data[], int linesize[]);
+
+/* Unpacks a frame into the BGRA image at dst */
+extern bool stinger_frame_cache_unpack(const struct stinger_frame_cache *cache,
+		size_t index, uint8_t *dst, int linesize);
+
+static inline size_t stinger_frame_cache_frame_size(
+		const struct stinger_frame_cache *cache)
+{
+	return (size_t)cache->linesize * cache->height;
+}
@@ -0,0 +1,134 @@
+#include <obs-module.h>
+
+#include "stinger-matte.h"
+
+void stinger_matte_get_rects(enum stinger_matte_layout layout,
+		struct vec4 *color, struct vec4 *matte)
+{
+	switch (layout) {
+	case STINGER_MATTE_SIDE_BY_SIDE:
+		vec4_set(color, 0.0f, 0.0f, 0.5f, 1.0f);
+		vec4_set(matte, 0.5f, 0.0f, 0.5f, 1.0f);
+		break;
+	case STINGER_MATTE_STACKED:
+		vec4_set(color, 0.0f, 0.0f, 1.0f, 0.5f);
+		vec4_set(matte, 0.0f, 0.5f, 1.0f, 0.5f);
+		break;
+	default:
+		vec4_set(color, 0.0f, 0.0f, 1.0f, 1.0f);
+		vec4_set(matte, 0.0f, 0.0f, 1.0f, 1.0f);
+	}
+}
+
+void stinger_matte_get_luma(enum video_format format,
+		enum video_range_type range, struct vec3 *weights,
+		struct vec2 *levels)
+{
+	bool yuv = true;
+
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_I444:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_Y800:
+		vec3_set(weights, 1.0f, 0.0f, 0.0f);
+		break;
+
+	/* packed texels hold two luma samples, (r, g, b) is Y1 U Y0 for
+	 * YUY2 and V Y0 U for UYVY */
+	case VIDEO_FORMAT_YUY2:
+		vec3_set(weights, 0.5f, 0.0f, 0.5f);
+		break;
+	case VIDEO_FORMAT_UYVY:
+		vec3_set(weights, 0.0f, 1.0f, 0.0f);
+		break;
+
+	default:
+		vec3_set(weights, 0.2126f, 0.7152f, 0.0722f);
+		yuv = false;
+	}
+
+	if (yuv && range != VIDEO_RANGE_FULL)
+		vec2_set(levels, 16.0f / 255.0f, 255.0f / 219.0f);
+	else
+		vec2_set(levels, 0.0f, 1.0f);
+}
+
+/* Replaces the held frame with a newer one up to target, if there is one */
+static void take_newer(struct stinger_playback *pb, int64_t target,
+		struct stinger_queued_frame *held, uint64_t *dropped)
+{
+	struct stinger_queued_frame frame;
+
+	if (!stinger_playback_take(pb, target, &frame, dropped))
+		return;
+
+	if (held->frame) {
+		stinger_queued_frame_release(held);
+		(*dropped)++;
+	}
+	*held = frame;
+}
+
+bool stinger_matte_sync_take(struct stinger_matte_sync *sync,
+		struct stinger_playback *color_pb,
+		struct stinger_playback *matte_pb, int64_t target,
+		struct stinger_queued_frame *color,
+		struct stinger_queued_frame *matte, uint64_t *dropped)
+{
+	take_newer(color_pb, target, &sync->color, dropped);
+	if (!sync->color.frame)
+		return false;
+
+	/* the matte never runs past the color, so the frame it holds is
+	 * either the match or one the color stream has already left behind */
+	if (matte_pb)
+		take_newer(matte_pb, sync->color.index, &sync->matte,
+				&sync->matte_dropped);
+
+	if (!sync->matte.frame || sync->matte.index < sync->color.index) {
+		if (matte_pb && !stinger_playback_finished(matte_pb)) {
+			sync->waits++;
+			return false;
+		}
+
+		/* a matte shorter than the color leaves its last frame up */
+		if (sync->matte.frame)
+			stinger_queued_frame_release(&sync->matte);
+		memset(&sync->matte, 0, sizeof(sync->matte));
+		sync->unmatched++;
+	}
+
+	*color = sync->color;
+	*matte = sync->matte;
+	memset(&sync->color, 0, sizeof(sync->color));
+	memset(&sync->matte, 0, sizeof(sync->matte));
+	return true;
+}
+
+void stinger_matte_sync_reset(struct stinger_matte_sync *sync)
+{
+	if (sync->color.frame)
+		stinger_queued_frame_release(&sync->color);
+	if (sync->matte.frame)
+		stinger_queued_frame_release(&sync->matte);
+
+	memset(&sync->color, 0, sizeof(sync->color));
+	memset(&sync->matte, 0, sizeof(sync->matte));
+}
+
+void stinger_matte_sync_log_stats(struct stinger_matte_sync *sync,
+		const char *name)
+{
+	if (sync->waits || sync->unmatched || sync->matte_dropped)
+		blog(LOG_INFO, "stinger '%s': held %llu frames for their "
+				"matte, %llu shown without one, %llu matte "
+				"frames dropped", name,
+				(unsigned long long)sync->waits,
+				(unsigned long long)sync->unmatched,
+				(unsigned long long)sync->matte_dropped);
+
+	sync->waits = 0;
+	sync->unmatched = 0;
+	sync->matte_dropped = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <graphics/vec2.h>
+#include <graphics/vec3.h>
+#include <graphics/vec4.h>
+#include <media-io/video-io.h>
+
+#include "stinger-playback.h"
+
+/* Alpha for stingers encoded without an alpha channel, so they can use
+ * plain 4:2:0 codecs. The matte is either packed beside (or below) the
+ * color in the same frame, or comes from a second file that's decoded in
+ * lockstep with the first; the effect rebuilds alpha from its luma. */
+
+enum stinger_matte_layout {
+	STINGER_MATTE_NONE,
+	STINGER_MATTE_SIDE_BY_SIDE,
+	STINGER_MATTE_STACKED,
+	STINGER_MATTE_FILE,
+};
+
+static inline bool stinger_matte_is_packed(enum stinger_matte_layout layout)
+{
+	return layout == STINGER_MATTE_SIDE_BY_SIDE ||
+		layout == STINGER_MATTE_STACKED;
+}
+
+/* Parts of the frame holding the color and the matte, as uv offset (x, y)
+ * and scale (z, w) */
+extern void stinger_matte_get_rects(enum stinger_matte_layout layout,
+		struct vec4 *color, struct vec4 *matte);
+
+/* How the effect turns a texel of a separate matte's first plane into
+ * alpha: luma weights, then the black level (x) and scale (y) of the
+ * range */
+extern void stinger_matte_get_luma(enum video_format format,
+		enum video_range_type range, struct vec3 *weights,
+		struct vec2 *levels);
+
+/* Pairs frames of the color and matte playbacks by index. Whichever
+ * stream is ahead holds its frame until the other catches up, so the two
+ * are only ever shown together. Render thread only. */
+struct stinger_matte_sync {
+	struct stinger_queued_frame color;
+	struct stinger_queued_frame matte;
+
+	uint64_t waits;
+	uint64_t unmatched;
+	uint64_t matte_dropped;
+};
+
+/* Hands out the newest color frame at or before target along with its
+ * matte, false while either hasn't been decoded yet. matte->frame is NULL
+ * if the matte ended early (or failed to open) and the previous one should
+ * stay up. Colour frames replaced before they could be shown are added to
+ * dropped. */
+extern bool stinger_matte_sync_take(struct stinger_matte_sync *sync,
+		struct stinger_playback *color_pb,
+		struct stinger_playback *matte_pb, int64_t target,
+		struct stinger_queued_frame *color,
+		struct stinger_queued_frame *matte, uint64_t *dropped);
+
+/* Releases the held frames, for when a new clip starts */
+extern void stinger_matte_sync_reset(struct stinger_matte_sync *sync);
+
+extern void stinger_matte_sync_log_stats(struct stinger_matte_sync *sync,
+		const char *name);
@@ -0,0 +1,448 @@
+#include <obs-module.h>
+#include <util/config-file.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/dstr.h>
+#include <sys/stat.h>
+
+#include "stinger-meta-cache.h"
+
+#define CACHE_FILE "probe-cache.ini"
+#define INDEX_DIR "probe-index"
+
+#define INDEX_MAGIC "STNGINDX"
+#define INDEX_VERSION 1
+
+/* Frame indexes are kept out of the INI, each in a file of its own named
+ * after the entry's section: this header, then the entries as they are in
+ * memory. The size and modification time of the clip are checked on load
+ * like the entry's. */
+struct index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t count;
+	uint64_t source_size;
+	int64_t source_mtime;
+};
+
+/* stores only change the config in memory, it's written out on unload */
+static config_t *cache_config = NULL;
+static bool cache_dirty = false;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t cache_hits = 0;
+static uint64_t cache_misses = 0;
+
+void stinger_meta_cache_init(void)
+{
+	char *dir = obs_module_config_path(INDEX_DIR);
+	char *file = obs_module_config_path(CACHE_FILE);
+
+	os_mkdirs(dir);
+
+	pthread_mutex_lock(&cache_mutex);
+	if (config_open(&cache_config, file, CONFIG_OPEN_ALWAYS) !=
+			CONFIG_SUCCESS) {
+		blog(LOG_WARNING, "stinger: couldn't open probe cache '%s'",
+				file);
+		cache_config = NULL;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	bfree(file);
+	bfree(dir);
+}
+
+void stinger_meta_cache_free(void)
+{
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_config) {
+		if (cache_dirty)
+			config_save_safe(cache_config, "tmp", NULL);
+		config_close(cache_config);
+		cache_config = NULL;
+	}
+	cache_dirty = false;
+
+	blog(LOG_INFO, "stinger: probe cache %llu hits, %llu misses",
+			(unsigned long long)cache_hits,
+			(unsigned long long)cache_misses);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/* Section names are a hash of the path, the path itself is stored inside the
+ * section to rule out collisions */
+static void get_section(struct dstr *section, const char *path)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (const char *c = path; *c; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 1099511628211ULL;
+	}
+
+	dstr_printf(section, "%016llx", (unsigned long long)hash);
+}
+
+static void load_keyframes(struct stinger_probe_info *info, const char *list)
+{
+	char *end;
+
+	while (list && *list) {
+		int64_t frame = strtoll(list, &end, 10);
+		if (end == list)
+			break;
+
+		da_push_back(info->keyframes, &frame);
+		list = *end == ',' ? end + 1 : end;
+	}
+}
+
+static void save_keyframes(struct stinger_probe_info *info, struct dstr *list)
+{
+	for (size_t i = 0; i < info->keyframes.num; i++)
+		dstr_catf(list, i ? ",%lld" : "%lld",
+				(long long)info->keyframes.array[i]);
+}
+
+static char *get_index_path(const char *section)
+{
+	struct dstr name = {0};
+	char *path;
+
+	dstr_printf(&name, INDEX_DIR "/%s.idx", section);
+	path = obs_module_config_path(name.array);
+	dstr_free(&name);
+	return path;
+}
+
+/* Reads the entry's frame index, which has count entries; false if the
+ * file is missing or doesn't match the clip */
+static bool load_index(const char *section, const struct stat *st,
+		uint64_t count, struct stinger_probe_info *info)
+{
+	struct index_header header;
+	char *path;
+	FILE *f;
+	bool success;
+
+	if (!count)
+		return true;
+	if (count != (uint64_t)info->frame_count)
+		return false;
+
+	path = get_index_path(section);
+	f = os_fopen(path, "rb");
+	bfree(path);
+	if (!f)
+		return false;
+
+	success = fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+		memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == INDEX_VERSION &&
+		header.entry_size == sizeof(struct stinger_index_entry) &&
+		header.count == count &&
+		header.source_size == (uint64_t)st->st_size &&
+		header.source_mtime == (int64_t)st->st_mtime;
+
+	if (success) {
+		da_resize(info->index, (size_t)count);
+		success = fread(info->index.array, sizeof(*info->index.array),
+				(size_t)count, f) == (size_t)count;
+	}
+	fclose(f);
+
+	if (!success)
+		da_free(info->index);
+	return success;
+}
+
+/* Writes the frame index next to the config, or removes a stale one when
+ * the probe found none */
+static void save_index(const char *section, const struct stat *st,
+		const struct stinger_probe_info *info)
+{
+	struct index_header header = {0};
+	char *path = get_index_path(section);
+	struct dstr temp = {0};
+	bool success;
+	FILE *f;
+
+	if (!info->index.num) {
+		os_unlink(path);
+		bfree(path);
+		return;
+	}
+
+	dstr_printf(&temp, "%s.tmp", path);
+	f = os_fopen(temp.array, "wb");
+	if (!f) {
+		blog(LOG_WARNING, "stinger: couldn't write frame index '%s'",
+				temp.array);
+		goto finish;
+	}
+
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.entry_size = sizeof(struct stinger_index_entry);
+	header.count = info->index.num;
+	header.source_size = (uint64_t)st->st_size;
+	header.source_mtime = (int64_t)st->st_mtime;
+
+	success = fwrite(&header, 1, sizeof(header), f) == sizeof(header) &&
+		fwrite(info->index.array, sizeof(*info->index.array),
+				info->index.num, f) == info->index.num;
+	success = fclose(f) == 0 && success;
+
+	if (!success || os_rename(temp.array, path) != 0)
+		os_unlink(temp.array);
+
+finish:
+	dstr_free(&temp);
+	bfree(path);
+}
+
+static void load_coverage(struct stinger_probe_info *info, const char *list)
+{
+	char *end;
+
+	while (list && *list) {
+		uint16_t coverage = (uint16_t)strtoul(list, &end, 10);
+		if (end == list)
+			break;
+
+		da_push_back(info->coverage, &coverage);
+		list = *end == ',' ? end + 1 : end;
+	}
+}
+
+static void save_coverage(struct stinger_probe_info *info, struct dstr *list)
+{
+	for (size_t i = 0; i < info->coverage.num; i++)
+		dstr_catf(list, i ? ",%u" : "%u",
+				(unsigned)info->coverage.array[i]);
+}
+
+/* Each coverage source has its curve under a key of its own, so measuring
+ * one source doesn't throw away another's */
+static inline void get_coverage_key(struct dstr *key,
+		enum stinger_coverage_source source)
+{
+	dstr_printf(key, "coverage_%d", (int)source);
+}
+
+/* True if the section describes the file as it is now */
+static bool is_current(const char *section, const char *path,
+		const struct stat *st)
+{
+	const char *cached_path;
+
+	cached_path = config_get_string(cache_config, section, "path");
+	return cached_path && strcmp(cached_path, path) == 0 &&
+		config_get_int(cache_config, section, "size") ==
+			(int64_t)st->st_size &&
+		config_get_int(cache_config, section, "mtime") ==
+			(int64_t)st->st_mtime;
+}
+
+/* Fills in everything but the frame index, of which index_count gets the
+ * number of entries. Called with the cache mutex held. */
+static bool cache_lookup(const char *section, const char *path,
+		const struct stat *st, enum stinger_coverage_source coverage,
+		struct stinger_probe_info *info, uint64_t *index_count)
+{
+	struct dstr coverage_key = {0};
+
+	if (!is_current(section, path, st))
+		return false;
+
+	/* entries from before the frame index had a file of its own are
+	 * probed again */
+	if (!config_has_user_value(cache_config, section, "index_frames"))
+		return false;
+
+	get_coverage_key(&coverage_key, coverage);
+	if (coverage != STINGER_COVERAGE_NONE &&
+	    !config_has_user_value(cache_config, section,
+		    coverage_key.array)) {
+		dstr_free(&coverage_key);
+		return false;
+	}
+
+	memset(info, 0, sizeof(*info));
+	info->frame_count = config_get_int(cache_config, section, "frames");
+	if (info->frame_count <= 0) {
+		dstr_free(&coverage_key);
+		return false;
+	}
+
+	info->duration_ms = (uint32_t)config_get_uint(cache_config, section,
+			"duration_ms");
+	info->framerate.num = (int)config_get_int(cache_config, section,
+			"fps_num");
+	info->framerate.den = (int)config_get_int(cache_config, section,
+			"fps_den");
+	info->width = (int)config_get_int(cache_config, section, "width");
+	info->height = (int)config_get_int(cache_config, section, "height");
+	info->pixel_format = (enum AVPixelFormat)config_get_int(cache_config,
+			section, "pix_fmt");
+	info->has_alpha = config_get_bool(cache_config, section, "alpha");
+	info->method = (enum stinger_probe_method)config_get_int(
+			cache_config, section, "method");
+	load_keyframes(info, config_get_string(cache_config, section,
+				"keyframes"));
+	info->time_base.num = (int)config_get_int(cache_config, section,
+			"tb_num");
+	info->time_base.den = (int)config_get_int(cache_config, section,
+			"tb_den");
+	info->end_pts = config_get_int(cache_config, section, "end_pts");
+	*index_count = config_get_uint(cache_config, section, "index_frames");
+
+	if (coverage != STINGER_COVERAGE_NONE) {
+		info->coverage_source = coverage;
+		load_coverage(info, config_get_string(cache_config, section,
+					coverage_key.array));
+	}
+
+	dstr_free(&coverage_key);
+	return true;
+}
+
+/* The frame index is saved separately, see save_index(). Called with the
+ * cache mutex held. */
+static void cache_store(const char *section, const char *path,
+		const struct stat *st, struct stinger_probe_info *info)
+{
+	struct dstr keyframes = {0};
+	struct dstr coverage = {0};
+	struct dstr key = {0};
+
+	/* curves of the file as it was are no good anymore, and neither are
+	 * the keys from before they were kept per source */
+	if (!is_current(section, path, st)) {
+		for (int source = STINGER_COVERAGE_ALPHA;
+				source <= STINGER_COVERAGE_LUMA_BOTTOM;
+				source++) {
+			get_coverage_key(&key,
+					(enum stinger_coverage_source)source);
+			config_remove_value(cache_config, section, key.array);
+		}
+	}
+	config_remove_value(cache_config, section, "coverage_source");
+	config_remove_value(cache_config, section, "coverage");
+	config_remove_value(cache_config, section, "index");
+
+	save_keyframes(info, &keyframes);
+	save_coverage(info, &coverage);
+
+	config_set_string(cache_config, section, "path", path);
+	config_set_int(cache_config, section, "size", (int64_t)st->st_size);
+	config_set_int(cache_config, section, "mtime", (int64_t)st->st_mtime);
+	config_set_int(cache_config, section, "frames", info->frame_count);
+	config_set_uint(cache_config, section, "duration_ms",
+			info->duration_ms);
+	config_set_int(cache_config, section, "fps_num", info->framerate.num);
+	config_set_int(cache_config, section, "fps_den", info->framerate.den);
+	config_set_int(cache_config, section, "width", info->width);
+	config_set_int(cache_config, section, "height", info->height);
+	config_set_int(cache_config, section, "pix_fmt", info->pixel_format);
+	config_set_bool(cache_config, section, "alpha", info->has_alpha);
+	config_set_int(cache_config, section, "method", info->method);
+	config_set_string(cache_config, section, "keyframes",
+			keyframes.array ? keyframes.array : "");
+	config_set_int(cache_config, section, "tb_num", info->time_base.num);
+	config_set_int(cache_config, section, "tb_den", info->time_base.den);
+	config_set_int(cache_config, section, "end_pts", info->end_pts);
+	config_set_uint(cache_config, section, "index_frames",
+			info->index.num);
+
+	if (info->coverage_source != STINGER_COVERAGE_NONE) {
+		get_coverage_key(&key, info->coverage_source);
+		config_set_string(cache_config, section, key.array,
+				coverage.array ? coverage.array : "");
+	}
+
+	cache_dirty = true;
+	dstr_free(&keyframes);
+	dstr_free(&coverage);
+	dstr_free(&key);
+}
+
+static bool probe(const char *path, enum stinger_coverage_source coverage,
+		bool lookup_only, struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info)
+{
+	struct dstr section = {0};
+	struct stat st;
+	uint64_t index_count = 0;
+	bool success;
+	bool hit;
+
+	if (!path || !*path || os_stat(path, &st) != 0) {
+		memset(info, 0, sizeof(*info));
+		return false;
+	}
+
+	get_section(&section, path);
+
+	pthread_mutex_lock(&cache_mutex);
+	hit = cache_config && cache_lookup(section.array, path, &st, coverage,
+			info, &index_count);
+	pthread_mutex_unlock(&cache_mutex);
+
+	/* the index file is read outside the lock, and without it the entry
+	 * is probed again */
+	if (hit && !load_index(section.array, &st, index_count, info)) {
+		stinger_probe_info_free(info);
+		hit = false;
+	}
+
+	pthread_mutex_lock(&cache_mutex);
+	if (hit)
+		cache_hits++;
+	else if (!lookup_only)
+		cache_misses++;
+	pthread_mutex_unlock(&cache_mutex);
+
+	if (hit) {
+		blog(LOG_DEBUG, "stinger: probe cache hit for '%s'", path);
+		dstr_free(&section);
+		return true;
+	}
+
+	if (lookup_only) {
+		memset(info, 0, sizeof(*info));
+		dstr_free(&section);
+		return false;
+	}
+
+	/* probe outside the lock, other files can still hit the cache */
+	success = stinger_probe_file(path, coverage, abort, info);
+
+	if (success) {
+		save_index(section.array, &st, info);
+
+		pthread_mutex_lock(&cache_mutex);
+		if (cache_config)
+			cache_store(section.array, path, &st, info);
+		pthread_mutex_unlock(&cache_mutex);
+	}
+
+	dstr_free(&section);
+	return success;
+}
+
+bool stinger_meta_cache_probe(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info)
+{
+	return probe(path, coverage, false, abort, info);
+}
+
+bool stinger_meta_cache_lookup(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_info *info)
+{
+	return probe(path, coverage, true, NULL, info);
+}
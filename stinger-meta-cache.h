@@ -0,0 +1,26 @@
+#pragma once
+
+#include "stinger-probe.h"
+
+/* Module-wide cache of probe results, persisted in the plugin config
+ * directory: the results in an INI written out on unload, and each clip's
+ * frame index in a file of its own. Entries are keyed by path and only
+ * reused while the file's size and modification time are unchanged. */
+
+extern void stinger_meta_cache_init(void);
+extern void stinger_meta_cache_free(void);
+
+/* Fills info from the cache, probing (and storing) the file on a miss.
+ * Entries only hit for a coverage source other than NONE if their curve
+ * was measured from that source. Probes given up on through abort (which
+ * may be NULL) aren't stored. The caller owns info and releases it with
+ * stinger_probe_info_free. */
+extern bool stinger_meta_cache_probe(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info);
+
+/* Same, without probing on a miss */
+extern bool stinger_meta_cache_lookup(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_info *info);
@@ -0,0 +1,376 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/dstr.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "stinger-pack.h"
+
+struct stinger_pack_mapping {
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const uint8_t *data;
+	uint64_t size;
+};
+
+static void unmap_file(struct stinger_pack_mapping *m)
+{
+	if (!m)
+		return;
+
+#ifdef _WIN32
+	if (m->data)
+		UnmapViewOfFile(m->data);
+	if (m->mapping)
+		CloseHandle(m->mapping);
+	if (m->file != INVALID_HANDLE_VALUE)
+		CloseHandle(m->file);
+#else
+	if (m->data)
+		munmap((void *)m->data, (size_t)m->size);
+	if (m->fd >= 0)
+		close(m->fd);
+#endif
+
+	bfree(m);
+}
+
+static struct stinger_pack_mapping *map_file(const char *path)
+{
+	struct stinger_pack_mapping *m = bzalloc(sizeof(*m));
+
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	wchar_t *wpath = NULL;
+
+	os_utf8_to_wcs_ptr(path, 0, &wpath);
+	m->file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bfree(wpath);
+
+	if (m->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m->file, &size))
+		goto fail;
+
+	m->size = (uint64_t)size.QuadPart;
+	m->mapping = CreateFileMappingW(m->file, NULL, PAGE_READONLY, 0, 0,
+			NULL);
+	if (!m->mapping)
+		goto fail;
+
+	m->data = MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m->data)
+		goto fail;
+#else
+	struct stat st;
+	void *data;
+
+	m->fd = open(path, O_RDONLY);
+	if (m->fd < 0 || fstat(m->fd, &st) != 0 || st.st_size <= 0)
+		goto fail;
+
+	m->size = (uint64_t)st.st_size;
+	data = mmap(NULL, (size_t)m->size, PROT_READ, MAP_SHARED, m->fd, 0);
+	if (data == MAP_FAILED)
+		goto fail;
+	m->data = data;
+#endif
+
+	return m;
+
+fail:
+	unmap_file(m);
+	return NULL;
+}
+
+char *stinger_pack_get_path(const char *source)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	struct dstr name = {0};
+	char *path;
+
+	for (const char *c = source; *c; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 1099511628211ULL;
+	}
+
+	dstr_printf(&name, "packs/%016llx.stpack", (unsigned long long)hash);
+	path = obs_module_config_path(name.array);
+	dstr_free(&name);
+	return path;
+}
+
+struct export_data {
+	FILE *file;
+	struct stinger_pack_header header;
+	DARRAY(struct stinger_pack_entry) entries;
+	uint64_t pos;
+	bool error;
+};
+
+static bool write_padding(struct export_data *data, uint64_t offset)
+{
+	static const uint8_t zeros[STINGER_PACK_ALIGN] = {0};
+
+	while (data->pos < offset) {
+		size_t size = offset - data->pos > sizeof(zeros) ?
+			sizeof(zeros) : (size_t)(offset - data->pos);
+
+		if (fwrite(zeros, 1, size, data->file) != size)
+			return false;
+		data->pos += size;
+	}
+
+	return true;
+}
+
+static bool write_frame(void *param, const struct stinger_frame_cache *layout,
+		struct stinger_cached_frame *frame)
+{
+	struct export_data *data = param;
+	struct stinger_pack_entry entry;
+
+	if (!data->entries.num) {
+		data->header.storage = (uint32_t)layout->storage;
+		data->header.width = layout->width;
+		data->header.height = layout->height;
+		data->header.linesize = layout->linesize;
+		data->header.premultiplied = layout->premultiplied;
+	}
+
+	entry.offset = (data->pos + STINGER_PACK_ALIGN - 1) &
+		~(uint64_t)(STINGER_PACK_ALIGN - 1);
+	entry.size = frame->size;
+	entry.pts = frame->pts;
+
+	if (!write_padding(data, entry.offset) ||
+	    fwrite(frame->data, 1, frame->size, data->file) != frame->size)
+		data->error = true;
+
+	data->pos += frame->size;
+	da_push_back(data->entries, &entry);
+	bfree(frame->data);
+	return !data->error;
+}
+
+static bool write_pack(struct export_data *data)
+{
+	size_t table_size = data->entries.num * sizeof(*data->entries.array);
+
+	data->header.frame_count = (uint32_t)data->entries.num;
+	data->header.table_offset = data->pos;
+
+	if (fwrite(data->entries.array, 1, table_size, data->file) !=
+			table_size)
+		return false;
+
+	/* the header goes in last, so a pack that was cut short is never
+	 * mistaken for a complete one */
+	memcpy(data->header.magic, STINGER_PACK_MAGIC,
+			sizeof(data->header.magic));
+	return os_fseeki64(data->file, 0, SEEK_SET) == 0 &&
+		fwrite(&data->header, 1, sizeof(data->header), data->file) ==
+			sizeof(data->header);
+}
+
+bool stinger_pack_export(const char *source, bool compress,
+		uint32_t max_width, uint32_t max_height, volatile bool *abort)
+{
+	struct export_data data = {0};
+	enum stinger_cache_result result;
+	char *path = stinger_pack_get_path(source);
+	char *dir = obs_module_config_path("packs");
+	struct dstr temp = {0};
+	uint64_t start = os_gettime_ns();
+	struct stat st;
+	bool success = false;
+
+	if (os_stat(source, &st) != 0)
+		goto finish;
+
+	os_mkdirs(dir);
+	dstr_printf(&temp, "%s.tmp", path);
+
+	data.file = os_fopen(temp.array, "wb");
+	if (!data.file) {
+		blog(LOG_WARNING, "stinger: couldn't create pack '%s'",
+				temp.array);
+		goto finish;
+	}
+
+	data.header.version = STINGER_PACK_VERSION;
+	data.header.max_width = max_width;
+	data.header.max_height = max_height;
+	data.header.source_size = (uint64_t)st.st_size;
+	data.header.source_mtime = (int64_t)st.st_mtime;
+
+	/* page 0 is reserved for the header */
+	data.error = !write_padding(&data, STINGER_PACK_ALIGN);
+
+	result = stinger_frame_cache_decode(source, compress ?
+			STINGER_CACHE_STORE_COMPRESSED :
+			STINGER_CACHE_STORE_BGRA, max_width, max_height,
+			SIZE_MAX, abort, write_frame, &data);
+
+	success = result == STINGER_CACHE_FILLED && !data.error &&
+		write_pack(&data);
+	success = fclose(data.file) == 0 && success;
+
+	if (success) {
+		success = os_rename(temp.array, path) == 0;
+	} else {
+		os_unlink(temp.array);
+	}
+
+	if (success)
+		blog(LOG_INFO, "stinger: exported %d frames of '%s' to '%s' "
+				"(%.1f MiB) in %.2f s",
+				(int)data.entries.num, source, path,
+				(double)data.pos / (1024.0 * 1024.0),
+				(double)(os_gettime_ns() - start) / 1e9);
+	else if (result != STINGER_CACHE_ABORTED)
+		blog(LOG_WARNING, "stinger: failed to export a pack of '%s'",
+				source);
+
+finish:
+	da_free(data.entries);
+	dstr_free(&temp);
+	bfree(dir);
+	bfree(path);
+	return success;
+}
+
+static bool check_header(const struct stinger_pack_header *header,
+		uint64_t size, const struct stat *st)
+{
+	uint64_t table_size;
+
+	if (memcmp(header->magic, STINGER_PACK_MAGIC,
+				sizeof(header->magic)) != 0 ||
+	    header->version != STINGER_PACK_VERSION)
+		return false;
+
+	if (header->source_size != (uint64_t)st->st_size ||
+	    header->source_mtime != (int64_t)st->st_mtime)
+		return false;
+
+	if (header->storage != STINGER_CACHE_STORE_BGRA &&
+	    header->storage != STINGER_CACHE_STORE_COMPRESSED)
+		return false;
+
+	if (!header->frame_count || !header->width || !header->height ||
+	    header->linesize < header->width * 4)
+		return false;
+
+	table_size = (uint64_t)header->frame_count *
+		sizeof(struct stinger_pack_entry);
+	return header->table_offset <= size &&
+		table_size <= size - header->table_offset;
+}
+
+struct stinger_pack *stinger_pack_open(const char *source,
+		uint32_t max_width, uint32_t max_height)
+{
+	const struct stinger_pack_header *header;
+	const struct stinger_pack_entry *entries;
+	struct stinger_pack_mapping *mapping;
+	struct stinger_pack *pack;
+	uint64_t start = os_gettime_ns();
+	char *path;
+	struct stat st;
+
+	if (!source || !*source || os_stat(source, &st) != 0)
+		return NULL;
+
+	path = stinger_pack_get_path(source);
+	mapping = os_file_exists(path) ? map_file(path) : NULL;
+	bfree(path);
+
+	if (!mapping)
+		return NULL;
+
+	header = (const struct stinger_pack_header *)mapping->data;
+	if (mapping->size < STINGER_PACK_ALIGN ||
+	    !check_header(header, mapping->size, &st)) {
+		blog(LOG_INFO, "stinger: ignoring the out of date or invalid "
+				"pack of '%s'", source);
+		unmap_file(mapping);
+		return NULL;
+	}
+
+	if (header->max_width != max_width ||
+	    header->max_height != max_height) {
+		blog(LOG_INFO, "stinger: ignoring the pack of '%s' made for "
+				"%ux%u, frames are now fitted into %ux%u",
+				source, header->max_width,
+				header->max_height, max_width, max_height);
+		unmap_file(mapping);
+		return NULL;
+	}
+
+	pack = bzalloc(sizeof(*pack));
+	pack->mapping = mapping;
+	pack->max_width = header->max_width;
+	pack->max_height = header->max_height;
+	pack->cache.storage = (enum stinger_cache_storage)header->storage;
+	pack->cache.width = header->width;
+	pack->cache.height = header->height;
+	pack->cache.linesize = header->linesize;
+	pack->cache.premultiplied = header->premultiplied != 0;
+	pack->cache.format = VIDEO_FORMAT_BGRA;
+	pack->cache.colorspace = VIDEO_CS_DEFAULT;
+	pack->cache.range = VIDEO_RANGE_DEFAULT;
+
+	entries = (const struct stinger_pack_entry *)
+		(mapping->data + header->table_offset);
+
+	for (uint32_t i = 0; i < header->frame_count; i++) {
+		struct stinger_cached_frame frame;
+
+		if (entries[i].offset > mapping->size ||
+		    entries[i].size > mapping->size - entries[i].offset ||
+		    (header->storage == STINGER_CACHE_STORE_BGRA &&
+		     entries[i].size < stinger_frame_cache_frame_size(
+			     &pack->cache))) {
+			blog(LOG_WARNING, "stinger: pack of '%s' is corrupt",
+					source);
+			stinger_pack_close(pack);
+			return NULL;
+		}
+
+		frame.data = (uint8_t *)mapping->data + entries[i].offset;
+		frame.size = (size_t)entries[i].size;
+		frame.pts = entries[i].pts;
+		da_push_back(pack->cache.frames, &frame);
+	}
+
+	pack->cache.memory_used = (size_t)mapping->size;
+
+	blog(LOG_INFO, "stinger: mapped pack of '%s' (%d frames, %s) "
+			"in %.2f ms", source, (int)header->frame_count,
+			stinger_cache_storage_name(pack->cache.storage),
+			(double)(os_gettime_ns() - start) / 1e6);
+	return pack;
+}
+
+void stinger_pack_close(struct stinger_pack *pack)
+{
+	if (!pack)
+		return;
+
+	/* the frame data belongs to the mapping */
+	da_free(pack->cache.frames);
+	unmap_file(pack->mapping);
+	bfree(pack);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "stinger-frame-cache.h"
+
+/* Pre-rendered frame packs. A pack holds every frame of a clip, already
+ * converted, so playback needs no demuxer, decoder or scaler: the file is
+ * memory mapped and frames are uploaded from the mapped pages.
+ *
+ * Layout (native byte order):
+ *   page 0     struct stinger_pack_header
+ *   page 1...  frame payloads, each starting on a page boundary
+ *   table      struct stinger_pack_entry for each frame, at table_offset
+ *
+ * Payloads are BGRA images or the cache's run-length coded BGRA. A pack
+ * records the size and modification time of the clip it was made from and
+ * is ignored once the clip changes. Packs live in the plugin config
+ * directory, named after a hash of the clip's path. */
+
+#define STINGER_PACK_MAGIC "STNGPACK"
+#define STINGER_PACK_VERSION 3
+#define STINGER_PACK_ALIGN 4096
+
+struct stinger_pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t storage;
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	uint32_t premultiplied;
+	uint32_t frame_count;
+	uint32_t max_width;
+	uint32_t max_height;
+	uint32_t reserved;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t table_offset;
+};
+
+struct stinger_pack_entry {
+	uint64_t offset;
+	uint64_t size;
+	int64_t pts;
+};
+
+struct stinger_pack_mapping;
+
+/* The frames of a mapped pack; frame data points into the mapping */
+struct stinger_pack {
+	struct stinger_frame_cache cache;
+	uint32_t max_width;
+	uint32_t max_height;
+	struct stinger_pack_mapping *mapping;
+};
+
+/* Where the pack for a clip is stored, free with bfree */
+extern char *stinger_pack_get_path(const char *source);
+
+/* Decodes the clip at source, fitted into max_width x max_height (0 for
+ * its own size), and writes its pack */
+extern bool stinger_pack_export(const char *source, bool compress,
+		uint32_t max_width, uint32_t max_height, volatile bool *abort);
+
+/* Maps the pack of the clip at source that was exported for the given
+ * maximum size, NULL if there is none, it's out of date or it was made for
+ * another size */
+extern struct stinger_pack *stinger_pack_open(const char *source,
+		uint32_t max_width, uint32_t max_height);
+extern void stinger_pack_close(struct stinger_pack *pack);
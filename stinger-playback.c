@@ -0,0 +1,853 @@
+#include <obs-module.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <util/darray.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <media-io/audio-resampler.h>
+#include <math.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "obs-ffmpeg-formats.h"
+#include "stinger-audio-ring.h"
+#include "stinger-convert.h"
+#include "stinger-decoder.h"
+#include "stinger-playback.h"
+#include "stinger-telemetry.h"
+#include "stinger-texture-ring.h"
+
+/* upper bound for the frames held by the preroll queue */
+#define STINGER_PREROLL_MAX_BYTES (256 * 1024 * 1024)
+
+struct stinger_playback {
+	struct stinger_decoder decoder;
+	struct SwsContext *sws;
+	char *path;
+	bool force_bgra;
+	bool decode_video;
+	struct stinger_decoder_options decoder_options;
+	DARRAY(struct stinger_index_entry) index;
+	struct stinger_telemetry *telemetry;
+
+	/* trimmed part of the file, and the times of its ends in seconds
+	 * from the file's first frame */
+	int64_t start_frame;
+	int64_t end_frame;
+	double start_time;
+	double end_time;
+
+	/* clip time in seconds and clip frames that pass per output frame
+	 * when played faster, and the next frame the renderer will ask for */
+	double speed;
+	double advance;
+	double step;
+	int64_t next_frame;
+
+	/* frames decoded ahead, capped once the frame size is known */
+	size_t preroll_frames;
+	size_t queue_frames;
+	bool preroll_checked;
+
+	struct stinger_audio_ring *audio;
+	audio_resampler_t *resampler;
+	struct resample_info resample_src;
+	struct resample_info resample_dst;
+	int64_t audio_written;
+	bool has_audio;
+	long clip;
+
+	pthread_t thread;
+	bool thread_active;
+	os_event_t *wake;
+
+	/* single-producer/single-consumer ring of decoded frames: the decoder
+	 * thread only advances write_pos and the render thread only advances
+	 * read_pos. Frames are tagged with their clip, so ones that were
+	 * pushed while a rewind was being requested are dropped on take. */
+	struct stinger_queued_frame *slots;
+	size_t capacity;
+	volatile long write_pos;
+	volatile long read_pos;
+	long take_clip;
+
+	/* handoff stats: waits are only written by the decoder thread, the
+	 * rest only by the render thread */
+	volatile long producer_waits;
+	volatile long producer_wait_us;
+	long logged_waits;
+	long logged_wait_us;
+	volatile long frames_decoded;
+	volatile long frames_queued;
+	long logged_decoded;
+	long logged_queued;
+
+	/* time from opening or rewinding to the clip's first frame */
+	uint64_t clip_start_ns;
+	bool first_frame_seen;
+	volatile long first_frame_us;
+	uint64_t takes;
+	uint64_t take_ns_total;
+	uint64_t take_ns_max;
+
+	/* rewind and next_clip are protected by the mutex; interrupt is set
+	 * by both rewind and stop requests to abort the current clip */
+	pthread_mutex_t mutex;
+	bool rewind;
+	long next_clip;
+	volatile bool interrupt;
+	volatile bool stop;
+	volatile bool eof;
+};
+
+void stinger_queued_frame_release(struct stinger_queued_frame *frame)
+{
+	if (frame->frame)
+		av_frame_free(&frame->frame);
+}
+
+static AVFrame *alloc_bgra_frame(const AVFrame *src)
+{
+	AVFrame *frame = av_frame_alloc();
+
+	if (!frame)
+		return NULL;
+
+	frame->format = AV_PIX_FMT_BGRA;
+	frame->width = src->width;
+	frame->height = src->height;
+
+	if (av_frame_get_buffer(frame, 32) < 0) {
+		av_frame_free(&frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+static AVFrame *scale_frame(struct stinger_playback *pb, const AVFrame *src)
+{
+	AVFrame *frame;
+
+	pb->sws = sws_getCachedContext(pb->sws,
+			src->width, src->height, src->format,
+			src->width, src->height, AV_PIX_FMT_BGRA,
+			SWS_BILINEAR, NULL, NULL, NULL);
+	if (!pb->sws) {
+		blog(LOG_ERROR, "stinger: unable to create sws context with "
+				"src{w:%d,h:%d,f:%d}", src->width,
+				src->height, src->format);
+		return NULL;
+	}
+
+	frame = alloc_bgra_frame(src);
+	if (frame)
+		sws_scale(pb->sws, (const uint8_t *const *)src->data,
+				src->linesize, 0, src->height,
+				frame->data, frame->linesize);
+	return frame;
+}
+
+/* Turns the decoded frame into something the texture ring can upload */
+static bool prepare_frame(struct stinger_playback *pb,
+		struct stinger_queued_frame *out)
+{
+	AVFrame *src = pb->decoder.frame;
+
+	out->index = pb->decoder.frame_index;
+	out->premultiplied = false;
+
+	switch (stinger_convert_choose(src->format, pb->force_bgra)) {
+	case STINGER_CONVERSION_YUVA:
+		out->frame = alloc_bgra_frame(src);
+		if (out->frame && !stinger_convert_frame(src,
+					out->frame->data[0],
+					out->frame->linesize[0]))
+			av_frame_free(&out->frame);
+		out->premultiplied = true;
+		break;
+
+	case STINGER_CONVERSION_PLANES:
+		out->frame = av_frame_clone(src);
+		break;
+
+	case STINGER_CONVERSION_SWSCALE:
+		out->frame = scale_frame(pb, src);
+		break;
+	}
+
+	return out->frame != NULL;
+}
+
+/* Time in seconds of a frame of the file, relative to its first frame */
+static double frame_time(struct stinger_playback *pb, int64_t frame)
+{
+	struct stinger_decoder *d = &pb->decoder;
+
+	if (frame <= 0)
+		return 0.0;
+	if ((size_t)frame < pb->index.num)
+		return (double)(pb->index.array[frame].pts -
+				pb->index.array[0].pts) *
+			av_q2d(d->stream->time_base);
+	if (d->frame_rate.num <= 0 || d->frame_rate.den <= 0)
+		return 0.0;
+	return (double)frame / av_q2d(d->frame_rate);
+}
+
+/* Clip time in seconds of a timestamp in the given time base, relative to
+ * the first video frame played */
+static double clip_time(struct stinger_playback *pb, int64_t ts,
+		AVRational time_base)
+{
+	struct stinger_decoder *d = &pb->decoder;
+	double start = d->start_pts == AV_NOPTS_VALUE ? 0.0 :
+		(double)d->start_pts * av_q2d(d->stream->time_base);
+
+	return (double)ts * av_q2d(time_base) - start - pb->start_time;
+}
+
+/* How many times faster than authored the audio plays */
+static inline double audio_speed(struct stinger_playback *pb)
+{
+	return pb->speed > 0.0 ? pb->speed : 1.0;
+}
+
+/* Audio played at another speed is resampled as if it had been recorded
+ * at a rate that much higher, which makes it that much shorter */
+static bool update_resampler(struct stinger_playback *pb,
+		const AVFrame *frame)
+{
+	struct resample_info src = {
+		.samples_per_sec = (uint32_t)((double)frame->sample_rate *
+				audio_speed(pb) + 0.5),
+		.format = convert_ffmpeg_sample_format(frame->format),
+		.speakers = convert_speaker_layout(
+				av_frame_get_channels(frame))
+	};
+
+	if (pb->resampler && memcmp(&src, &pb->resample_src,
+				sizeof(src)) == 0)
+		return true;
+
+	audio_resampler_destroy(pb->resampler);
+	pb->resampler = audio_resampler_create(&pb->resample_dst, &src);
+	pb->resample_src = src;
+
+	if (!pb->resampler)
+		blog(LOG_WARNING, "stinger: can't resample %d channel audio "
+				"at %d Hz", av_frame_get_channels(frame),
+				frame->sample_rate);
+	return pb->resampler != NULL;
+}
+
+/* Without video frames to hold it back the decoder would run far ahead of
+ * playback, so audio-only playback waits for the audio thread instead of
+ * dropping samples. Rewinding and stopping wake it through the ring. */
+static void wait_for_audio_space(struct stinger_playback *pb, size_t frames)
+{
+	struct stinger_audio_ring *ring = pb->audio;
+
+	if (frames > ring->capacity)
+		frames = ring->capacity;
+
+	while (!os_atomic_load_bool(&pb->interrupt) &&
+	       ring->capacity - stinger_audio_ring_readable(ring) < frames)
+		stinger_audio_ring_wait(ring, frames, &pb->interrupt);
+}
+
+/* Resamples a decoded audio frame into the audio ring. Gaps in the
+ * timestamps are filled with silence, so ring positions stay in step with
+ * the video timeline at the playback speed; audio from outside the frames
+ * played is cut. */
+static void audio_frame(void *param, AVFrame *frame)
+{
+	struct stinger_playback *pb = param;
+	uint32_t rate = pb->resample_dst.samples_per_sec;
+	uint8_t *output[MAX_AV_PLANES];
+	uint32_t frames;
+	uint64_t ts_offset;
+	int64_t ts = frame->best_effort_timestamp;
+	int64_t end;
+	size_t skip = 0;
+
+	/* the clip is being abandoned, don't let its audio reach the ring */
+	if (os_atomic_load_bool(&pb->interrupt))
+		return;
+
+	if (!update_resampler(pb, frame) ||
+	    !audio_resampler_resample(pb->resampler, output, &frames,
+			&ts_offset, (const uint8_t *const *)frame->data,
+			(uint32_t)frame->nb_samples))
+		return;
+
+	if (ts != AV_NOPTS_VALUE) {
+		double time = clip_time(pb, ts,
+				pb->decoder.audio_stream->time_base) /
+			audio_speed(pb) - (double)ts_offset / 1e9;
+		int64_t pos = (int64_t)(time * (double)rate);
+
+		/* tolerate small jitter without inserting silence */
+		if (pos > pb->audio_written + (int64_t)(rate / 100)) {
+			if (!pb->decode_video)
+				wait_for_audio_space(pb,
+						(size_t)(pos - pb->audio_written));
+			stinger_audio_ring_write_silence(pb->audio,
+					(size_t)(pos - pb->audio_written));
+			pb->audio_written = pos;
+		} else if (pos < 0) {
+			skip = (size_t)-pos;
+		}
+	}
+
+	if (pb->end_time > 0.0) {
+		end = (int64_t)(pb->end_time / audio_speed(pb) *
+				(double)rate);
+		if (pb->audio_written >= end)
+			return;
+		if (pb->audio_written + (int64_t)(frames - skip) > end)
+			frames = (uint32_t)(end - pb->audio_written) +
+				(uint32_t)skip;
+	}
+
+	if (skip >= frames)
+		return;
+
+	if (!pb->decode_video)
+		wait_for_audio_space(pb, frames - skip);
+
+	for (size_t i = 0; i < pb->audio->channels; i++)
+		output[i] += skip * sizeof(float);
+
+	stinger_audio_ring_write(pb->audio, (const float *const *)output,
+			frames - skip);
+	pb->audio_written += frames - skip;
+}
+
+/* Caps the preroll so that a clip with large frames can't pin an unbounded
+ * amount of memory while it waits for the next transition */
+static void limit_preroll(struct stinger_playback *pb, const AVFrame *frame)
+{
+	int size = av_image_get_buffer_size(frame->format, frame->width,
+			frame->height, 1);
+	size_t max_frames;
+
+	pb->preroll_checked = true;
+	if (size <= 0)
+		return;
+
+	max_frames = STINGER_PREROLL_MAX_BYTES / (size_t)size;
+	if (max_frames < 1)
+		max_frames = 1;
+
+	if (pb->preroll_frames > max_frames) {
+		blog(LOG_INFO, "stinger: preroll limited to %d frames of "
+				"%dx%d", (int)max_frames, frame->width,
+				frame->height);
+		pb->preroll_frames = max_frames;
+	}
+
+	pb->queue_frames = pb->preroll_frames > STINGER_LOOKAHEAD_FRAMES ?
+		pb->preroll_frames : STINGER_LOOKAHEAD_FRAMES;
+}
+
+static inline size_t queued_frames(struct stinger_playback *pb)
+{
+	return (size_t)((unsigned long)os_atomic_load_long(&pb->write_pos) -
+			(unsigned long)os_atomic_load_long(&pb->read_pos));
+}
+
+static bool wait_for_space(struct stinger_playback *pb)
+{
+	uint64_t wait_start = 0;
+
+	for (;;) {
+		if (os_atomic_load_bool(&pb->interrupt))
+			return false;
+
+		if (queued_frames(pb) < pb->queue_frames)
+			break;
+
+		if (!wait_start)
+			wait_start = os_gettime_ns();
+		os_event_wait(pb->wake);
+	}
+
+	if (wait_start) {
+		long us = (long)((os_gettime_ns() - wait_start) / 1000);
+
+		os_atomic_set_long(&pb->producer_waits,
+				pb->producer_waits + 1);
+		os_atomic_set_long(&pb->producer_wait_us,
+				pb->producer_wait_us + us);
+	}
+	return true;
+}
+
+static void push_frame(struct stinger_playback *pb,
+		struct stinger_queued_frame *frame)
+{
+	long pos = pb->write_pos;
+
+	if (os_atomic_load_bool(&pb->interrupt)) {
+		stinger_queued_frame_release(frame);
+		return;
+	}
+
+	frame->clip = pb->clip;
+	pb->slots[(unsigned long)pos & (pb->capacity - 1)] = *frame;
+	os_atomic_set_long(&pb->write_pos, (long)((unsigned long)pos + 1));
+}
+
+/* How much clip time and how many clip frames go by per frame of output
+ * at the playback speed */
+static void set_frame_step(struct stinger_playback *pb)
+{
+	AVRational rate = pb->decoder.frame_rate;
+	struct obs_video_info ovi;
+
+	pb->step = 1.0;
+	pb->advance = 0.0;
+	if (pb->speed <= 1.0 || !obs_get_video_info(&ovi) || !ovi.fps_num ||
+	    !ovi.fps_den)
+		return;
+
+	pb->advance = pb->speed * (double)ovi.fps_den / (double)ovi.fps_num;
+	if (rate.num > 0 && rate.den > 0 && pb->advance * av_q2d(rate) > 1.0)
+		pb->step = pb->advance * av_q2d(rate);
+}
+
+/* Last frame of the file that starts at or before time, in seconds from
+ * its first frame; rounds down, so a frame that might be asked for isn't
+ * passed over */
+static int64_t frame_at_time(struct stinger_playback *pb, double time)
+{
+	struct stinger_decoder *d = &pb->decoder;
+	int64_t pts;
+	size_t low, high, mid;
+
+	if (pb->index.num) {
+		pts = pb->index.array[0].pts +
+			(int64_t)floor(time / av_q2d(d->stream->time_base));
+		low = 0;
+		high = pb->index.num;
+		while (high - low > 1) {
+			mid = low + (high - low) / 2;
+			if (pb->index.array[mid].pts <= pts)
+				low = mid;
+			else
+				high = mid;
+		}
+		return (int64_t)low;
+	}
+
+	if (d->frame_rate.num <= 0 || d->frame_rate.den <= 0)
+		return 0;
+	return (int64_t)floor(time * av_q2d(d->frame_rate));
+}
+
+/* First frame after frame the renderer can ask for. The renderer maps
+ * transition time onto the clip's frame times, so its next target is at
+ * least an output frame's worth of clip time after the one that got it
+ * this frame; everything before the frame at that time goes unshown. */
+static int64_t next_wanted_frame(struct stinger_playback *pb, int64_t frame)
+{
+	int64_t next;
+
+	if (pb->advance <= 0.0)
+		return frame + 1;
+
+	next = frame_at_time(pb, frame_time(pb, frame) + pb->advance);
+	return next > frame ? next : frame + 1;
+}
+
+static bool open_decoder(struct stinger_playback *pb)
+{
+	if (!stinger_decoder_open(&pb->decoder, pb->path,
+				&pb->decoder_options))
+		return false;
+
+	pb->has_audio = pb->audio && stinger_decoder_open_audio(
+			&pb->decoder, audio_frame, pb);
+	if (!pb->has_audio && !pb->decode_video) {
+		stinger_decoder_close(&pb->decoder);
+		return false;
+	}
+
+	/* when most frames go unshown, the ones nothing refers to aren't
+	 * worth decoding at all */
+	set_frame_step(pb);
+	if (!pb->decode_video)
+		pb->decoder.codec->skip_frame = AVDISCARD_ALL;
+	else if (pb->step >= 2.0)
+		pb->decoder.codec->skip_frame = AVDISCARD_NONREF;
+
+	pb->start_time = frame_time(pb, pb->start_frame);
+	pb->end_time = pb->end_frame > pb->start_frame ?
+		frame_time(pb, pb->end_frame) - pb->start_time : 0.0;
+
+	/* if the seek fails, the frames before the first one are decoded
+	 * and skipped instead */
+	if (pb->start_frame > 0)
+		stinger_decoder_seek(&pb->decoder, pb->start_frame);
+
+	pb->decoder.interrupt = &pb->interrupt;
+	return true;
+}
+
+static void begin_clip(struct stinger_playback *pb, long clip)
+{
+	pb->clip = clip;
+	pb->audio_written = 0;
+	pb->first_frame_seen = false;
+	pb->next_frame = pb->start_frame;
+
+	if (pb->audio) {
+		stinger_audio_ring_begin_clip(pb->audio, clip);
+		if (!pb->has_audio)
+			stinger_audio_ring_end_clip(pb->audio, clip);
+	}
+}
+
+static void end_clip(struct stinger_playback *pb)
+{
+	if (pb->has_audio)
+		stinger_audio_ring_end_clip(pb->audio, pb->clip);
+	os_atomic_set_bool(&pb->eof, true);
+}
+
+static void decode_clip(struct stinger_playback *pb)
+{
+	struct stinger_queued_frame frame;
+	struct stinger_telemetry *telemetry =
+		pb->decode_video ? pb->telemetry : NULL;
+	uint64_t start = 0;
+
+	while (wait_for_space(pb)) {
+		if (telemetry)
+			start = os_gettime_ns();
+		if (!stinger_decoder_next(&pb->decoder))
+			break;
+		if (pb->end_frame > pb->start_frame &&
+		    pb->decoder.frame_index >= pb->end_frame)
+			break;
+
+		if (!pb->decode_video)
+			continue;
+		os_atomic_set_long(&pb->frames_decoded,
+				pb->frames_decoded + 1);
+
+		/* seeks land on the keyframe before the first frame, and
+		 * frames played faster than the output leave some unshown */
+		if (pb->decoder.frame_index < pb->next_frame)
+			continue;
+
+		if (telemetry) {
+			stinger_telemetry_add_time(telemetry,
+					STINGER_METRIC_DECODE, start);
+			start = os_gettime_ns();
+		}
+
+		if (!pb->preroll_checked)
+			limit_preroll(pb, pb->decoder.frame);
+		if (!prepare_frame(pb, &frame))
+			continue;
+
+		if (telemetry)
+			stinger_telemetry_add_time(telemetry,
+					STINGER_METRIC_CONVERT, start);
+
+		if (!pb->first_frame_seen) {
+			pb->first_frame_seen = true;
+			os_atomic_set_long(&pb->first_frame_us, (long)(
+				(os_gettime_ns() - pb->clip_start_ns) / 1000));
+		}
+		push_frame(pb, &frame);
+		os_atomic_set_long(&pb->frames_queued, pb->frames_queued + 1);
+
+		/* may seek, so only once the frame is queued */
+		pb->next_frame = next_wanted_frame(pb,
+				pb->decoder.frame_index);
+		if (pb->advance > 0.0)
+			stinger_decoder_skip_to(&pb->decoder, pb->next_frame);
+	}
+}
+
+/* Blocks until the next clip is requested; false when stopping instead */
+static bool wait_for_rewind(struct stinger_playback *pb)
+{
+	for (;;) {
+		bool rewind;
+
+		if (os_atomic_load_bool(&pb->stop))
+			return false;
+
+		pthread_mutex_lock(&pb->mutex);
+		rewind = pb->rewind;
+		if (rewind) {
+			pb->rewind = false;
+			pb->clip = pb->next_clip;
+			os_atomic_set_bool(&pb->interrupt, false);
+			os_atomic_set_bool(&pb->eof, false);
+		}
+		pthread_mutex_unlock(&pb->mutex);
+
+		if (rewind)
+			return true;
+
+		os_event_wait(pb->wake);
+	}
+}
+
+static void *playback_thread(void *data)
+{
+	struct stinger_playback *pb = data;
+	bool opened;
+
+	os_set_thread_name("stinger: decoder");
+
+	pb->clip_start_ns = os_gettime_ns();
+	opened = open_decoder(pb);
+	begin_clip(pb, pb->clip);
+
+	while (opened) {
+		decode_clip(pb);
+		end_clip(pb);
+
+		/* the demuxer and decoders stay open, so the next clip only
+		 * costs a seek and the frames up to the first one shown */
+		if (!wait_for_rewind(pb))
+			break;
+
+		pb->clip_start_ns = os_gettime_ns();
+		if (!stinger_decoder_seek(&pb->decoder, pb->start_frame)) {
+			stinger_decoder_close(&pb->decoder);
+			opened = open_decoder(pb);
+		}
+		begin_clip(pb, pb->clip);
+	}
+
+	if (!opened)
+		end_clip(pb);
+
+	stinger_decoder_close(&pb->decoder);
+	return NULL;
+}
+
+struct stinger_playback *stinger_playback_create(
+		const struct stinger_playback_options *options)
+{
+	struct stinger_playback *pb = bzalloc(sizeof(*pb));
+	struct stinger_audio_ring *audio = options->audio;
+	struct obs_audio_info oai;
+
+	pb->path = bstrdup(options->path);
+	pb->force_bgra = options->force_bgra;
+	pb->decoder_options.hw_decoding = options->hw_decoding;
+	pb->decoder_options.max_width = options->max_width;
+	pb->decoder_options.max_height = options->max_height;
+	pb->decoder_options.threads = options->threads;
+	pb->decoder_options.threading = options->threading;
+	pb->decoder_options.read_ahead = true;
+	pb->start_frame = options->start_frame > 0 ? options->start_frame : 0;
+	pb->end_frame = options->end_frame > 0 ? options->end_frame : 0;
+	pb->speed = options->speed;
+	pb->step = 1.0;
+	pb->advance = 0.0;
+	pb->decode_video = options->decode_video;
+	pb->telemetry = options->telemetry;
+	pb->clip = options->clip;
+	pb->preroll_frames = options->preroll_frames;
+	pb->queue_frames = STINGER_LOOKAHEAD_FRAMES;
+	pb->take_clip = options->clip;
+
+	pb->capacity = 1;
+	while (pb->capacity < STINGER_LOOKAHEAD_FRAMES ||
+	       pb->capacity < pb->preroll_frames)
+		pb->capacity <<= 1;
+	pb->slots = bzalloc(pb->capacity * sizeof(*pb->slots));
+
+	if (options->index && options->index_size) {
+		da_copy_array(pb->index, options->index,
+				options->index_size);
+		pb->decoder_options.index = pb->index.array;
+		pb->decoder_options.index_size = pb->index.num;
+	}
+
+	if (audio && obs_get_audio_info(&oai)) {
+		pb->audio = audio;
+		pb->resample_dst.samples_per_sec = oai.samples_per_sec;
+		pb->resample_dst.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		pb->resample_dst.speakers = oai.speakers;
+	} else if (audio) {
+		stinger_audio_ring_begin_clip(audio, options->clip);
+		stinger_audio_ring_end_clip(audio, options->clip);
+	}
+
+	pthread_mutex_init(&pb->mutex, NULL);
+
+	if (os_event_init(&pb->wake, OS_EVENT_TYPE_AUTO) != 0) {
+		blog(LOG_ERROR, "stinger: failed to create decoder event");
+		stinger_playback_destroy(pb);
+		return NULL;
+	}
+
+	return pb;
+}
+
+void stinger_playback_start(struct stinger_playback *pb)
+{
+	if (pthread_create(&pb->thread, NULL, playback_thread, pb) != 0) {
+		blog(LOG_ERROR, "stinger: failed to start decoder thread");
+		begin_clip(pb, pb->clip);
+		end_clip(pb);
+		return;
+	}
+
+	pb->thread_active = true;
+}
+
+/* Consumer side, or once the decoder thread is gone */
+static void clear_queue(struct stinger_playback *pb)
+{
+	long pos = pb->read_pos;
+	long end = os_atomic_load_long(&pb->write_pos);
+
+	while (pos != end) {
+		stinger_queued_frame_release(
+				&pb->slots[(unsigned long)pos & (pb->capacity - 1)]);
+		pos = (long)((unsigned long)pos + 1);
+	}
+
+	os_atomic_set_long(&pb->read_pos, pos);
+}
+
+void stinger_playback_destroy(struct stinger_playback *pb)
+{
+	if (!pb)
+		return;
+
+	if (pb->thread_active) {
+		os_atomic_set_bool(&pb->stop, true);
+		os_atomic_set_bool(&pb->interrupt, true);
+		os_event_signal(pb->wake);
+		if (pb->audio)
+			stinger_audio_ring_wake(pb->audio);
+		pthread_join(pb->thread, NULL);
+	}
+
+	clear_queue(pb);
+
+	if (pb->sws)
+		sws_freeContext(pb->sws);
+	audio_resampler_destroy(pb->resampler);
+	bfree(pb->slots);
+	da_free(pb->index);
+	os_event_destroy(pb->wake);
+	pthread_mutex_destroy(&pb->mutex);
+	bfree(pb->path);
+	bfree(pb);
+}
+
+void stinger_playback_rewind(struct stinger_playback *pb, long clip)
+{
+	pthread_mutex_lock(&pb->mutex);
+	pb->rewind = true;
+	pb->next_clip = clip;
+	os_atomic_set_bool(&pb->interrupt, true);
+	pthread_mutex_unlock(&pb->mutex);
+
+	pb->take_clip = clip;
+	clear_queue(pb);
+	os_event_signal(pb->wake);
+	if (pb->audio)
+		stinger_audio_ring_wake(pb->audio);
+}
+
+bool stinger_playback_take(struct stinger_playback *pb, int64_t target,
+		struct stinger_queued_frame *frame, uint64_t *dropped)
+{
+	uint64_t start = os_gettime_ns();
+	uint64_t elapsed;
+	long pos = pb->read_pos;
+	long end = os_atomic_load_long(&pb->write_pos);
+	bool found = false;
+
+	while (pos != end) {
+		struct stinger_queued_frame *next =
+			&pb->slots[(unsigned long)pos & (pb->capacity - 1)];
+
+		if (next->clip == pb->take_clip) {
+			if (next->index > target)
+				break;
+
+			if (found) {
+				stinger_queued_frame_release(frame);
+				(*dropped)++;
+			}
+
+			*frame = *next;
+			found = true;
+		} else {
+			stinger_queued_frame_release(next);
+		}
+
+		next->frame = NULL;
+		pos = (long)((unsigned long)pos + 1);
+	}
+
+	if (pos != pb->read_pos) {
+		os_atomic_set_long(&pb->read_pos, pos);
+		os_event_signal(pb->wake);
+	}
+
+	elapsed = os_gettime_ns() - start;
+	pb->takes++;
+	pb->take_ns_total += elapsed;
+	if (elapsed > pb->take_ns_max)
+		pb->take_ns_max = elapsed;
+
+	return found;
+}
+
+bool stinger_playback_finished(struct stinger_playback *pb)
+{
+	return os_atomic_load_bool(&pb->eof) && !queued_frames(pb);
+}
+
+void stinger_playback_log_stats(struct stinger_playback *pb, const char *name)
+{
+	long waits = os_atomic_load_long(&pb->producer_waits);
+	long wait_us = os_atomic_load_long(&pb->producer_wait_us);
+	long decoded = os_atomic_load_long(&pb->frames_decoded);
+	long queued = os_atomic_load_long(&pb->frames_queued);
+
+	if (pb->takes)
+		blog(LOG_INFO, "stinger '%s': first frame decoded %.2f ms "
+				"after open or rewind, frame handoff avg "
+				"%.3f ms, max %.3f ms over %llu takes, decoder "
+				"waited for space %ld times (%.1f ms)", name,
+				(double)os_atomic_load_long(
+					&pb->first_frame_us) / 1000.0,
+				(double)pb->take_ns_total /
+					(double)pb->takes / 1e6,
+				(double)pb->take_ns_max / 1e6,
+				(unsigned long long)pb->takes,
+				waits - pb->logged_waits,
+				(double)(wait_us - pb->logged_wait_us) /
+					1000.0);
+
+	if (decoded - pb->logged_decoded > queued - pb->logged_queued)
+		blog(LOG_INFO, "stinger '%s': decoded %ld frames, %ld of "
+				"them not shown", name,
+				decoded - pb->logged_decoded,
+				(decoded - pb->logged_decoded) -
+				(queued - pb->logged_queued));
+
+	pb->logged_waits = waits;
+	pb->logged_wait_us = wait_us;
+	pb->logged_decoded = decoded;
+	pb->logged_queued = queued;
+	pb->takes = 0;
+	pb->take_ns_total = 0;
+	pb->take_ns_max = 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <libavutil/frame.h>
+
+#include "stinger-decoder.h"
+
+struct stinger_audio_ring;
+struct stinger_telemetry;
+
+/* Streaming playback of a stinger file. A decoder thread keeps a small
+ * lock-free lookahead queue of frames that are ready to upload (YUV planes
+ * the effect converts, or BGRA); the render thread takes frames out of it
+ * by frame index, so playback follows the transition clock instead of the
+ * decoder. Audio is resampled to the output format and written to an audio
+ * ring, starting at the clip's first video frame.
+ *
+ * Once a clip has been played the decoder stays open, so it can be rewound
+ * and primed with the first frames of the next clip before that clip is
+ * needed. */
+
+#define STINGER_LOOKAHEAD_FRAMES 4
+
+struct stinger_queued_frame {
+	AVFrame *frame;
+	int64_t index;
+	long clip;
+	bool premultiplied;
+};
+
+struct stinger_playback;
+
+struct stinger_playback_options {
+	const char *path;
+	bool hw_decoding;
+	bool force_bgra;
+
+	/* frames are decoded or scaled down to fit, 0 for the clip's size */
+	uint32_t max_width;
+	uint32_t max_height;
+
+	/* decoder threads (0 for one per core) and how they split the work */
+	int threads;
+	enum stinger_decoder_threading threading;
+
+	/* part of the file that is played: the first frame and the frame it
+	 * stops before, 0 for the end of the file. Frames keep their index in
+	 * the file, and the clip's audio starts at the first frame. */
+	int64_t start_frame;
+	int64_t end_frame;
+
+	/* the probe's frame index, copied; NULL to go by the frame rate */
+	const struct stinger_index_entry *index;
+	size_t index_size;
+
+	/* how many times faster than authored the clip is played, 0 for its
+	 * own speed. Frames the output has no time to show are skipped at
+	 * the decoder where possible. Audio is resampled to the same speed,
+	 * so it changes pitch the way a tape played faster would. */
+	double speed;
+
+	/* false to only play the audio, e.g. when frames come from a cache */
+	bool decode_video;
+
+	/* frames to decode ahead while waiting for the clip to start, in
+	 * addition to the lookahead; limited by the size of the frames */
+	size_t preroll_frames;
+
+	/* NULL to skip the clip's audio */
+	struct stinger_audio_ring *audio;
+
+	/* number of the first clip in the audio ring */
+	long clip;
+
+	/* receives decode and convert times, NULL when disabled */
+	struct stinger_telemetry *telemetry;
+};
+
+/* Creating a playback doesn't touch the file; stinger_playback_start()
+ * opens it and starts decoding, and may be called from another thread. The
+ * other functions are safe to use before it has been called. */
+extern struct stinger_playback *stinger_playback_create(
+		const struct stinger_playback_options *options);
+extern void stinger_playback_start(struct stinger_playback *pb);
+extern void stinger_playback_destroy(struct stinger_playback *pb);
+
+/* Abandons the current clip, drops the queued frames and starts decoding
+ * the clip from its first frame again as the given clip number */
+extern void stinger_playback_rewind(struct stinger_playback *pb, long clip);
+
+/* Removes every queued frame up to index target and hands out the newest of
+ * them; the ones skipped over are added to dropped. Returns false if no
+ * frame at or before target has been decoded yet. */
+extern bool stinger_playback_take(struct stinger_playback *pb,
+		int64_t target, struct stinger_queued_frame *frame,
+		uint64_t *dropped);
+
+/* True once the whole clip has been decoded and taken */
+extern bool stinger_playback_finished(struct stinger_playback *pb);
+
+/* Logs how long the render thread spent taking frames, how often the
+ * decoder had to wait for room in the queue and how many of the frames it
+ * decoded were left out, then resets the counters */
+extern void stinger_playback_log_stats(struct stinger_playback *pb,
+		const char *name);
+
+extern void stinger_queued_frame_release(struct stinger_queued_frame *frame);
@@ -0,0 +1,117 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "stinger-meta-cache.h"
+#include "stinger-probe-job.h"
+
+struct stinger_probe_job {
+	char *path;
+	enum stinger_coverage_source coverage;
+	struct stinger_probe_info info;
+	struct stinger_probe_abort abort;
+
+	stinger_probe_job_done_t done;
+	void *param;
+
+	pthread_t thread;
+	bool thread_created;
+	volatile long state;
+};
+
+static void *probe_thread(void *data)
+{
+	struct stinger_probe_job *job = data;
+	uint64_t start = os_gettime_ns();
+	enum stinger_probe_job_state state;
+	bool success;
+
+	os_set_thread_name("stinger: probe");
+
+	success = stinger_meta_cache_probe(job->path, job->coverage,
+			&job->abort, &job->info);
+
+	if (success)
+		state = STINGER_PROBE_JOB_SUCCEEDED;
+	else if (!os_atomic_load_bool(&job->abort.cancel) &&
+	         stinger_probe_aborted(&job->abort))
+		state = STINGER_PROBE_JOB_TIMED_OUT;
+	else
+		state = STINGER_PROBE_JOB_FAILED;
+
+	blog(LOG_INFO, "stinger: background probe of '%s' took %.1f ms",
+			job->path, (double)(os_gettime_ns() - start) / 1e6);
+
+	os_atomic_set_long(&job->state, state);
+
+	if (!os_atomic_load_bool(&job->abort.cancel) && job->done)
+		job->done(job->param);
+	return NULL;
+}
+
+struct stinger_probe_job *stinger_probe_job_start(const char *path,
+		enum stinger_coverage_source coverage,
+		stinger_probe_job_done_t done, void *param)
+{
+	struct stinger_probe_job *job = bzalloc(sizeof(*job));
+
+	job->path = bstrdup(path);
+	job->coverage = coverage;
+	job->done = done;
+	job->param = param;
+	stinger_probe_abort_init(&job->abort);
+
+	job->thread_created = pthread_create(&job->thread, NULL,
+			probe_thread, job) == 0;
+	if (!job->thread_created) {
+		blog(LOG_WARNING, "stinger: couldn't start probing '%s'",
+				path);
+		job->state = STINGER_PROBE_JOB_FAILED;
+	}
+
+	return job;
+}
+
+void stinger_probe_job_destroy(struct stinger_probe_job *job)
+{
+	if (!job)
+		return;
+
+	os_atomic_set_bool(&job->abort.cancel, true);
+	if (job->thread_created)
+		pthread_join(job->thread, NULL);
+
+	stinger_probe_info_free(&job->info);
+	bfree(job->path);
+	bfree(job);
+}
+
+const char *stinger_probe_job_get_path(struct stinger_probe_job *job)
+{
+	return job->path;
+}
+
+bool stinger_probe_job_started(struct stinger_probe_job *job)
+{
+	return job->thread_created;
+}
+
+bool stinger_probe_job_matches(struct stinger_probe_job *job,
+		const char *path, enum stinger_coverage_source coverage)
+{
+	return job && job->coverage == coverage &&
+		strcmp(job->path, path) == 0;
+}
+
+enum stinger_probe_job_state stinger_probe_job_get_state(
+		struct stinger_probe_job *job)
+{
+	return (enum stinger_probe_job_state)os_atomic_load_long(
+			&job->state);
+}
+
+const struct stinger_probe_info *stinger_probe_job_get_info(
+		struct stinger_probe_job *job)
+{
+	return &job->info;
+}
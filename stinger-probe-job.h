@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stinger-probe.h"
+
+/* A probe running on a thread of its own, so the properties dialog stays
+ * responsive while a file is scanned or decoded. Results go through the
+ * meta cache and are kept on the job as well. Destroying a job that's
+ * still running cancels it; reads in progress give up right away, so
+ * that only waits as long as it takes them to notice. */
+
+enum stinger_probe_job_state {
+	STINGER_PROBE_JOB_RUNNING,
+	STINGER_PROBE_JOB_SUCCEEDED,
+	STINGER_PROBE_JOB_FAILED,
+	STINGER_PROBE_JOB_TIMED_OUT
+};
+
+struct stinger_probe_job;
+
+/* Called on the job's thread once it's done, unless it was cancelled */
+typedef void (*stinger_probe_job_done_t)(void *param);
+
+/* Gives up after STINGER_PROBE_TIMEOUT_MS */
+extern struct stinger_probe_job *stinger_probe_job_start(const char *path,
+		enum stinger_coverage_source coverage,
+		stinger_probe_job_done_t done, void *param);
+extern void stinger_probe_job_destroy(struct stinger_probe_job *job);
+
+extern const char *stinger_probe_job_get_path(struct stinger_probe_job *job);
+
+/* False if the job's thread couldn't be started, done won't be called */
+extern bool stinger_probe_job_started(struct stinger_probe_job *job);
+extern bool stinger_probe_job_matches(struct stinger_probe_job *job,
+		const char *path, enum stinger_coverage_source coverage);
+extern enum stinger_probe_job_state stinger_probe_job_get_state(
+		struct stinger_probe_job *job);
+
+/* The probe results, only valid once the job has succeeded */
+extern const struct stinger_probe_info *stinger_probe_job_get_info(
+		struct stinger_probe_job *job);
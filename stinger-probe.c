@@ -0,0 +1,398 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <libavformat/avformat.h>
+#include <libavutil/pixdesc.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "stinger-decoder.h"
+#include "stinger-probe.h"
+
+void stinger_probe_abort_init(struct stinger_probe_abort *abort)
+{
+	abort->cancel = false;
+	abort->deadline_ns = os_gettime_ns() +
+		(uint64_t)STINGER_PROBE_TIMEOUT_MS * 1000000ULL;
+}
+
+bool stinger_probe_aborted(struct stinger_probe_abort *abort)
+{
+	return abort && (os_atomic_load_bool(&abort->cancel) ||
+		(abort->deadline_ns && os_gettime_ns() > abort->deadline_ns));
+}
+
+static int abort_callback(void *opaque)
+{
+	return stinger_probe_aborted(opaque) ? 1 : 0;
+}
+
+static bool open_video_stream(const char *path, AVFormatContext **format,
+		int *stream, AVCodec **codec, struct stinger_probe_abort *abort)
+{
+	if (!path || !*path)
+		return false;
+
+	/* reads give up with the probe, a file on a share that stopped
+	 * answering would block them indefinitely */
+	if (abort) {
+		*format = avformat_alloc_context();
+		(*format)->interrupt_callback.callback = abort_callback;
+		(*format)->interrupt_callback.opaque = abort;
+	}
+
+	if (avformat_open_input(format, path, NULL, NULL) != 0) {
+		blog(LOG_WARNING, "Couldn't open stinger video file");
+		return false;
+	}
+
+	if (avformat_find_stream_info(*format, NULL) < 0) {
+		blog(LOG_WARNING, "Couldn't find stinger video stream "
+				"information");
+		return false;
+	}
+
+	*stream = av_find_best_stream(*format, AVMEDIA_TYPE_VIDEO, -1, -1,
+			codec, 0);
+	if (*stream < 0 || !*codec) {
+		blog(LOG_WARNING, "Unsupported codec of stinger video");
+		return false;
+	}
+
+	return true;
+}
+
+static AVRational stream_framerate(AVFormatContext *format, AVStream *stream)
+{
+	if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+		return stream->avg_frame_rate;
+	if (stream->r_frame_rate.num > 0 && stream->r_frame_rate.den > 0)
+		return stream->r_frame_rate;
+	return av_guess_frame_rate(format, stream, NULL);
+}
+
+/* Frame count implied by the container duration, 0 if it has none */
+static int64_t expected_frame_count(AVFormatContext *format,
+		AVStream *stream, AVRational framerate)
+{
+	double seconds = 0.0;
+
+	if (framerate.num <= 0 || framerate.den <= 0)
+		return 0;
+
+	if (stream->duration > 0 && stream->duration != AV_NOPTS_VALUE)
+		seconds = (double)stream->duration * av_q2d(stream->time_base);
+	else if (format->duration > 0 && format->duration != AV_NOPTS_VALUE)
+		seconds = (double)format->duration / AV_TIME_BASE;
+
+	return (int64_t)(seconds * av_q2d(framerate) + 0.5);
+}
+
+static bool count_matches_duration(int64_t count, int64_t expected,
+		double tolerance)
+{
+	int64_t diff = count > expected ? count - expected : expected - count;
+	int64_t allowed = (int64_t)((double)expected * tolerance);
+
+	if (!expected)
+		return true;
+	return diff <= (allowed > 2 ? allowed : 2);
+}
+
+/* Reads every packet of the stream without decoding, noting keyframes
+ * and building the frame index in decode order; returns the number of
+ * packets */
+static int64_t scan_packets(AVFormatContext *format, int stream,
+		struct stinger_probe_info *info)
+{
+	struct stinger_index_entry *entry;
+	bool timestamps = true;
+	int64_t packets = 0;
+	int64_t pts;
+	AVPacket packet;
+
+	info->keyframes.num = 0;
+	info->index.num = 0;
+	info->end_pts = AV_NOPTS_VALUE;
+
+	while (av_read_frame(format, &packet) >= 0) {
+		if (packet.stream_index == stream) {
+			if ((packet.flags & AV_PKT_FLAG_KEY) != 0)
+				da_push_back(info->keyframes, &packets);
+			packets++;
+
+			pts = packet.pts != AV_NOPTS_VALUE ?
+				packet.pts : packet.dts;
+			timestamps = timestamps && pts != AV_NOPTS_VALUE;
+
+			if (timestamps) {
+				entry = da_push_back_new(info->index);
+				entry->pts = pts;
+				entry->pos = packet.pos;
+				entry->keyframe =
+					(packet.flags & AV_PKT_FLAG_KEY) != 0;
+
+				if (packet.duration > 0 &&
+				    (info->end_pts == AV_NOPTS_VALUE ||
+				     pts + packet.duration > info->end_pts))
+					info->end_pts = pts + packet.duration;
+			}
+		}
+		av_packet_unref(&packet);
+	}
+
+	if (!timestamps)
+		da_free(info->index);
+	return packets;
+}
+
+static int compare_pts(const void *a, const void *b)
+{
+	const struct stinger_index_entry *entry_a = a;
+	const struct stinger_index_entry *entry_b = b;
+
+	return entry_a->pts < entry_b->pts ? -1 :
+		entry_a->pts > entry_b->pts ? 1 : 0;
+}
+
+/* Puts the index in presentation order, or drops it if it doesn't match
+ * the frames: packed or field coded streams, repeated timestamps */
+static void finish_index(struct stinger_probe_info *info)
+{
+	struct stinger_index_entry *last;
+
+	if (info->index.num != (size_t)info->frame_count) {
+		da_free(info->index);
+		return;
+	}
+
+	qsort(info->index.array, info->index.num, sizeof(*info->index.array),
+			compare_pts);
+
+	for (size_t i = 1; i < info->index.num; i++) {
+		if (info->index.array[i].pts <= info->index.array[i - 1].pts) {
+			da_free(info->index);
+			return;
+		}
+	}
+
+	/* without packet durations the last frame lasts as long as the one
+	 * before it */
+	last = da_end(info->index);
+	if (info->end_pts == AV_NOPTS_VALUE || info->end_pts <= last->pts)
+		info->end_pts = info->index.num > 1 ?
+			2 * last->pts - info->index.array[
+				info->index.num - 2].pts :
+			last->pts + 1;
+}
+
+static bool stream_has_alpha(AVStream *stream, enum AVPixelFormat format)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+	AVDictionaryEntry *alpha_mode;
+
+	if (desc && (desc->flags & AV_PIX_FMT_FLAG_ALPHA) != 0)
+		return true;
+
+	/* VP8/VP9 in WebM carry alpha in a side channel the stream pixel
+	 * format doesn't show */
+	alpha_mode = av_dict_get(stream->metadata, "alpha_mode", NULL, 0);
+	return alpha_mode && strcmp(alpha_mode->value, "1") == 0;
+}
+
+/* Decodes every frame, measuring the coverage of each when asked to;
+ * returns the number of frames */
+static int64_t decode_frames(const char *path,
+		enum stinger_coverage_source source,
+		struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info)
+{
+	struct stinger_decoder_options options = {
+		.threading = STINGER_THREADING_FRAME,
+		.read_ahead = true,
+		.abort = abort ? &abort->cancel : NULL,
+		.deadline_ns = abort ? abort->deadline_ns : 0
+	};
+	struct stinger_decoder d;
+	int64_t frames = 0;
+	uint16_t coverage;
+
+	if (!stinger_decoder_open(&d, path, &options))
+		return 0;
+
+	while (stinger_decoder_next(&d)) {
+		if (source != STINGER_COVERAGE_NONE &&
+		    stinger_coverage_measure(d.frame, source, &coverage))
+			da_push_back(info->coverage, &coverage);
+		frames++;
+	}
+
+	stinger_decoder_close(&d);
+	return frames;
+}
+
+static uint16_t max_coverage(struct stinger_probe_info *info)
+{
+	uint16_t max = 0;
+
+	for (size_t i = 0; i < info->coverage.num; i++) {
+		if (info->coverage.array[i] > max)
+			max = info->coverage.array[i];
+	}
+
+	return max;
+}
+
+/* Logs how long a probe that was given up on ran, false for the caller
+ * to return */
+static bool probe_aborted(const char *path, struct stinger_probe_abort *abort,
+		uint64_t start)
+{
+	blog(LOG_WARNING, "stinger: gave up probing '%s' after %.1f ms (%s)",
+			path, (double)(os_gettime_ns() - start) / 1e6,
+			os_atomic_load_bool(&abort->cancel) ?
+				"cancelled" : "timed out");
+	return false;
+}
+
+bool stinger_probe_file(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info)
+{
+	uint64_t start = os_gettime_ns();
+	AVFormatContext *format = NULL;
+	AVCodec *codec = NULL;
+	AVStream *stream;
+	int64_t expected;
+	int64_t decoded;
+	bool analyze;
+	int index;
+
+	memset(info, 0, sizeof(*info));
+	info->pixel_format = AV_PIX_FMT_NONE;
+	info->coverage_source = coverage;
+
+	if (!open_video_stream(path, &format, &index, &codec, abort)) {
+		if (format)
+			avformat_close_input(&format);
+		return stinger_probe_aborted(abort) ?
+			probe_aborted(path, abort, start) : false;
+	}
+
+	stream = format->streams[index];
+	info->time_base = stream->time_base;
+	info->framerate = stream_framerate(format, stream);
+	info->width = stream->codecpar->width;
+	info->height = stream->codecpar->height;
+	info->pixel_format = (enum AVPixelFormat)stream->codecpar->format;
+	info->has_alpha = stream_has_alpha(stream, info->pixel_format);
+
+	expected = expected_frame_count(format, stream, info->framerate);
+
+	/* the scan is needed for the frame index either way, so the
+	 * container's count only settles it when the two disagree and the
+	 * container's matches the duration */
+	info->frame_count = scan_packets(format, index, info);
+	info->method = STINGER_PROBE_PACKET_SCAN;
+
+	if (stream->nb_frames > 0 && stream->nb_frames != info->frame_count &&
+	    count_matches_duration(stream->nb_frames, expected, 0.02)) {
+		info->frame_count = stream->nb_frames;
+		info->method = STINGER_PROBE_METADATA;
+	}
+
+	avformat_close_input(&format);
+
+	/* an interrupted scan ends early, its count would be stored */
+	if (stinger_probe_aborted(abort))
+		return probe_aborted(path, abort, start);
+
+	/* a clip without alpha has nothing to measure it by */
+	analyze = coverage != STINGER_COVERAGE_NONE &&
+		(coverage != STINGER_COVERAGE_ALPHA || info->has_alpha);
+
+	/* packed or field coded streams don't map packets to frames 1:1 */
+	if (!info->frame_count ||
+	    !count_matches_duration(info->frame_count, expected, 0.05)) {
+		info->frame_count = decode_frames(path, analyze ?
+				coverage : STINGER_COVERAGE_NONE, abort, info);
+		info->method = STINGER_PROBE_DECODE;
+	} else if (analyze) {
+		decoded = decode_frames(path, coverage, abort, info);
+		if (decoded != info->frame_count)
+			blog(LOG_DEBUG, "stinger: '%s' decoded %lld frames, "
+					"%lld expected", path,
+					(long long)decoded,
+					(long long)info->frame_count);
+	}
+
+	if (stinger_probe_aborted(abort))
+		return probe_aborted(path, abort, start);
+
+	finish_index(info);
+	info->duration_ms = (uint32_t)(stinger_probe_frame_time_us(info,
+				info->frame_count) / 1000);
+
+	info->probe_ns = os_gettime_ns() - start;
+
+	blog(LOG_INFO, "stinger: probed '%s' in %.1f ms (%s): %lld frames, "
+			"%dx%d %s%s, %u ms", path,
+			(double)info->probe_ns / 1e6,
+			stinger_probe_method_name(info->method),
+			(long long)info->frame_count,
+			info->width, info->height,
+			av_get_pix_fmt_name(info->pixel_format) ?
+				av_get_pix_fmt_name(info->pixel_format) : "?",
+			info->has_alpha ? " with alpha" : "",
+			info->duration_ms);
+
+	if (info->coverage.num)
+		blog(LOG_INFO, "stinger: '%s' covers at most %.1f%% of the "
+				"frame", path,
+				(double)max_coverage(info) * 100.0 /
+				STINGER_COVERAGE_SCALE);
+
+	return info->frame_count > 0;
+}
+
+void stinger_probe_info_free(struct stinger_probe_info *info)
+{
+	da_free(info->keyframes);
+	da_free(info->index);
+	da_free(info->coverage);
+}
+
+int64_t stinger_probe_frame_time_us(const struct stinger_probe_info *info,
+		int64_t frame)
+{
+	const AVRational us = {1, 1000000};
+	int64_t pts;
+
+	if (info->index.num && frame >= 0 &&
+	    frame <= (int64_t)info->index.num) {
+		pts = frame < (int64_t)info->index.num ?
+			info->index.array[frame].pts : info->end_pts;
+		return av_rescale_q(pts - info->index.array[0].pts,
+				info->time_base, us);
+	}
+
+	if (info->framerate.num <= 0 || info->framerate.den <= 0)
+		return 0;
+	return av_rescale_q(frame, av_inv_q(info->framerate), us);
+}
+
+int64_t stinger_probe_count_decoded(const char *path)
+{
+	return decode_frames(path, STINGER_COVERAGE_NONE, NULL, NULL);
+}
+
+const char *stinger_probe_method_name(enum stinger_probe_method method)
+{
+	switch (method) {
+	case STINGER_PROBE_METADATA:    return "metadata";
+	case STINGER_PROBE_PACKET_SCAN: return "packet scan";
+	case STINGER_PROBE_DECODE:      return "full decode";
+	}
+
+	return "unknown";
+}
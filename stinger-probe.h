@@ -0,0 +1,83 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/darray.h>
+#include <libavutil/avutil.h>
+
+#include "stinger-coverage.h"
+#include "stinger-decoder.h"
+
+/* Everything the transition needs to know about a stinger file, gathered in
+ * a single pass. Every probe demuxes the whole file once, without decoding,
+ * since that's what builds the frame index; the frame count is the number
+ * of packets it found, checked against the container's count and the
+ * duration. The file is only fully decoded when neither count can be
+ * trusted, or when its coverage curve is wanted, in which case the one
+ * decode serves both. */
+
+enum stinger_probe_method {
+	/* the container's count, where the packet scan came out different */
+	STINGER_PROBE_METADATA,
+	STINGER_PROBE_PACKET_SCAN,
+	STINGER_PROBE_DECODE
+};
+
+struct stinger_probe_info {
+	int64_t frame_count;
+	uint32_t duration_ms;
+	AVRational framerate;
+	int width;
+	int height;
+	enum AVPixelFormat pixel_format;
+	bool has_alpha;
+
+	/* frame numbers of keyframes, in decode order */
+	DARRAY(int64_t) keyframes;
+
+	/* every frame in presentation order with its timestamp in time_base,
+	 * and where the last one ends. Empty when the packets lack
+	 * timestamps or don't map to frames one to one. */
+	DARRAY(struct stinger_index_entry) index;
+	AVRational time_base;
+	int64_t end_pts;
+
+	/* coverage of every frame, empty if the source had nothing to
+	 * measure (or none was asked for) */
+	enum stinger_coverage_source coverage_source;
+	DARRAY(uint16_t) coverage;
+
+	enum stinger_probe_method method;
+	uint64_t probe_ns;
+};
+
+/* milliseconds a probe may take before it's given up on */
+#define STINGER_PROBE_TIMEOUT_MS 30000
+
+/* Lets a probe be given up on from another thread, or once the
+ * os_gettime_ns() deadline passes (0 for never) */
+struct stinger_probe_abort {
+	volatile bool cancel;
+	uint64_t deadline_ns;
+};
+
+/* Deadline STINGER_PROBE_TIMEOUT_MS from now */
+extern void stinger_probe_abort_init(struct stinger_probe_abort *abort);
+extern bool stinger_probe_aborted(struct stinger_probe_abort *abort);
+
+/* abort may be NULL to probe for as long as it takes */
+extern bool stinger_probe_file(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_abort *abort,
+		struct stinger_probe_info *info);
+extern void stinger_probe_info_free(struct stinger_probe_info *info);
+
+/* Start of frame in microseconds from the first frame; frame_count gives
+ * the end of the last one. Goes by the frame index when there is one,
+ * which keeps variable frame rate clips right, else by the frame rate. */
+extern int64_t stinger_probe_frame_time_us(
+		const struct stinger_probe_info *info, int64_t frame);
+
+/* Frame count by decoding every packet, the slow but exact reference */
+extern int64_t stinger_probe_count_decoded(const char *path);
+
+extern const char *stinger_probe_method_name(enum stinger_probe_method method);
@@ -0,0 +1,207 @@
+#include <obs-module.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+#include <util/platform.h>
+
+#include "obs-ffmpeg-compat.h"
+#include "stinger-read-ahead.h"
+
+/* enough to cover a few frames of audio and video, including large
+ * keyframes of high bitrate intermediate codecs */
+#define MAX_PACKETS 64
+#define MAX_BYTES (32 * 1024 * 1024)
+
+/* how often a waiting consumer checks for an interrupt */
+#define WAIT_MS 10
+
+struct stinger_read_ahead {
+	AVFormatContext *format;
+
+	/* held by the thread while it reads, and while paused */
+	pthread_mutex_t format_mutex;
+
+	/* packets and bytes are protected by the mutex */
+	pthread_mutex_t mutex;
+	struct circlebuf packets;
+	size_t bytes;
+	bool eof;
+
+	os_event_t *data_ready;
+	os_event_t *space_ready;
+	pthread_t thread;
+	bool thread_active;
+	volatile bool stop;
+
+	/* consumer only */
+	uint64_t waits;
+	uint64_t wait_ns;
+};
+
+static inline bool queue_full(struct stinger_read_ahead *ra)
+{
+	return ra->packets.size >= MAX_PACKETS * sizeof(AVPacket) ||
+		ra->bytes >= MAX_BYTES;
+}
+
+static void *read_thread(void *data)
+{
+	struct stinger_read_ahead *ra = data;
+	AVPacket packet;
+	bool eof;
+
+	os_set_thread_name("stinger: demux");
+
+	for (;;) {
+		pthread_mutex_lock(&ra->mutex);
+		while (!os_atomic_load_bool(&ra->stop) &&
+		       (ra->eof || queue_full(ra))) {
+			pthread_mutex_unlock(&ra->mutex);
+			os_event_wait(ra->space_ready);
+			pthread_mutex_lock(&ra->mutex);
+		}
+		pthread_mutex_unlock(&ra->mutex);
+
+		if (os_atomic_load_bool(&ra->stop))
+			break;
+
+		/* the packet is queued before a seek can flush the queue, so
+		 * nothing read from the old position is left behind */
+		pthread_mutex_lock(&ra->format_mutex);
+		eof = av_read_frame(ra->format, &packet) < 0;
+
+		pthread_mutex_lock(&ra->mutex);
+		if (eof) {
+			ra->eof = true;
+		} else {
+			circlebuf_push_back(&ra->packets, &packet,
+					sizeof(packet));
+			ra->bytes += (size_t)packet.size;
+		}
+		pthread_mutex_unlock(&ra->mutex);
+		pthread_mutex_unlock(&ra->format_mutex);
+
+		os_event_signal(ra->data_ready);
+	}
+
+	return NULL;
+}
+
+struct stinger_read_ahead *stinger_read_ahead_create(AVFormatContext *format)
+{
+	struct stinger_read_ahead *ra = bzalloc(sizeof(*ra));
+
+	ra->format = format;
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_mutex_init(&ra->format_mutex, NULL);
+
+	if (os_event_init(&ra->data_ready, OS_EVENT_TYPE_AUTO) != 0 ||
+	    os_event_init(&ra->space_ready, OS_EVENT_TYPE_AUTO) != 0 ||
+	    pthread_create(&ra->thread, NULL, read_thread, ra) != 0) {
+		blog(LOG_WARNING, "stinger: failed to start demux thread, "
+				"reading on the decoder thread");
+		stinger_read_ahead_destroy(ra);
+		return NULL;
+	}
+
+	ra->thread_active = true;
+	return ra;
+}
+
+void stinger_read_ahead_destroy(struct stinger_read_ahead *ra)
+{
+	AVPacket packet;
+
+	if (!ra)
+		return;
+
+	if (ra->thread_active) {
+		os_atomic_set_bool(&ra->stop, true);
+		os_event_signal(ra->space_ready);
+		pthread_join(ra->thread, NULL);
+	}
+
+	while (ra->packets.size) {
+		circlebuf_pop_front(&ra->packets, &packet, sizeof(packet));
+		av_packet_unref(&packet);
+	}
+
+	circlebuf_free(&ra->packets);
+	os_event_destroy(ra->data_ready);
+	os_event_destroy(ra->space_ready);
+	pthread_mutex_destroy(&ra->format_mutex);
+	pthread_mutex_destroy(&ra->mutex);
+	bfree(ra);
+}
+
+void stinger_read_ahead_pause(struct stinger_read_ahead *ra)
+{
+	if (ra)
+		pthread_mutex_lock(&ra->format_mutex);
+}
+
+void stinger_read_ahead_resume(struct stinger_read_ahead *ra, bool flush)
+{
+	AVPacket packet;
+
+	if (!ra)
+		return;
+
+	if (flush) {
+		pthread_mutex_lock(&ra->mutex);
+		while (ra->packets.size) {
+			circlebuf_pop_front(&ra->packets, &packet,
+					sizeof(packet));
+			av_packet_unref(&packet);
+		}
+		ra->bytes = 0;
+		ra->eof = false;
+		pthread_mutex_unlock(&ra->mutex);
+	}
+
+	pthread_mutex_unlock(&ra->format_mutex);
+	os_event_signal(ra->space_ready);
+}
+
+bool stinger_read_ahead_get(struct stinger_read_ahead *ra, AVPacket *packet,
+		volatile bool *interrupt)
+{
+	uint64_t wait_start = 0;
+	bool found;
+	bool eof;
+
+	for (;;) {
+		pthread_mutex_lock(&ra->mutex);
+		found = ra->packets.size != 0;
+		if (found) {
+			circlebuf_pop_front(&ra->packets, packet,
+					sizeof(*packet));
+			ra->bytes -= (size_t)packet->size;
+		}
+		eof = ra->eof;
+		pthread_mutex_unlock(&ra->mutex);
+
+		if (found) {
+			os_event_signal(ra->space_ready);
+			break;
+		}
+		if (eof || (interrupt && os_atomic_load_bool(interrupt)))
+			break;
+
+		if (!wait_start) {
+			wait_start = os_gettime_ns();
+			ra->waits++;
+		}
+		os_event_timedwait(ra->data_ready, WAIT_MS);
+	}
+
+	if (wait_start)
+		ra->wait_ns += os_gettime_ns() - wait_start;
+	return found;
+}
+
+void stinger_read_ahead_get_stats(struct stinger_read_ahead *ra,
+		uint64_t *waits, uint64_t *wait_ns)
+{
+	*waits = ra ? ra->waits : 0;
+	*wait_ns = ra ? ra->wait_ns : 0;
+}
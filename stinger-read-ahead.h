@@ -0,0 +1,35 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <libavformat/avformat.h>
+
+/* Demuxes a file on its own thread into a bounded queue of packets, so
+ * reading (possibly from a slow disk or network share) overlaps decoding
+ * instead of stalling it. Packets of every stream come out in file order.
+ * The format context belongs to the read-ahead thread while it runs;
+ * seeking means pausing it, seeking and resuming it with the queued
+ * packets flushed. */
+
+struct stinger_read_ahead;
+
+extern struct stinger_read_ahead *stinger_read_ahead_create(
+		AVFormatContext *format);
+extern void stinger_read_ahead_destroy(struct stinger_read_ahead *ra);
+
+/* Waits for a read in progress and stops reading, handing the format
+ * context to the caller until resumed. Resuming with flush drops the
+ * packets queued so far and clears the end of file. Both do nothing
+ * if ra is NULL. */
+extern void stinger_read_ahead_pause(struct stinger_read_ahead *ra);
+extern void stinger_read_ahead_resume(struct stinger_read_ahead *ra,
+		bool flush);
+
+/* Takes the next packet, waiting for it to be read if necessary. False at
+ * the end of the file, on a read error, or when interrupt gets set while
+ * waiting. */
+extern bool stinger_read_ahead_get(struct stinger_read_ahead *ra,
+		AVPacket *packet, volatile bool *interrupt);
+
+/* How often and how long the consumer had to wait for a packet */
+extern void stinger_read_ahead_get_stats(struct stinger_read_ahead *ra,
+		uint64_t *waits, uint64_t *wait_ns);
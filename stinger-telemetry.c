@@ -0,0 +1,206 @@
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "stinger-telemetry.h"
+
+struct metric_info {
+	const char *name;
+	const char *label;
+	bool time;
+};
+
+static const struct metric_info metrics[STINGER_METRIC_COUNT] = {
+	{"first_frame_us", "scene change to first frame", true},
+	{"decode_us", "decode", true},
+	{"convert_us", "convert", true},
+	{"upload_us", "upload", true},
+	{"dropped_frames", "frames dropped", false},
+	{"repeated_frames", "frames repeated", false},
+	{"cut_late_frames", "frames the cut came after cutFrame", false},
+	{"cut_behind_frames", "frames shown behind the clock at the cut",
+		false},
+};
+
+static size_t get_bucket(uint64_t value)
+{
+	size_t msb = 2;
+	size_t bucket;
+
+	if (value < 4)
+		return (size_t)value;
+
+	while (msb < 63 && (value >> (msb + 1)) != 0)
+		msb++;
+
+	bucket = (msb - 1) * 4 + (size_t)((value >> (msb - 2)) & 3);
+	return bucket < STINGER_HISTOGRAM_BUCKETS ?
+		bucket : STINGER_HISTOGRAM_BUCKETS - 1;
+}
+
+static void get_bucket_range(size_t bucket, uint64_t *lower, uint64_t *upper)
+{
+	size_t shift;
+
+	if (bucket < 4) {
+		*lower = bucket;
+		*upper = bucket;
+		return;
+	}
+
+	shift = bucket / 4 - 1;
+	*lower = (uint64_t)(4 + bucket % 4) << shift;
+	*upper = *lower + ((uint64_t)1 << shift) - 1;
+}
+
+void stinger_histogram_add(struct stinger_histogram *h, uint64_t value)
+{
+	os_atomic_inc_long(&h->buckets[get_bucket(value)]);
+}
+
+uint64_t stinger_histogram_count(const struct stinger_histogram *h)
+{
+	uint64_t count = 0;
+
+	for (size_t i = 0; i < STINGER_HISTOGRAM_BUCKETS; i++)
+		count += (uint64_t)h->buckets[i];
+	return count;
+}
+
+double stinger_histogram_percentile(const struct stinger_histogram *h,
+		double p)
+{
+	uint64_t count = stinger_histogram_count(h);
+	uint64_t rank = (uint64_t)(p * (double)count + 0.5);
+	uint64_t seen = 0;
+	uint64_t lower, upper;
+
+	if (!count)
+		return 0.0;
+	if (rank < 1)
+		rank = 1;
+
+	for (size_t i = 0; i < STINGER_HISTOGRAM_BUCKETS; i++) {
+		seen += (uint64_t)h->buckets[i];
+		if (seen >= rank) {
+			get_bucket_range(i, &lower, &upper);
+			return ((double)lower + (double)upper) / 2.0;
+		}
+	}
+
+	return 0.0;
+}
+
+void stinger_telemetry_init(struct stinger_telemetry *t)
+{
+	memset(t, 0, sizeof(*t));
+	pthread_mutex_init(&t->mutex, NULL);
+}
+
+void stinger_telemetry_free(struct stinger_telemetry *t)
+{
+	pthread_mutex_destroy(&t->mutex);
+}
+
+void stinger_telemetry_add_time(struct stinger_telemetry *t,
+		enum stinger_metric metric, uint64_t start_ns)
+{
+	stinger_histogram_add(&t->run[metric],
+			(os_gettime_ns() - start_ns) / 1000);
+}
+
+static void log_metric(const char *name, const struct metric_info *info,
+		const struct stinger_histogram *h)
+{
+	uint64_t count = stinger_histogram_count(h);
+	double scale = info->time ? 1000.0 : 1.0;
+
+	if (!count)
+		return;
+
+	if (count == 1)
+		blog(LOG_INFO, "stinger '%s': %s %.*f%s", name, info->label,
+				info->time ? 2 : 0,
+				stinger_histogram_percentile(h, 0.5) / scale,
+				info->time ? " ms" : "");
+	else
+		blog(LOG_INFO, "stinger '%s': %s p50 %.2f, p90 %.2f, p99 "
+				"%.2f, max %.2f%s over %llu samples", name,
+				info->label,
+				stinger_histogram_percentile(h, 0.5) / scale,
+				stinger_histogram_percentile(h, 0.9) / scale,
+				stinger_histogram_percentile(h, 0.99) / scale,
+				stinger_histogram_percentile(h, 1.0) / scale,
+				info->time ? " ms" : "",
+				(unsigned long long)count);
+}
+
+void stinger_telemetry_finish_run(struct stinger_telemetry *t,
+		const char *name)
+{
+	struct stinger_histogram run;
+
+	pthread_mutex_lock(&t->mutex);
+	for (size_t m = 0; m < STINGER_METRIC_COUNT; m++) {
+		for (size_t i = 0; i < STINGER_HISTOGRAM_BUCKETS; i++) {
+			run.buckets[i] = os_atomic_set_long(
+					&t->run[m].buckets[i], 0);
+			t->total[m].buckets[i] += run.buckets[i];
+		}
+
+		log_metric(name, &metrics[m], &run);
+	}
+	t->transitions++;
+	pthread_mutex_unlock(&t->mutex);
+}
+
+static void json_metric(struct dstr *json, const struct metric_info *info,
+		const struct stinger_histogram *h)
+{
+	uint64_t lower, upper;
+	bool first = true;
+
+	dstr_catf(json, "\"%s\":{\"count\":%llu,\"p50\":%.1f,\"p90\":%.1f,"
+			"\"p99\":%.1f,\"max\":%.1f,\"buckets\":[", info->name,
+			(unsigned long long)stinger_histogram_count(h),
+			stinger_histogram_percentile(h, 0.5),
+			stinger_histogram_percentile(h, 0.9),
+			stinger_histogram_percentile(h, 0.99),
+			stinger_histogram_percentile(h, 1.0));
+
+	/* [lowest value, highest value, samples] */
+	for (size_t i = 0; i < STINGER_HISTOGRAM_BUCKETS; i++) {
+		if (!h->buckets[i])
+			continue;
+
+		get_bucket_range(i, &lower, &upper);
+		dstr_catf(json, "%s[%llu,%llu,%ld]", first ? "" : ",",
+				(unsigned long long)lower,
+				(unsigned long long)upper, h->buckets[i]);
+		first = false;
+	}
+
+	dstr_cat(json, "]}");
+}
+
+void stinger_telemetry_get_json(struct stinger_telemetry *t,
+		struct dstr *json)
+{
+	pthread_mutex_lock(&t->mutex);
+	dstr_printf(json, "{\"transitions\":%llu,\"metrics\":{",
+			(unsigned long long)t->transitions);
+	for (size_t m = 0; m < STINGER_METRIC_COUNT; m++) {
+		if (m)
+			dstr_cat(json, ",");
+		json_metric(json, &metrics[m], &t->total[m]);
+	}
+	dstr_cat(json, "}}");
+	pthread_mutex_unlock(&t->mutex);
+}
+
+void stinger_telemetry_reset(struct stinger_telemetry *t)
+{
+	pthread_mutex_lock(&t->mutex);
+	memset(t->total, 0, sizeof(t->total));
+	t->transitions = 0;
+	pthread_mutex_unlock(&t->mutex);
+}
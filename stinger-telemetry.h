@@ -0,0 +1,77 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+
+/* Per-transition performance histograms. Samples of the running transition
+ * are added lock-free by the decoder and render threads; at the end of the
+ * transition they're summarized in the log and merged into the totals,
+ * which the source's proc handler hands out as JSON. Nothing is recorded
+ * (or timed) unless the caller passes the telemetry along, so the cost
+ * when it's disabled is a NULL check. */
+
+/* log-linear buckets, four per power of two, up to about 2^25 */
+#define STINGER_HISTOGRAM_BUCKETS 96
+
+struct stinger_histogram {
+	volatile long buckets[STINGER_HISTOGRAM_BUCKETS];
+};
+
+enum stinger_metric {
+	/* microseconds */
+	STINGER_METRIC_FIRST_FRAME,
+	STINGER_METRIC_DECODE,
+	STINGER_METRIC_CONVERT,
+	STINGER_METRIC_UPLOAD,
+
+	/* frames per transition */
+	STINGER_METRIC_DROPPED,
+	STINGER_METRIC_REPEATED,
+	STINGER_METRIC_CUT_LATE,
+	STINGER_METRIC_CUT_BEHIND,
+
+	STINGER_METRIC_COUNT
+};
+
+struct stinger_telemetry {
+	struct stinger_histogram run[STINGER_METRIC_COUNT];
+
+	/* everything since the last reset, protected by the mutex */
+	pthread_mutex_t mutex;
+	struct stinger_histogram total[STINGER_METRIC_COUNT];
+	uint64_t transitions;
+};
+
+extern void stinger_histogram_add(struct stinger_histogram *h,
+		uint64_t value);
+extern uint64_t stinger_histogram_count(const struct stinger_histogram *h);
+
+/* Value at fraction p (0 to 1) of the samples, as the middle of its
+ * bucket */
+extern double stinger_histogram_percentile(const struct stinger_histogram *h,
+		double p);
+
+extern void stinger_telemetry_init(struct stinger_telemetry *t);
+extern void stinger_telemetry_free(struct stinger_telemetry *t);
+
+static inline void stinger_telemetry_add(struct stinger_telemetry *t,
+		enum stinger_metric metric, uint64_t value)
+{
+	stinger_histogram_add(&t->run[metric], value);
+}
+
+/* Adds the time since start_ns (from os_gettime_ns) */
+extern void stinger_telemetry_add_time(struct stinger_telemetry *t,
+		enum stinger_metric metric, uint64_t start_ns);
+
+/* Logs the samples of the transition that just ended and moves them into
+ * the totals */
+extern void stinger_telemetry_finish_run(struct stinger_telemetry *t,
+		const char *name);
+
+/* The totals as a JSON object, with the percentiles and non-empty buckets
+ * of every metric */
+extern void stinger_telemetry_get_json(struct stinger_telemetry *t,
+		struct dstr *json);
+extern void stinger_telemetry_reset(struct stinger_telemetry *t);
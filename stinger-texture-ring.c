@@ -0,0 +1,222 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "stinger-texture-ring.h"
+
+struct plane_layout {
+	uint32_t width;
+	uint32_t height;
+	enum gs_color_format format;
+	uint32_t texel_size;
+};
+
+static inline void set_plane(struct plane_layout *plane, uint32_t width,
+		uint32_t height, enum gs_color_format format,
+		uint32_t texel_size)
+{
+	plane->width = width;
+	plane->height = height;
+	plane->format = format;
+	plane->texel_size = texel_size;
+}
+
+static size_t get_plane_layout(enum video_format format, uint32_t width,
+		uint32_t height, struct plane_layout *planes)
+{
+	uint32_t half_width = (width + 1) / 2;
+	uint32_t half_height = (height + 1) / 2;
+
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+		set_plane(&planes[0], width, height, GS_R8, 1);
+		set_plane(&planes[1], half_width, half_height, GS_R8, 1);
+		set_plane(&planes[2], half_width, half_height, GS_R8, 1);
+		return 3;
+	case VIDEO_FORMAT_I444:
+		set_plane(&planes[0], width, height, GS_R8, 1);
+		set_plane(&planes[1], width, height, GS_R8, 1);
+		set_plane(&planes[2], width, height, GS_R8, 1);
+		return 3;
+	case VIDEO_FORMAT_NV12:
+		set_plane(&planes[0], width, height, GS_R8, 1);
+		set_plane(&planes[1], half_width, half_height, GS_R8G8, 2);
+		return 2;
+	case VIDEO_FORMAT_Y800:
+		set_plane(&planes[0], width, height, GS_R8, 1);
+		return 1;
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+		/* two pixels per texel, unpacked in the effect */
+		set_plane(&planes[0], half_width, height, GS_BGRA, 4);
+		return 1;
+	case VIDEO_FORMAT_RGBA:
+		set_plane(&planes[0], width, height, GS_RGBA, 4);
+		return 1;
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		set_plane(&planes[0], width, height, GS_BGRA, 4);
+		return 1;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+bool stinger_texture_ring_format_supported(enum video_format format)
+{
+	struct plane_layout planes[STINGER_MAX_PLANES];
+	return get_plane_layout(format, 2, 2, planes) > 0;
+}
+
+void stinger_texture_ring_init(struct stinger_texture_ring *ring)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->display = -1;
+	ring->last_written = -1;
+}
+
+static void destroy_textures(struct stinger_texture_ring *ring)
+{
+	for (size_t i = 0; i < STINGER_TEXTURE_RING_SIZE; i++) {
+		for (size_t p = 0; p < STINGER_MAX_PLANES; p++) {
+			gs_texture_destroy(ring->slots[i].planes[p]);
+			ring->slots[i].planes[p] = NULL;
+		}
+	}
+
+	ring->width = 0;
+	ring->height = 0;
+	ring->format = VIDEO_FORMAT_NONE;
+	os_atomic_set_long(&ring->display, -1);
+	ring->last_written = -1;
+}
+
+void stinger_texture_ring_free(struct stinger_texture_ring *ring)
+{
+	destroy_textures(ring);
+}
+
+static bool ensure_textures(struct stinger_texture_ring *ring,
+		uint32_t width, uint32_t height, enum video_format format,
+		const struct plane_layout *planes, size_t count)
+{
+	if (ring->width == width && ring->height == height &&
+	    ring->format == format && ring->slots[0].planes[0])
+		return true;
+
+	destroy_textures(ring);
+
+	for (size_t i = 0; i < STINGER_TEXTURE_RING_SIZE; i++) {
+		for (size_t p = 0; p < count; p++) {
+			gs_texture_t *tex = gs_texture_create(
+					planes[p].width, planes[p].height,
+					planes[p].format, 1, NULL, GS_DYNAMIC);
+			if (!tex) {
+				blog(LOG_ERROR, "stinger: failed to create "
+						"%ux%u dynamic texture",
+						planes[p].width,
+						planes[p].height);
+				destroy_textures(ring);
+				return false;
+			}
+
+			ring->slots[i].planes[p] = tex;
+		}
+
+		ring->slot_allocations++;
+	}
+
+	ring->width = width;
+	ring->height = height;
+	ring->format = format;
+	return true;
+}
+
+bool stinger_texture_ring_upload(struct stinger_texture_ring *ring,
+		uint32_t width, uint32_t height, enum video_format format,
+		const uint8_t *const data[], const int linesize[],
+		const struct stinger_frame_props *props)
+{
+	struct plane_layout planes[STINGER_MAX_PLANES];
+	uint64_t start = os_gettime_ns();
+	struct stinger_ring_slot *slot;
+	uint64_t elapsed;
+	size_t count;
+	long next;
+
+	count = get_plane_layout(format, width, height, planes);
+	if (!count || !ensure_textures(ring, width, height, format,
+				planes, count))
+		return false;
+
+	next = (ring->last_written + 1) % STINGER_TEXTURE_RING_SIZE;
+	slot = &ring->slots[next];
+
+	for (size_t p = 0; p < count; p++) {
+		gs_texture_set_image(slot->planes[p], data[p],
+				(uint32_t)linesize[p], false);
+		ring->upload_bytes += (uint64_t)planes[p].width *
+			planes[p].height * planes[p].texel_size;
+	}
+
+	slot->props = *props;
+
+	ring->last_written = next;
+	os_atomic_set_long(&ring->display, next);
+
+	elapsed = os_gettime_ns() - start;
+	ring->uploads++;
+	ring->upload_ns_total += elapsed;
+	if (elapsed > ring->upload_ns_max)
+		ring->upload_ns_max = elapsed;
+	return true;
+}
+
+void stinger_texture_ring_clear(struct stinger_texture_ring *ring)
+{
+	os_atomic_set_long(&ring->display, -1);
+}
+
+const struct stinger_ring_slot *stinger_texture_ring_current(
+		struct stinger_texture_ring *ring)
+{
+	long slot = os_atomic_load_long(&ring->display);
+	return slot < 0 ? NULL : &ring->slots[slot];
+}
+
+void stinger_texture_ring_log_stats(struct stinger_texture_ring *ring,
+		const char *name)
+{
+	uint64_t avoided;
+
+	if (!ring->uploads)
+		return;
+
+	/* every upload used to create (and later destroy) the textures for
+	 * its frame, however many planes it has */
+	avoided = ring->uploads > ring->slot_allocations ?
+		ring->uploads - ring->slot_allocations : 0;
+
+	blog(LOG_INFO, "stinger '%s': %llu frame uploads, %llu frame texture "
+			"allocations avoided, upload avg %.3f ms, max %.3f ms, "
+			"%.1f KiB per frame",
+			name,
+			(unsigned long long)ring->uploads,
+			(unsigned long long)avoided,
+			(double)ring->upload_ns_total /
+				(double)ring->uploads / 1e6,
+			(double)ring->upload_ns_max / 1e6,
+			(double)ring->upload_bytes /
+				(double)ring->uploads / 1024.0);
+}
+
+void stinger_texture_ring_reset_stats(struct stinger_texture_ring *ring)
+{
+	ring->uploads = 0;
+	ring->upload_bytes = 0;
+	ring->slot_allocations = 0;
+	ring->upload_ns_total = 0;
+	ring->upload_ns_max = 0;
+}
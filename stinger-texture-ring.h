@@ -0,0 +1,68 @@
+#pragma once
+
+#include <graphics/graphics.h>
+#include <media-io/video-io.h>
+
+/* Small ring of persistent dynamic textures. Each upload goes into the slot
+ * after the one currently displayed, so the texture the renderer samples (and
+ * the one before it, which may still be in flight on the GPU) is never
+ * written while in use. Textures are only recreated when the frame size or
+ * format changes. All functions must be called inside the graphics context.
+ *
+ * YUV frames are uploaded as one R8/R8G8 texture per plane and converted to
+ * RGB by the effect, so only BGRA/RGBA frames are uploaded as a single
+ * texture. */
+
+struct stinger_frame_props {
+	enum video_colorspace colorspace;
+	enum video_range_type range;
+	bool premultiplied;
+};
+
+#define STINGER_TEXTURE_RING_SIZE 3
+#define STINGER_MAX_PLANES 3
+
+struct stinger_ring_slot {
+	gs_texture_t *planes[STINGER_MAX_PLANES];
+	struct stinger_frame_props props;
+};
+
+struct stinger_texture_ring {
+	struct stinger_ring_slot slots[STINGER_TEXTURE_RING_SIZE];
+	uint32_t width;
+	uint32_t height;
+	enum video_format format;
+
+	volatile long display;
+	long last_written;
+
+	/* slot_allocations counts slots whose textures were created, one per
+	 * frame the way uploads do, not one per plane */
+	uint64_t uploads;
+	uint64_t upload_bytes;
+	uint64_t slot_allocations;
+	uint64_t upload_ns_total;
+	uint64_t upload_ns_max;
+};
+
+extern void stinger_texture_ring_init(struct stinger_texture_ring *ring);
+extern void stinger_texture_ring_free(struct stinger_texture_ring *ring);
+
+extern bool stinger_texture_ring_upload(struct stinger_texture_ring *ring,
+		uint32_t width, uint32_t height, enum video_format format,
+		const uint8_t *const data[], const int linesize[],
+		const struct stinger_frame_props *props);
+
+/* Hides the current frame without releasing any texture */
+extern void stinger_texture_ring_clear(struct stinger_texture_ring *ring);
+
+/* Slot the renderer should sample, NULL if no frame is shown */
+extern const struct stinger_ring_slot *stinger_texture_ring_current(
+		struct stinger_texture_ring *ring);
+
+extern bool stinger_texture_ring_format_supported(enum video_format format);
+
+extern void stinger_texture_ring_log_stats(struct stinger_texture_ring *ring,
+		const char *name);
+extern void stinger_texture_ring_reset_stats(
+		struct stinger_texture_ring *ring);
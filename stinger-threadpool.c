@@ -0,0 +1,155 @@
+#include <obs-module.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <util/darray.h>
+
+#include "stinger-threadpool.h"
+
+#define MAX_WORKERS 15
+
+struct stinger_threadpool {
+	char *name;
+	DARRAY(pthread_t) threads;
+	os_sem_t *start;
+	os_event_t *done;
+	pthread_mutex_t run_mutex;
+	volatile bool exit;
+
+	stinger_task_t task;
+	void *param;
+	long count;
+	volatile long next;
+	volatile long active;
+};
+
+static struct stinger_threadpool *global_pool = NULL;
+
+static void process_tasks(struct stinger_threadpool *pool)
+{
+	long index;
+
+	while ((index = os_atomic_inc_long(&pool->next) - 1) < pool->count)
+		pool->task(pool->param, (size_t)index);
+}
+
+static void *worker_thread(void *data)
+{
+	struct stinger_threadpool *pool = data;
+
+	os_set_thread_name(pool->name);
+
+	for (;;) {
+		os_sem_wait(pool->start);
+		if (pool->exit)
+			break;
+
+		process_tasks(pool);
+
+		if (os_atomic_dec_long(&pool->active) == 0)
+			os_event_signal(pool->done);
+	}
+
+	return NULL;
+}
+
+struct stinger_threadpool *stinger_threadpool_create(const char *name,
+		int workers)
+{
+	struct stinger_threadpool *pool = bzalloc(sizeof(*pool));
+
+	pool->name = bstrdup(name);
+	pthread_mutex_init(&pool->run_mutex, NULL);
+
+	if (os_sem_init(&pool->start, 0) != 0 ||
+	    os_event_init(&pool->done, OS_EVENT_TYPE_AUTO) != 0) {
+		blog(LOG_ERROR, "%s: failed to create synchronization objects",
+				name);
+		stinger_threadpool_destroy(pool);
+		return NULL;
+	}
+
+	if (workers > MAX_WORKERS)
+		workers = MAX_WORKERS;
+
+	for (int i = 0; i < workers; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, worker_thread, pool) != 0) {
+			blog(LOG_WARNING, "%s: only started %d of %d workers",
+					name, i, workers);
+			break;
+		}
+		da_push_back(pool->threads, &thread);
+	}
+
+	return pool;
+}
+
+void stinger_threadpool_destroy(struct stinger_threadpool *pool)
+{
+	if (!pool)
+		return;
+
+	pool->exit = true;
+	for (size_t i = 0; i < pool->threads.num; i++)
+		os_sem_post(pool->start);
+	for (size_t i = 0; i < pool->threads.num; i++)
+		pthread_join(pool->threads.array[i], NULL);
+
+	da_free(pool->threads);
+	os_sem_destroy(pool->start);
+	os_event_destroy(pool->done);
+	pthread_mutex_destroy(&pool->run_mutex);
+	bfree(pool->name);
+	bfree(pool);
+}
+
+void stinger_threadpool_run(struct stinger_threadpool *pool, size_t count,
+		stinger_task_t task, void *param)
+{
+	if (!pool || !pool->threads.num || count <= 1) {
+		for (size_t i = 0; i < count; i++)
+			task(param, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->run_mutex);
+
+	pool->task = task;
+	pool->param = param;
+	pool->count = (long)count;
+	os_atomic_set_long(&pool->next, 0);
+	os_atomic_set_long(&pool->active, (long)pool->threads.num);
+
+	for (size_t i = 0; i < pool->threads.num; i++)
+		os_sem_post(pool->start);
+
+	process_tasks(pool);
+	os_event_wait(pool->done);
+
+	pthread_mutex_unlock(&pool->run_mutex);
+}
+
+int stinger_threadpool_workers(struct stinger_threadpool *pool)
+{
+	return pool ? (int)pool->threads.num : 0;
+}
+
+void stinger_threadpool_global_init(void)
+{
+	int cores = os_get_logical_cores();
+
+	global_pool = stinger_threadpool_create("stinger: worker pool",
+			cores > 1 ? cores - 1 : 0);
+}
+
+void stinger_threadpool_global_free(void)
+{
+	stinger_threadpool_destroy(global_pool);
+	global_pool = NULL;
+}
+
+struct stinger_threadpool *stinger_threadpool_global(void)
+{
+	return global_pool;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <util/c99defs.h>
+
+/* Minimal fork/join pool for splitting per-frame work (row bands, frame
+ * ranges) across cores. stinger_threadpool_run() blocks until every index
+ * has been processed; the calling thread takes part in the work, so a pool
+ * with zero workers simply runs everything inline. */
+
+struct stinger_threadpool;
+
+typedef void (*stinger_task_t)(void *param, size_t index);
+
+extern struct stinger_threadpool *stinger_threadpool_create(const char *name,
+		int workers);
+extern void stinger_threadpool_destroy(struct stinger_threadpool *pool);
+
+extern void stinger_threadpool_run(struct stinger_threadpool *pool,
+		size_t count, stinger_task_t task, void *param);
+
+extern int stinger_threadpool_workers(struct stinger_threadpool *pool);
+
+/* Module-wide pool, created on module load */
+extern void stinger_threadpool_global_init(void);
+extern void stinger_threadpool_global_free(void);
+extern struct stinger_threadpool *stinger_threadpool_global(void);
@@ -0,0 +1,596 @@
+#include <obs-module.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <libswscale/swscale.h>
+#include <sys/stat.h>
+
+#include "stinger-decoder.h"
+#include "stinger-thumbnails.h"
+
+#define THUMBNAIL_WIDTH 96
+#define PREVIEW_WIDTH 320
+
+/* a preview this far past the last one decoded seeks instead of decoding
+ * its way there */
+#define MAX_DECODE_AHEAD 30
+
+#define STRIP_FILE "strip.txt"
+
+struct thumbnail_set {
+	char *path;
+
+	/* written by the thread, read under the mutex */
+	char *dir;
+	DARRAY(int64_t) keyframes;
+	DARRAY(int64_t) previews;
+	bool prepared;
+	bool complete;
+	bool failed;
+};
+
+static pthread_mutex_t mutex;
+static DARRAY(struct thumbnail_set *) sets;
+static DARRAY(struct thumbnail_set *) strip_queue;
+
+/* only changed by the thread, under the mutex */
+static struct thumbnail_set *strip_set = NULL;
+static struct thumbnail_set *preview_set = NULL;
+static int64_t preview_frame = -1;
+static bool preview_pending = false;
+static volatile bool preview_interrupt = false;
+
+static os_event_t *wake = NULL;
+static pthread_t thread;
+static bool thread_active = false;
+static volatile bool exiting = false;
+
+/* thread only */
+static struct stinger_decoder strip_decoder;
+static struct stinger_decoder preview_decoder;
+static struct thumbnail_set *preview_open_set = NULL;
+static int64_t preview_pos = -1;
+static struct SwsContext *sws = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* images */
+
+static void get_file(struct thumbnail_set *set, char type, int64_t frame,
+		struct dstr *file)
+{
+	dstr_printf(file, "%s/%c%lld.bmp", set->dir, type, (long long)frame);
+}
+
+/* Alpha is shown against a checkerboard */
+static inline uint8_t blend(uint8_t color, uint8_t alpha, uint8_t back)
+{
+	return (uint8_t)((color * alpha + back * (255 - alpha) + 127) / 255);
+}
+
+static inline void put_le(uint8_t *p, uint32_t value, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		p[i] = (uint8_t)(value >> (i * 8));
+}
+
+/* Writes the frame as a 24 bit bottom-up BMP */
+static bool write_bmp(const char *file, const uint8_t *bgra, int linesize,
+		int width, int height)
+{
+	int row_size = (width * 3 + 3) & ~3;
+	uint32_t data_size = (uint32_t)row_size * (uint32_t)height;
+	uint8_t header[54] = {'B', 'M'};
+	uint8_t *row;
+	bool success = true;
+	FILE *f;
+
+	put_le(header + 2, 54 + data_size, 4);
+	put_le(header + 10, 54, 4);
+	put_le(header + 14, 40, 4);
+	put_le(header + 18, (uint32_t)width, 4);
+	put_le(header + 22, (uint32_t)height, 4);
+	put_le(header + 26, 1, 2);
+	put_le(header + 28, 24, 2);
+	put_le(header + 34, data_size, 4);
+
+	f = os_fopen(file, "wb");
+	if (!f)
+		return false;
+
+	row = bzalloc((size_t)row_size);
+	success = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+	for (int y = height - 1; success && y >= 0; y--) {
+		const uint8_t *src = bgra + (size_t)y * linesize;
+
+		for (int x = 0; x < width; x++) {
+			uint8_t back = ((x / 8 + y / 8) & 1) ? 0x66 : 0x99;
+			uint8_t a = src[x * 4 + 3];
+
+			row[x * 3 + 0] = blend(src[x * 4 + 0], a, back);
+			row[x * 3 + 1] = blend(src[x * 4 + 1], a, back);
+			row[x * 3 + 2] = blend(src[x * 4 + 2], a, back);
+		}
+
+		success = fwrite(row, 1, (size_t)row_size, f) ==
+			(size_t)row_size;
+	}
+
+	bfree(row);
+	fclose(f);
+
+	if (!success)
+		os_unlink(file);
+	return success;
+}
+
+/* Converts the decoded frame, already decoded down to size, to BGRA and
+ * saves it */
+static bool save_frame(const AVFrame *frame, const char *file)
+{
+	uint8_t *bgra;
+	int linesize = frame->width * 4;
+	bool success;
+
+	sws = sws_getCachedContext(sws, frame->width, frame->height,
+			frame->format, frame->width, frame->height,
+			AV_PIX_FMT_BGRA, SWS_BILINEAR, NULL, NULL, NULL);
+	if (!sws)
+		return false;
+
+	bgra = bmalloc((size_t)linesize * frame->height);
+	sws_scale(sws, (const uint8_t *const *)frame->data, frame->linesize,
+			0, frame->height, &bgra, &linesize);
+
+	success = write_bmp(file, bgra, linesize, frame->width,
+			frame->height);
+	bfree(bgra);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* generator thread */
+
+static void load_strip(struct thumbnail_set *set, const char *list)
+{
+	char *end;
+
+	while (list && *list) {
+		int64_t frame = strtoll(list, &end, 10);
+		if (end == list)
+			break;
+
+		da_push_back(set->keyframes, &frame);
+		list = *end == ',' ? end + 1 : end;
+	}
+}
+
+/* Finds the set's directory, which changes along with the file, and picks
+ * up a strip finished in an earlier session */
+static bool prepare_set(struct thumbnail_set *set)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	struct dstr name = {0};
+	struct dstr file = {0};
+	struct stat st;
+	char *dir;
+	char *strip;
+
+	if (set->prepared)
+		return !set->failed;
+
+	if (os_stat(set->path, &st) != 0) {
+		pthread_mutex_lock(&mutex);
+		set->prepared = true;
+		set->failed = true;
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+
+	for (const char *c = set->path; *c; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 1099511628211ULL;
+	}
+
+	dstr_printf(&name, "thumbnails/%016llx-%llx-%llx",
+			(unsigned long long)hash,
+			(unsigned long long)st.st_size,
+			(unsigned long long)st.st_mtime);
+	dir = obs_module_config_path(name.array);
+	os_mkdirs(dir);
+
+	dstr_printf(&file, "%s/" STRIP_FILE, dir);
+	strip = os_quick_read_utf8_file(file.array);
+
+	pthread_mutex_lock(&mutex);
+	set->dir = dir;
+	set->prepared = true;
+	if (strip) {
+		load_strip(set, strip);
+		set->complete = true;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	bfree(strip);
+	dstr_free(&file);
+	dstr_free(&name);
+	return true;
+}
+
+static void finish_strip(bool success)
+{
+	struct thumbnail_set *set;
+	struct dstr list = {0};
+	struct dstr file = {0};
+
+	stinger_decoder_close(&strip_decoder);
+
+	pthread_mutex_lock(&mutex);
+	set = strip_set;
+	strip_set = NULL;
+	for (size_t i = 0; i < set->keyframes.num; i++)
+		dstr_catf(&list, i ? ",%lld" : "%lld",
+				(long long)set->keyframes.array[i]);
+	set->complete = success;
+	set->failed = !success;
+	pthread_mutex_unlock(&mutex);
+
+	if (success) {
+		dstr_printf(&file, "%s/" STRIP_FILE, set->dir);
+		os_quick_write_utf8_file(file.array,
+				list.array ? list.array : "", list.len, false);
+		blog(LOG_DEBUG, "stinger: %d keyframe thumbnails of '%s' "
+				"ready", (int)set->keyframes.num, set->path);
+	}
+
+	dstr_free(&file);
+	dstr_free(&list);
+}
+
+static bool start_strip(void)
+{
+	struct stinger_decoder_options options = {
+		.max_width = THUMBNAIL_WIDTH,
+		.max_height = THUMBNAIL_WIDTH * 16,
+		.read_ahead = true
+	};
+
+	pthread_mutex_lock(&mutex);
+	if (strip_queue.num) {
+		strip_set = strip_queue.array[0];
+		da_erase(strip_queue, 0);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (!strip_set)
+		return false;
+
+	if (!prepare_set(strip_set) || strip_set->complete) {
+		pthread_mutex_lock(&mutex);
+		strip_set = NULL;
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+
+	if (!stinger_decoder_open(&strip_decoder, strip_set->path,
+				&options)) {
+		finish_strip(false);
+		return true;
+	}
+
+	/* everything but keyframes is skipped without being decoded */
+	strip_decoder.codec->skip_frame = AVDISCARD_NONKEY;
+	strip_decoder.interrupt = &exiting;
+	return true;
+}
+
+/* Adds one keyframe to the strip being generated; false when there's no
+ * strip to work on */
+static bool step_strip(void)
+{
+	struct dstr file = {0};
+	int64_t frame;
+
+	if (!strip_set && !start_strip())
+		return false;
+	if (!strip_set)
+		return true;
+
+	if (!stinger_decoder_next(&strip_decoder)) {
+		finish_strip(!os_atomic_load_bool(&exiting));
+		return true;
+	}
+
+	frame = strip_decoder.frame_index;
+	get_file(strip_set, 'k', frame, &file);
+
+	if (save_frame(strip_decoder.frame, file.array)) {
+		pthread_mutex_lock(&mutex);
+		da_push_back(strip_set->keyframes, &frame);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	dstr_free(&file);
+	return true;
+}
+
+static bool open_preview_decoder(struct thumbnail_set *set)
+{
+	struct stinger_decoder_options options = {
+		.max_width = PREVIEW_WIDTH,
+		.max_height = PREVIEW_WIDTH * 16,
+		.threading = STINGER_THREADING_SLICE
+	};
+
+	if (preview_open_set == set)
+		return true;
+
+	if (preview_open_set)
+		stinger_decoder_close(&preview_decoder);
+	preview_open_set = NULL;
+	preview_pos = -1;
+
+	if (!stinger_decoder_open(&preview_decoder, set->path, &options))
+		return false;
+
+	preview_decoder.interrupt = &preview_interrupt;
+	preview_open_set = set;
+	return true;
+}
+
+static void add_preview(struct thumbnail_set *set, int64_t frame)
+{
+	pthread_mutex_lock(&mutex);
+	da_push_back(set->previews, &frame);
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Decodes the requested frame, from the last one decoded if it's close
+ * ahead, otherwise from the keyframe before it. Frames past the end of the
+ * clip show its last frame. */
+static void render_preview(struct thumbnail_set *set, int64_t frame)
+{
+	struct dstr file = {0};
+	bool decoded = false;
+
+	if (!prepare_set(set))
+		return;
+
+	get_file(set, 'f', frame, &file);
+	if (os_file_exists(file.array)) {
+		add_preview(set, frame);
+		goto done;
+	}
+
+	if (!open_preview_decoder(set))
+		goto done;
+
+	if ((frame <= preview_pos || frame > preview_pos + MAX_DECODE_AHEAD) &&
+	    !stinger_decoder_seek(&preview_decoder, frame)) {
+		stinger_decoder_close(&preview_decoder);
+		preview_open_set = NULL;
+		goto done;
+	}
+
+	while (stinger_decoder_next(&preview_decoder)) {
+		decoded = true;
+		preview_pos = preview_decoder.frame_index;
+		if (preview_pos >= frame)
+			break;
+	}
+
+	/* a newer request came in, the decoder carries on from here */
+	if (preview_pos < frame && os_atomic_load_bool(&preview_interrupt))
+		goto done;
+
+	if (decoded && save_frame(preview_decoder.frame, file.array))
+		add_preview(set, frame);
+
+	/* the decoder is at the end of the clip */
+	if (preview_pos < frame)
+		preview_pos = -1;
+
+done:
+	dstr_free(&file);
+}
+
+static bool take_preview_request(struct thumbnail_set **set, int64_t *frame)
+{
+	bool pending;
+
+	pthread_mutex_lock(&mutex);
+	pending = preview_pending;
+	*set = preview_set;
+	*frame = preview_frame;
+	preview_pending = false;
+	os_atomic_set_bool(&preview_interrupt, false);
+	pthread_mutex_unlock(&mutex);
+
+	return pending;
+}
+
+static void *thumbnail_thread(void *data)
+{
+	struct thumbnail_set *set;
+	int64_t frame;
+
+	os_set_thread_name("stinger: thumbnails");
+
+	while (!os_atomic_load_bool(&exiting)) {
+		if (take_preview_request(&set, &frame))
+			render_preview(set, frame);
+		else if (!step_strip())
+			os_event_wait(wake);
+	}
+
+	if (strip_set)
+		stinger_decoder_close(&strip_decoder);
+	if (preview_open_set)
+		stinger_decoder_close(&preview_decoder);
+	if (sws)
+		sws_freeContext(sws);
+
+	UNUSED_PARAMETER(data);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void stinger_thumbnails_init(void)
+{
+	pthread_mutex_init(&mutex, NULL);
+	da_init(sets);
+	da_init(strip_queue);
+
+	if (os_event_init(&wake, OS_EVENT_TYPE_AUTO) != 0 ||
+	    pthread_create(&thread, NULL, thumbnail_thread, NULL) != 0) {
+		blog(LOG_WARNING, "stinger: failed to start thumbnail thread, "
+				"thumbnails are disabled");
+		return;
+	}
+
+	thread_active = true;
+}
+
+void stinger_thumbnails_free(void)
+{
+	if (thread_active) {
+		os_atomic_set_bool(&exiting, true);
+		os_atomic_set_bool(&preview_interrupt, true);
+		os_event_signal(wake);
+		pthread_join(thread, NULL);
+		thread_active = false;
+	}
+
+	for (size_t i = 0; i < sets.num; i++) {
+		struct thumbnail_set *set = sets.array[i];
+
+		da_free(set->keyframes);
+		da_free(set->previews);
+		bfree(set->dir);
+		bfree(set->path);
+		bfree(set);
+	}
+
+	da_free(sets);
+	da_free(strip_queue);
+	os_event_destroy(wake);
+	pthread_mutex_destroy(&mutex);
+}
+
+/* Called with the mutex held */
+static struct thumbnail_set *get_set(const char *path, bool create)
+{
+	struct thumbnail_set *set;
+
+	for (size_t i = 0; i < sets.num; i++) {
+		if (strcmp(sets.array[i]->path, path) == 0)
+			return sets.array[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	set = bzalloc(sizeof(*set));
+	set->path = bstrdup(path);
+	da_push_back(sets, &set);
+	return set;
+}
+
+void stinger_thumbnails_request(const char *path)
+{
+	struct thumbnail_set *set;
+	bool queued = false;
+
+	if (!thread_active || !path || !*path)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	set = get_set(path, true);
+	if (!set->complete && !set->failed && set != strip_set &&
+	    da_find(strip_queue, &set, 0) == DARRAY_INVALID) {
+		da_push_back(strip_queue, &set);
+		queued = true;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (queued)
+		os_event_signal(wake);
+}
+
+void stinger_thumbnails_get_strip(const char *path, size_t max,
+		struct dstr *html)
+{
+	struct thumbnail_set *set;
+	struct dstr file = {0};
+	size_t count;
+
+	if (!thread_active || !path || !max)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	set = get_set(path, false);
+	count = set ? set->keyframes.num : 0;
+
+	for (size_t i = 0; i < count && i < max; i++) {
+		size_t index = count <= max ? i : i * (count - 1) / (max - 1);
+
+		get_file(set, 'k', set->keyframes.array[index], &file);
+		dstr_replace(&file, "\\", "/");
+		dstr_catf(html, "<img src=\"%s\"> ", file.array);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	dstr_free(&file);
+}
+
+bool stinger_thumbnails_get_preview(const char *path, int64_t *frame,
+		struct dstr *file)
+{
+	struct thumbnail_set *set;
+	int64_t shown = -1;
+	bool request = false;
+	bool exact;
+
+	if (!thread_active || !path || !*path)
+		return false;
+
+	pthread_mutex_lock(&mutex);
+	set = get_set(path, true);
+
+	exact = da_find(set->previews, frame, 0) != DARRAY_INVALID;
+	if (exact) {
+		shown = *frame;
+	} else {
+		for (size_t i = 0; i < set->keyframes.num; i++) {
+			if (set->keyframes.array[i] <= *frame &&
+			    set->keyframes.array[i] > shown)
+				shown = set->keyframes.array[i];
+		}
+
+		/* the last frame asked for is either queued or being
+		 * decoded already */
+		request = !set->failed &&
+			(preview_set != set || preview_frame != *frame);
+		if (request) {
+			preview_set = set;
+			preview_frame = *frame;
+			preview_pending = true;
+			os_atomic_set_bool(&preview_interrupt, true);
+		}
+	}
+
+	if (shown >= 0)
+		get_file(set, exact ? 'f' : 'k', shown, file);
+	pthread_mutex_unlock(&mutex);
+
+	if (request)
+		os_event_signal(wake);
+
+	if (shown < 0)
+		return false;
+
+	dstr_replace(file, "\\", "/");
+	*frame = shown;
+	return true;
+}
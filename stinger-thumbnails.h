@@ -0,0 +1,34 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/dstr.h>
+
+/* Thumbnails of stinger files for the properties dialog: a strip made from
+ * the clip's keyframes only, and previews of single frames, found by seeking
+ * to the keyframe before them. A background thread decodes them at a small
+ * size and writes them as images to the plugin config directory, next to
+ * the probe cache, where they're reused until the file changes. Previews
+ * take precedence over the strip, and a newer preview request cuts short
+ * the one being decoded.
+ *
+ * The lookups only consult what the thread has already finished; they
+ * never touch the disk or wait, so they're safe to call from the UI while
+ * a slider is being dragged. Frames are counted from 0. */
+
+extern void stinger_thumbnails_init(void);
+extern void stinger_thumbnails_free(void);
+
+/* Starts on path's keyframe strip, unless it's cached or on its way */
+extern void stinger_thumbnails_request(const char *path);
+
+/* Appends <img> tags for up to max of the strip's thumbnails finished so
+ * far, spread evenly over the clip */
+extern void stinger_thumbnails_get_strip(const char *path, size_t max,
+		struct dstr *html);
+
+/* Image file showing frame: the frame itself if it has been decoded, else
+ * the closest keyframe before it, with frame set to the one shown. Queues
+ * decoding the frame itself when it's missing. False if there's nothing to
+ * show yet. */
+extern bool stinger_thumbnails_get_preview(const char *path, int64_t *frame,
+		struct dstr *file);
@@ -0,0 +1,261 @@
+#include <obs-module.h>
+#include <util/darray.h>
+#include <util/platform.h>
+
+#include "stinger-warmup.h"
+
+static pthread_mutex_t queue_mutex;
+static DARRAY(struct stinger_warmup *) queue;
+static os_sem_t *queued = NULL;
+static pthread_t threads[STINGER_WARMUP_MAX_THREADS];
+static size_t thread_count = 0;
+static long concurrency = 1;
+static long running = 0;
+static uint64_t settle_ns = 0;
+static volatile bool exiting = false;
+
+/* manual reset: signaled when the queue is hurried or the threads exit,
+ * reset (under the mutex) whenever settle_ns moves later */
+static os_event_t *settled = NULL;
+
+/* Waits until nothing has been queued for a while */
+static void wait_settled(void)
+{
+	uint64_t now, until;
+
+	while (!os_atomic_load_bool(&exiting)) {
+		pthread_mutex_lock(&queue_mutex);
+		until = settle_ns;
+		pthread_mutex_unlock(&queue_mutex);
+
+		now = os_gettime_ns();
+		if (now >= until)
+			break;
+
+		os_event_timedwait(settled,
+				(unsigned long)((until - now) / 1000000) + 1);
+	}
+}
+
+/* The next item, unless as many as allowed are running already */
+static struct stinger_warmup *take_item(void)
+{
+	struct stinger_warmup *w = NULL;
+
+	pthread_mutex_lock(&queue_mutex);
+	if (queue.num && running < concurrency) {
+		w = queue.array[0];
+		da_erase(queue, 0);
+		os_atomic_set_long(&w->state, STINGER_WARMUP_RUNNING);
+		running++;
+	}
+	pthread_mutex_unlock(&queue_mutex);
+
+	return w;
+}
+
+static void finish_item(struct stinger_warmup *w)
+{
+	bool more;
+
+	pthread_mutex_lock(&queue_mutex);
+	os_atomic_set_long(&w->state, STINGER_WARMUP_DONE);
+	running--;
+	more = queue.num != 0;
+	pthread_mutex_unlock(&queue_mutex);
+
+	/* whoever waits on w may free it as soon as this is signalled */
+	os_event_signal(w->finished);
+
+	/* a thread that found no room for the next item gave up on it */
+	if (more)
+		os_sem_post(queued);
+}
+
+static void *warmup_thread(void *data)
+{
+	struct stinger_warmup *w;
+
+	os_set_thread_name("stinger: warm-up");
+
+	for (;;) {
+		os_sem_wait(queued);
+		if (os_atomic_load_bool(&exiting))
+			break;
+
+		wait_settled();
+
+		w = take_item();
+		if (w) {
+			w->work(w->param);
+			finish_item(w);
+		}
+	}
+
+	UNUSED_PARAMETER(data);
+	return NULL;
+}
+
+/* Starts threads up to the concurrency, called with the mutex held */
+static void start_threads(void)
+{
+	while (thread_count < (size_t)concurrency) {
+		if (pthread_create(&threads[thread_count], NULL,
+					warmup_thread, NULL) != 0) {
+			blog(LOG_WARNING, "stinger: failed to start warm-up "
+					"thread");
+			break;
+		}
+		thread_count++;
+	}
+}
+
+void stinger_warmup_init(void)
+{
+	pthread_mutex_init(&queue_mutex, NULL);
+	da_init(queue);
+
+	if (os_sem_init(&queued, 0) != 0 ||
+	    os_event_init(&settled, OS_EVENT_TYPE_MANUAL) != 0) {
+		blog(LOG_WARNING, "stinger: failed to set up warm-ups, "
+				"transitions will warm up as they're "
+				"created");
+		os_sem_destroy(queued);
+		queued = NULL;
+		settled = NULL;
+	}
+}
+
+void stinger_warmup_free(void)
+{
+	os_atomic_set_bool(&exiting, true);
+	if (settled)
+		os_event_signal(settled);
+
+	for (size_t i = 0; i < thread_count; i++)
+		os_sem_post(queued);
+	for (size_t i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	thread_count = 0;
+
+	os_sem_destroy(queued);
+	queued = NULL;
+	if (settled)
+		os_event_destroy(settled);
+	settled = NULL;
+	da_free(queue);
+	pthread_mutex_destroy(&queue_mutex);
+}
+
+void stinger_warmup_set_concurrency(int count)
+{
+	long added;
+
+	if (count < 1)
+		count = 1;
+	if (count > STINGER_WARMUP_MAX_THREADS)
+		count = STINGER_WARMUP_MAX_THREADS;
+
+	pthread_mutex_lock(&queue_mutex);
+	added = count - concurrency;
+	concurrency = count;
+	if (queue.num && queued)
+		start_threads();
+	pthread_mutex_unlock(&queue_mutex);
+
+	/* only the threads that may run now and couldn't before need a
+	 * wake-up; most updates leave the concurrency as it was */
+	if (queued)
+		for (long i = 0; i < added; i++)
+			os_sem_post(queued);
+}
+
+void stinger_warmup_item_init(struct stinger_warmup *w,
+		stinger_work_t work, void *param)
+{
+	w->work = work;
+	w->param = param;
+	w->state = STINGER_WARMUP_IDLE;
+
+	if (os_event_init(&w->finished, OS_EVENT_TYPE_MANUAL) != 0)
+		w->finished = NULL;
+	else
+		os_event_signal(w->finished);
+}
+
+void stinger_warmup_item_free(struct stinger_warmup *w)
+{
+	stinger_warmup_cancel(w);
+	if (w->finished)
+		os_event_wait(w->finished);
+	os_event_destroy(w->finished);
+	w->finished = NULL;
+}
+
+void stinger_warmup_queue(struct stinger_warmup *w)
+{
+	long state;
+
+	if (!queued || !w->finished) {
+		w->work(w->param);
+		os_atomic_set_long(&w->state, STINGER_WARMUP_DONE);
+		return;
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	state = os_atomic_load_long(&w->state);
+	if (state != STINGER_WARMUP_QUEUED && state != STINGER_WARMUP_RUNNING) {
+		os_atomic_set_long(&w->state, STINGER_WARMUP_QUEUED);
+		os_event_reset(w->finished);
+		da_push_back(queue, &w);
+		settle_ns = os_gettime_ns() +
+			(uint64_t)STINGER_WARMUP_SETTLE_MS * 1000000ULL;
+		os_event_reset(settled);
+		start_threads();
+	}
+	pthread_mutex_unlock(&queue_mutex);
+
+	os_sem_post(queued);
+}
+
+void stinger_warmup_hurry(struct stinger_warmup *w)
+{
+	bool queued_item;
+
+	pthread_mutex_lock(&queue_mutex);
+	queued_item = os_atomic_load_long(&w->state) == STINGER_WARMUP_QUEUED;
+	if (queued_item) {
+		da_erase_item(queue, &w);
+		da_insert(queue, 0, &w);
+
+		/* something is being used, the load is over */
+		settle_ns = os_gettime_ns();
+		os_event_signal(settled);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+
+	if (queued_item)
+		os_sem_post(queued);
+}
+
+void stinger_warmup_cancel(struct stinger_warmup *w)
+{
+	long state;
+
+	pthread_mutex_lock(&queue_mutex);
+	state = os_atomic_load_long(&w->state);
+
+	if (state == STINGER_WARMUP_QUEUED) {
+		da_erase_item(queue, &w);
+		os_atomic_set_long(&w->state, STINGER_WARMUP_IDLE);
+		pthread_mutex_unlock(&queue_mutex);
+		os_event_signal(w->finished);
+	} else {
+		pthread_mutex_unlock(&queue_mutex);
+	}
+}
+
+enum stinger_warmup_state stinger_warmup_get_state(struct stinger_warmup *w)
+{
+	return (enum stinger_warmup_state)os_atomic_load_long(&w->state);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/threading.h>
+
+#include "stinger-worker.h"
+
+/* Deferred start-up work of stinger transitions. Loading a scene
+ * collection only reads each transition's settings; the slow part
+ * (probing its file, mapping its pack, filling its frame cache) is queued
+ * here. It starts once no more has been queued for
+ * STINGER_WARMUP_SETTLE_MS, so it doesn't compete with the rest of the
+ * load, and runs on up to the configured number of threads at a time.
+ * A transition activated before its turn comes is moved to the front of
+ * the queue, and is shown without its clip until the work is done. */
+
+#define STINGER_WARMUP_SETTLE_MS 2000
+#define STINGER_WARMUP_MAX_THREADS 8
+
+enum stinger_warmup_state {
+	STINGER_WARMUP_IDLE,
+	STINGER_WARMUP_QUEUED,
+	STINGER_WARMUP_RUNNING,
+	STINGER_WARMUP_DONE
+};
+
+/* One transition's work, embedded in the transition */
+struct stinger_warmup {
+	stinger_work_t work;
+	void *param;
+	volatile long state;
+	os_event_t *finished;
+};
+
+extern void stinger_warmup_init(void);
+extern void stinger_warmup_free(void);
+
+/* How many warm-ups may run at once, between 1 and
+ * STINGER_WARMUP_MAX_THREADS */
+extern void stinger_warmup_set_concurrency(int count);
+
+extern void stinger_warmup_item_init(struct stinger_warmup *w,
+		stinger_work_t work, void *param);
+
+/* Cancels w, waiting for it if it's running; the caller makes sure the
+ * work gives up quickly */
+extern void stinger_warmup_item_free(struct stinger_warmup *w);
+
+extern void stinger_warmup_queue(struct stinger_warmup *w);
+
+/* Moves w to the front of the queue and starts the queue without waiting
+ * for it to settle, if w is still queued. Doesn't wait for w. */
+extern void stinger_warmup_hurry(struct stinger_warmup *w);
+
+/* Takes w off the queue if it hasn't started. One that's running is left
+ * to finish without being waited for; its work has to tell for itself
+ * that it's stale. */
+extern void stinger_warmup_cancel(struct stinger_warmup *w);
+
+extern enum stinger_warmup_state stinger_warmup_get_state(
+		struct stinger_warmup *w);
@@ -0,0 +1,117 @@
+#include <obs-module.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+#include <util/platform.h>
+
+#include "stinger-worker.h"
+
+struct work_item {
+	stinger_work_t work;
+	void *param;
+};
+
+static pthread_mutex_t queue_mutex;
+static struct circlebuf queue;
+static os_sem_t *queued = NULL;
+static pthread_t thread;
+static bool thread_active = false;
+static volatile bool exiting = false;
+
+static bool pop_item(struct work_item *item)
+{
+	bool found;
+
+	pthread_mutex_lock(&queue_mutex);
+	found = queue.size != 0;
+	if (found)
+		circlebuf_pop_front(&queue, item, sizeof(*item));
+	pthread_mutex_unlock(&queue_mutex);
+
+	return found;
+}
+
+static void *worker_thread(void *data)
+{
+	struct work_item item;
+
+	os_set_thread_name("stinger: worker");
+
+	for (;;) {
+		os_sem_wait(queued);
+
+		if (pop_item(&item))
+			item.work(item.param);
+		else if (os_atomic_load_bool(&exiting))
+			break;
+	}
+
+	UNUSED_PARAMETER(data);
+	return NULL;
+}
+
+void stinger_worker_init(void)
+{
+	pthread_mutex_init(&queue_mutex, NULL);
+
+	if (os_sem_init(&queued, 0) != 0 ||
+	    pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
+		blog(LOG_WARNING, "stinger: failed to start worker thread, "
+				"work will run on the calling thread");
+		return;
+	}
+
+	thread_active = true;
+}
+
+void stinger_worker_free(void)
+{
+	if (thread_active) {
+		os_atomic_set_bool(&exiting, true);
+		os_sem_post(queued);
+		pthread_join(thread, NULL);
+		thread_active = false;
+	}
+
+	os_sem_destroy(queued);
+	queued = NULL;
+	circlebuf_free(&queue);
+	pthread_mutex_destroy(&queue_mutex);
+}
+
+void stinger_worker_queue(stinger_work_t work, void *param)
+{
+	struct work_item item = {work, param};
+
+	if (!thread_active) {
+		work(param);
+		return;
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	circlebuf_push_back(&queue, &item, sizeof(item));
+	pthread_mutex_unlock(&queue_mutex);
+
+	os_sem_post(queued);
+}
+
+static void signal_flushed(void *param)
+{
+	os_event_signal(param);
+}
+
+void stinger_worker_flush(void)
+{
+	os_event_t *flushed;
+
+	if (!thread_active)
+		return;
+
+	if (os_event_init(&flushed, OS_EVENT_TYPE_MANUAL) != 0) {
+		blog(LOG_ERROR, "stinger: failed to wait for the worker");
+		return;
+	}
+
+	stinger_worker_queue(signal_flushed, flushed);
+	os_event_wait(flushed);
+	os_event_destroy(flushed);
+}
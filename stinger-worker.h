@@ -0,0 +1,22 @@
+#pragma once
+
+#include <util/c99defs.h>
+
+/* Module-wide worker thread for slow work the graphics and UI threads
+ * mustn't wait on: starting and tearing down decoders and loading images
+ * from disk. Probes, which can take far longer, get threads of their own
+ * (see stinger-probe-job.h) so they don't hold these up. Work items run one at a
+ * time, in the order they were queued, so an item can rely on everything
+ * queued before it having finished. */
+
+typedef void (*stinger_work_t)(void *param);
+
+extern void stinger_worker_init(void);
+
+/* Runs whatever is still queued, then stops the thread */
+extern void stinger_worker_free(void);
+
+extern void stinger_worker_queue(stinger_work_t work, void *param);
+
+/* Blocks until every item queued so far has run */
+extern void stinger_worker_flush(void);
@@ -1,6 +1,14 @@
 #include <obs-module.h>
 #include <obs-frontend-api.h>
 
+#include "stinger-cache-registry.h"
+#include "stinger-convert.h"
+#include "stinger-meta-cache.h"
+#include "stinger-threadpool.h"
+#include "stinger-thumbnails.h"
+#include "stinger-warmup.h"
+#include "stinger-worker.h"
+
 OBS_DECLARE_MODULE()
 
 OBS_MODULE_USE_DEFAULT_LOCALE("obs-transitions", "en-US") //might be useful in future but not used right now
@@ -9,11 +17,24 @@ extern struct obs_source_info stinger_transition;
 
 bool obs_module_load(void)
 {
+	stinger_threadpool_global_init();
+	stinger_worker_init();
+	stinger_convert_init();
+	stinger_meta_cache_init();
+	stinger_cache_registry_init();
+	stinger_thumbnails_init();
+	stinger_warmup_init();
 	obs_register_source(&stinger_transition);
 	return true;
 }
 
 bool obs_module_unload()
 {
+	stinger_warmup_free();
+	stinger_thumbnails_free();
+	stinger_worker_free();
+	stinger_cache_registry_free();
+	stinger_meta_cache_free();
+	stinger_threadpool_global_free();
 	return true;
 }
\ No newline at end of file
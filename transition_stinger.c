@@ -2,13 +2,26 @@
 #include <obs-internal.h>
 #include <graphics/image-file.h>
 #include <util/dstr.h>
-#include <libswscale/swscale.h>
+#include <util/threading.h>
+#include <util/platform.h>
 #include <media-io/audio-resampler.h>
 
 #include "obs-ffmpeg-compat.h"
 #include "obs-ffmpeg-formats.h"
 
-#include <libff/ff-demuxer.h>
+#include "stinger-audio-ring.h"
+#include "stinger-cache-prefetch.h"
+#include "stinger-cache-registry.h"
+#include "stinger-matte.h"
+#include "stinger-meta-cache.h"
+#include "stinger-pack.h"
+#include "stinger-playback.h"
+#include "stinger-probe-job.h"
+#include "stinger-telemetry.h"
+#include "stinger-texture-ring.h"
+#include "stinger-thumbnails.h"
+#include "stinger-warmup.h"
+#include "stinger-worker.h"
 
 //#include <windows.h>
 //
@@ -26,35 +39,159 @@
 
 
 
+#define STINGER_AUDIO_BUFFER_SECONDS 2
+
 struct stinger_info {
 	obs_source_t *source;
 
+	/* loaded by the first render */
 	gs_effect_t *effect;
+	bool effect_failed;
 	gs_eparam_t *ep_a_tex;
 	gs_eparam_t *ep_b_tex;
+	gs_eparam_t *ep_y_tex;
+	gs_eparam_t *ep_u_tex;
+	gs_eparam_t *ep_v_tex;
+	gs_eparam_t *ep_color_matrix;
+	gs_eparam_t *ep_color_range_min;
+	gs_eparam_t *ep_color_range_max;
+	gs_eparam_t *ep_frame_size;
+	gs_eparam_t *ep_color_rect;
+	gs_eparam_t *ep_matte_rect;
+	gs_eparam_t *ep_matte_tex;
+	gs_eparam_t *ep_matte_weights;
+	gs_eparam_t *ep_matte_levels;
 
 	float lastTime;
 
-	gs_texture_t *stinger_texture;
-	gs_image_file_t stinger_error_image;
+	struct stinger_texture_ring texture_ring;
 
-	struct obs_source_audio *audio_data;
+	/* alpha from a track matte instead of the video, the matte file is
+	 * decoded alongside the stinger and paired with it by frame */
+	enum stinger_matte_layout matte_layout;
+	const char *matte_path;
+	struct stinger_playback *matte_playback;
+	struct stinger_matte_sync matte_sync;
+	struct stinger_texture_ring matte_ring;
+
+	/* loaded on the worker the first time it's needed */
+	gs_image_file_t stinger_error_image;
+	volatile bool error_image_requested;
+	volatile bool error_image_ready;
 
 	float cutTime;
 	size_t cutFrame;
-	bool validInput;
+	volatile bool validInput;
 
 	char *path;
 	size_t curFrame;
 	size_t numberOfFrames;
 
-	struct ff_demuxer *demuxer;
-	struct SwsContext *sws_ctx;
-	int sws_width;
-	int sws_height;
-	enum AVPixelFormat sws_format;
-	uint8_t *sws_data;
-	int sws_linesize;
+	/* frames played: from the trim-in point up to the frame before the
+	 * trim-out point. Frames keep their number in the file. */
+	size_t first_frame;
+	size_t end_frame;
+
+	/* start of every frame and the end of the last one in us, and the
+	 * probe's frame index for the decoder; set by the warm-up, the
+	 * measure job or update while render uses them */
+	DARRAY(int64_t) frame_times;
+	DARRAY(struct stinger_index_entry) index;
+	pthread_mutex_t timing_mutex;
+
+	/* probe of a newly picked file for the properties dialog, and the
+	 * coverage measurement for its cut frame when that needs a pass of
+	 * its own. A finished coverage job stays until something else is
+	 * measured, so a failed one isn't started over on every refresh. */
+	struct stinger_probe_job *probe_job;
+	struct stinger_probe_job *coverage_job;
+
+	/* the first update only reads the settings, the rest of the set-up
+	 * waits for the warm-up. It works from a copy of the settings it
+	 * needs, which it takes over when it starts (under the timing
+	 * mutex), and an update gives up on it through warm_abort instead
+	 * of waiting for it. A transition started before the warm-up is
+	 * done plays without the clip. */
+	struct stinger_warmup warmup;
+	struct warm_job *warm_job;
+	struct stinger_probe_abort warm_abort;
+	bool initialized;
+	bool transition_warm;
+
+	/* the clip's length, and the size and modification time of the file
+	 * it was measured from, saved with the settings so the next load
+	 * knows it without probing unless the file changed. Published by
+	 * the warm-up under the timing mutex, along with the fixed duration
+	 * it leaves for the UI thread to apply (0 when none is pending). */
+	uint32_t duration_ms;
+	int64_t duration_file_size;
+	int64_t duration_file_mtime;
+	uint32_t pending_fixed_ms;
+
+	/* updates after the first one probe on a measure job. Each update
+	 * counts up the generation (under the timing mutex), which drops
+	 * what the job or the warm-up still measures for an earlier one;
+	 * the warm-up reads it atomically under the cache mutex too. The
+	 * frame count the measure job probed for a file the properties dialog
+	 * didn't get to waits for save to write it back (0 when none did). */
+	volatile long update_generation;
+	volatile bool measuring;
+	size_t pending_frames;
+
+	/* the measurement of the latest update, on a probe job's thread so
+	 * a slow file doesn't hold up the worker; the job and what it was
+	 * started for are protected by the timing mutex */
+	struct stinger_probe_job *measure_job;
+	long measure_generation;
+	bool measure_probe_frames;
+
+	/* plays the clip in this long instead, 0 for its own length. Frames
+	 * are still picked by the share of the transition gone by, so the cut
+	 * frame lands at the same point of the shorter transition. */
+	uint32_t target_duration_ms;
+
+	struct stinger_playback *playback;
+	long playback_clip;
+	long last_clip;
+	bool playback_video;
+	bool playback_primed;
+	volatile bool reset_playback;
+	bool prime_decoder;
+	size_t preroll_frames;
+	int decoder_threads;
+	enum stinger_decoder_threading decoder_threading;
+	int64_t presented_frame;
+	int64_t scheduled_frame;
+	uint64_t frames_presented;
+	uint64_t frames_late;
+	uint64_t frames_dropped;
+	uint64_t render_time_total;
+	uint64_t render_time_max;
+	uint64_t frames_rendered;
+
+	/* histograms for the proc handler, only filled in when enabled */
+	bool telemetry_enabled;
+	struct stinger_telemetry telemetry;
+	uint64_t transition_start_ns;
+	bool first_frame_pending;
+	bool cut_recorded;
+
+	/* clip to play and its start, published to the audio thread through
+	 * the sequence counter: odd while being written */
+	struct stinger_audio_ring audio_ring;
+	volatile long audio_sequence;
+	long audio_clip;
+	uint64_t audio_start_ts;
+	volatile long audio_underruns;
+
+	/* audio thread only */
+	long audio_seen_sequence;
+	long audio_playing_clip;
+	long audio_clip_base;
+	uint64_t audio_clip_start_ts;
+	bool audio_base_known;
+	bool audio_playing;
+	float audio_mix[MAX_AUDIO_CHANNELS][AUDIO_OUTPUT_FRAMES];
 
 	enum AVDiscard frame_drop;
 	enum video_range_type range;
@@ -66,7 +203,37 @@ struct stinger_info {
 	bool is_hw_decoding;
 	bool is_clear_on_media_end;
 	bool restart_on_activate;
-	
+	bool scale_to_output;
+
+	/* the entry is swapped by update while render uses it */
+	bool use_frame_cache;
+	enum stinger_cache_storage cache_storage;
+	struct stinger_cache_entry *cache_entry;
+	pthread_mutex_t cache_mutex;
+	size_t cache_frame;
+
+	/* unpacks compact cached frames, set up by render */
+	struct stinger_cache_prefetch *cache_prefetch;
+	const struct stinger_frame_cache *prefetch_cache;
+
+	/* exported frame pack, preferred over the cache; swapped under the
+	 * cache mutex too, along with the path of the clip a pack is wanted
+	 * for (NULL when none is), which the export thread checks before it
+	 * installs the pack it made */
+	bool use_pack;
+	bool pack_compressed;
+	struct stinger_pack *pack;
+	char *pack_source;
+	uint32_t pack_max_width;
+	uint32_t pack_max_height;
+	pthread_t export_thread;
+	bool export_thread_active;
+	volatile bool export_done;
+	volatile bool export_abort;
+	char *export_path;
+	bool export_compressed;
+	uint32_t export_max_width;
+	uint32_t export_max_height;
 };
 
 static const char *stinger_get_name(void *type_data)
@@ -75,250 +242,653 @@ static const char *stinger_get_name(void *type_data)
 	return obs_module_text("StingerTransition");
 }
 
-bool update_sws_context(struct stinger_info *s, AVFrame *frame)
+/* A matte file layout without a file falls back to the video's alpha */
+static inline enum stinger_matte_layout get_matte_layout(
+		struct stinger_info *s)
 {
-	if (frame->width != s->sws_width
-		|| frame->height != s->sws_height
-		|| frame->format != s->sws_format) {
-		if (s->sws_ctx != NULL)
-			sws_freeContext(s->sws_ctx);
+	if (s->matte_layout == STINGER_MATTE_FILE &&
+	    (!s->matte_path || !*s->matte_path))
+		return STINGER_MATTE_NONE;
+	return s->matte_layout;
+}
 
-		if (frame->width <= 0 || frame->height <= 0) {
-			blog(LOG_ERROR, "unable to create a sws "
-				"context that has a width(%d) or "
-				"height(%d) of zero.", frame->width,
-				frame->height);
-			goto fail;
-		}
+/* Size frames are fitted into when they're decoded at the output size,
+ * 0 for the clip's own size. Packed mattes take twice the room along the
+ * side they're packed on. */
+static void get_decode_size(struct stinger_info *s, uint32_t *width,
+		uint32_t *height)
+{
+	struct obs_video_info ovi;
 
-		s->sws_ctx = sws_getContext(
-			frame->width,
-			frame->height,
-			frame->format,
-			frame->width,
-			frame->height,
-			AV_PIX_FMT_BGRA,
-			SWS_BILINEAR,
-			NULL, NULL, NULL);
-
-		if (s->sws_ctx == NULL) {
-			blog(LOG_ERROR, "unable to create sws "
-				"context with src{w:%d,h:%d,f:%d}->"
-				"dst{w:%d,h:%d,f:%d}",
-				frame->width, frame->height,
-				frame->format, frame->width,
-				frame->height, AV_PIX_FMT_BGRA);
-			goto fail;
+	*width = 0;
+	*height = 0;
 
-		}
+	if (!s->scale_to_output || !obs_get_video_info(&ovi))
+		return;
 
-		if (s->sws_data != NULL)
-			bfree(s->sws_data);
-		s->sws_data = bzalloc(frame->width * frame->height * 4);
-		if (s->sws_data == NULL) {
-			blog(LOG_ERROR, "unable to allocate sws "
-				"pixel data with size %d",
-				frame->width * frame->height * 4);
-			goto fail;
-		}
+	*width = ovi.base_width;
+	*height = ovi.base_height;
 
-		s->sws_linesize = frame->width * 4;
-		s->sws_width = frame->width;
-		s->sws_height = frame->height;
-		s->sws_format = frame->format;
-	}
+	if (s->matte_layout == STINGER_MATTE_SIDE_BY_SIDE)
+		*width *= 2;
+	else if (s->matte_layout == STINGER_MATTE_STACKED)
+		*height *= 2;
+}
 
-	return true;
+static inline struct stinger_telemetry *get_telemetry(struct stinger_info *s)
+{
+	return s->telemetry_enabled ? &s->telemetry : NULL;
+}
+
+/* Called with the cache mutex held, returns the entry replaced */
+static struct stinger_cache_entry *swap_frame_cache(struct stinger_info *s,
+		struct stinger_cache_entry *entry)
+{
+	struct stinger_cache_entry *prev = s->cache_entry;
 
-fail:
-	if (s->sws_ctx != NULL)
-		sws_freeContext(s->sws_ctx);
-	s->sws_ctx = NULL;
+	s->cache_entry = entry;
+	s->cache_frame = (size_t)-1;
+	stinger_cache_prefetch_set_cache(s->cache_prefetch, NULL);
+	s->prefetch_cache = NULL;
+	return prev;
+}
 
-	if (s->sws_data)
-		bfree(s->sws_data);
-	s->sws_data = NULL;
+static void set_frame_cache(struct stinger_info *s,
+		struct stinger_cache_entry *entry)
+{
+	struct stinger_cache_entry *prev;
 
-	s->sws_linesize = 0;
-	s->sws_width = 0;
-	s->sws_height = 0;
-	s->sws_format = 0;
+	pthread_mutex_lock(&s->cache_mutex);
+	prev = swap_frame_cache(s, entry);
+	pthread_mutex_unlock(&s->cache_mutex);
 
-	return false;
+	stinger_cache_registry_release(prev);
 }
 
-static void setNextFrameTexture(struct stinger_info *stinger, AVFrame *frame)
+/* The new entry is acquired before the old one is released, so an update
+ * that keeps the same file doesn't drop (or restart) its cached frames.
+ * Clips played from a pack don't need one, and clips with a matte file
+ * are always decoded so the matte stays in step. */
+static void start_frame_cache(struct stinger_info *s)
 {
-	if (!stinger)
-		return;
+	uint32_t width, height;
 
-	obs_enter_graphics();
-	gs_texture_destroy(stinger->stinger_texture);
-	stinger->stinger_texture = gs_texture_create(
-		frame->width, frame->height, 5, 1, //5 is AV_PIX_FMT_BGRA
-		(const uint8_t**)&frame->data, 0);
-	obs_leave_graphics();
+	get_decode_size(s, &width, &height);
+	set_frame_cache(s, s->use_frame_cache && s->validInput && !s->pack &&
+			get_matte_layout(s) != STINGER_MATTE_FILE ?
+			stinger_cache_registry_acquire(s->path,
+				s->cache_storage, width, height) : NULL);
+}
+
+static void stop_frame_cache(struct stinger_info *s)
+{
+	set_frame_cache(s, NULL);
+}
+
+/* Called with the cache mutex held, returns the pack replaced */
+static struct stinger_pack *swap_frame_pack(struct stinger_info *s,
+		struct stinger_pack *pack)
+{
+	struct stinger_pack *prev = s->pack;
 
-	stinger->curFrame++;
+	s->pack = pack;
+	s->cache_frame = (size_t)-1;
+	stinger_cache_prefetch_set_cache(s->cache_prefetch, NULL);
+	s->prefetch_cache = NULL;
+	return prev;
+}
+
+static void set_frame_pack(struct stinger_info *s, struct stinger_pack *pack)
+{
+	struct stinger_pack *prev;
+
+	pthread_mutex_lock(&s->cache_mutex);
+	prev = swap_frame_pack(s, pack);
+	pthread_mutex_unlock(&s->cache_mutex);
 
-	av_frame_free(&frame);
+	stinger_pack_close(prev);
 }
 
+/* Only maps the file, so it's cheap enough to redo on every update */
+static void load_frame_pack(struct stinger_info *s)
+{
+	bool wanted = s->use_pack && s->validInput &&
+		get_matte_layout(s) != STINGER_MATTE_FILE;
+	char *source = wanted ? bstrdup(s->path) : NULL;
+	uint32_t width, height;
+
+	get_decode_size(s, &width, &height);
+
+	pthread_mutex_lock(&s->cache_mutex);
+	bfree(s->pack_source);
+	s->pack_source = source;
+	s->pack_max_width = width;
+	s->pack_max_height = height;
+	pthread_mutex_unlock(&s->cache_mutex);
+
+	set_frame_pack(s, wanted ? stinger_pack_open(s->path, width, height) :
+			NULL);
+}
 
-static bool video_frame_scale(struct ff_frame *frame,
-struct stinger_info *s, AVFrame *pFrame)
+/* Packs are made for the size frames are decoded at; once the output
+ * size changes the pack in use no longer fits and is dropped until one is
+ * exported for the new size. Only compares, so it's fine on any thread. */
+static void drop_stale_pack(struct stinger_info *s)
 {
-	if (!update_sws_context(s, frame->frame))
-	{
-		av_frame_free(&pFrame);
+	struct stinger_pack *prev = NULL;
+	uint32_t width, height;
+
+	get_decode_size(s, &width, &height);
+
+	pthread_mutex_lock(&s->cache_mutex);
+	s->pack_max_width = width;
+	s->pack_max_height = height;
+	if (s->pack && (s->pack->max_width != width ||
+	                s->pack->max_height != height))
+		prev = swap_frame_pack(s, NULL);
+	pthread_mutex_unlock(&s->cache_mutex);
+
+	stinger_pack_close(prev);
+}
+
+/* The export thread only reads what it was handed; the pack it made is
+ * installed if a pack of that clip at that size is still wanted */
+static void install_exported_pack(struct stinger_info *s, const char *path)
+{
+	struct stinger_pack *pack = stinger_pack_open(path,
+			s->export_max_width, s->export_max_height);
+
+	pthread_mutex_lock(&s->cache_mutex);
+	if (pack && s->pack_source && strcmp(s->pack_source, path) == 0 &&
+	    s->pack_max_width == pack->max_width &&
+	    s->pack_max_height == pack->max_height)
+		pack = swap_frame_pack(s, pack);
+	pthread_mutex_unlock(&s->cache_mutex);
+
+	stinger_pack_close(pack);
+}
+
+static void *export_thread(void *data)
+{
+	struct stinger_info *s = data;
+
+	os_set_thread_name("stinger: pack export");
+
+	if (stinger_pack_export(s->export_path, s->export_compressed,
+				s->export_max_width, s->export_max_height,
+				&s->export_abort))
+		install_exported_pack(s, s->export_path);
+
+	os_atomic_set_bool(&s->export_done, true);
+	return NULL;
+}
+
+static void stop_pack_export(struct stinger_info *s)
+{
+	if (s->export_thread_active) {
+		os_atomic_set_bool(&s->export_abort, true);
+		pthread_join(s->export_thread, NULL);
+		s->export_thread_active = false;
+	}
+
+	bfree(s->export_path);
+	s->export_path = NULL;
+}
+
+static bool export_pack_clicked(obs_properties_t *props,
+		obs_property_t *property, void *data)
+{
+	struct stinger_info *s = data;
+
+	if (s->export_thread_active && !os_atomic_load_bool(&s->export_done))
+		return false;
+
+	stop_pack_export(s);
+	if (!s->validInput)
 		return false;
+
+	s->export_path = bstrdup(s->path);
+	s->export_compressed = s->pack_compressed;
+	get_decode_size(s, &s->export_max_width, &s->export_max_height);
+	s->export_abort = false;
+	s->export_done = false;
+
+	if (pthread_create(&s->export_thread, NULL, export_thread, s) != 0)
+		blog(LOG_WARNING, "stinger: failed to create pack export "
+				"thread");
+	else
+		s->export_thread_active = true;
+
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(property);
+	return false;
+}
+
+static void touch_frame_cache(struct stinger_info *s)
+{
+	pthread_mutex_lock(&s->cache_mutex);
+	if (s->cache_entry)
+		stinger_cache_entry_touch(s->cache_entry);
+	pthread_mutex_unlock(&s->cache_mutex);
+}
+
+/* Maps transition time t onto the frames between the trim points. With
+ * the frame times from the index this holds for variable frame rates too,
+ * without them frames are taken to be evenly spaced. */
+static int64_t get_target_frame(struct stinger_info *s, float t)
+{
+	int64_t first = (int64_t)s->first_frame;
+	int64_t end = (int64_t)s->end_frame;
+	const int64_t *times;
+	int64_t target, low, high, mid;
+	int64_t frame;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	if (s->frame_times.num > (size_t)end) {
+		times = s->frame_times.array;
+		target = times[first] + (int64_t)((double)t *
+				(double)(times[end] - times[first]));
+
+		/* the last frame starting at or before target */
+		low = first;
+		high = end;
+		while (high - low > 1) {
+			mid = low + (high - low) / 2;
+			if (times[mid] <= target)
+				low = mid;
+			else
+				high = mid;
+		}
+		frame = low;
+	} else {
+		frame = first + (int64_t)(t * (float)(end - first));
 	}
-	
-	sws_scale(
-		s->sws_ctx,
-		(uint8_t const *const *)frame->frame->data,
-		frame->frame->linesize,
-		0,
-		frame->frame->height,
-		&s->sws_data,
-		&s->sws_linesize
-		);
-
-	pFrame->data[0] = s->sws_data;
-	pFrame->linesize[0] = s->sws_linesize;
-	pFrame->format = AV_PIX_FMT_BGRA;
-
-	setNextFrameTexture(s, pFrame);
+	pthread_mutex_unlock(&s->timing_mutex);
 
-	return true;
+	if (frame >= end)
+		frame = end - 1;
+	return frame < first ? first : frame;
 }
 
-static bool video_frame_hwaccel(struct ff_frame *frame,
-struct stinger_info *s, AVFrame *pFrame)
+/* Uploads a cached frame the way it's stored: BGRA and planar frames as
+ * they are, compact frames unpacked by the prefetch thread */
+static void upload_cached_frame(struct stinger_info *s,
+		const struct stinger_frame_cache *cache, size_t frame)
 {
-	// 4th plane is pixelbuf reference for mac
-	for (int i = 0; i < 3; i++) {
-		pFrame->data[i] = frame->frame->data[i];
-		pFrame->linesize[i] = frame->frame->linesize[i];
+	struct stinger_frame_props props = {
+		cache->colorspace, cache->range, cache->premultiplied
+	};
+	uint8_t *planes[STINGER_MAX_PLANES];
+	int linesize[STINGER_MAX_PLANES];
+	const uint8_t *data;
+
+	if (cache->storage == STINGER_CACHE_STORE_BGRA) {
+		data = cache->frames.array[frame].data;
+		linesize[0] = (int)cache->linesize;
+
+	} else if (!stinger_frame_cache_needs_unpack(cache)) {
+		stinger_frame_cache_get_planes(cache, frame, planes, linesize);
+		stinger_texture_ring_upload(&s->texture_ring,
+			cache->width, cache->height, cache->format,
+			(const uint8_t *const *)planes, linesize, &props);
+		return;
+
+	} else {
+		if (s->prefetch_cache != cache) {
+			stinger_cache_prefetch_set_cache(s->cache_prefetch,
+					cache);
+			s->prefetch_cache = cache;
+		}
+
+		data = stinger_cache_prefetch_lock(s->cache_prefetch, frame);
+		if (!data)
+			return;
+		linesize[0] = (int)cache->linesize;
 	}
 
-	//if (!set_obs_frame_colorprops(frame, s, obs_frame))
-	//	return false;
+	stinger_texture_ring_upload(&s->texture_ring,
+		cache->width, cache->height, VIDEO_FORMAT_BGRA,
+		&data, linesize, &props);
 
-	setNextFrameTexture(s, pFrame);
-	return true;
+	if (stinger_frame_cache_needs_unpack(cache))
+		stinger_cache_prefetch_unlock(s->cache_prefetch);
 }
 
-static bool video_frame_direct(struct ff_frame *frame,
-struct stinger_info *s, AVFrame *pFrame)
+/* Records how long the transition took to show its first frame */
+static void frame_presented(struct stinger_info *s)
 {
-	int i;
+	struct stinger_telemetry *telemetry = get_telemetry(s);
+
+	if (telemetry && s->first_frame_pending)
+		stinger_telemetry_add_time(telemetry,
+				STINGER_METRIC_FIRST_FRAME,
+				s->transition_start_ns);
+	s->first_frame_pending = false;
+}
 
-	for (i = 0; i < MAX_AV_PLANES; i++) {
-		pFrame->data[i] = frame->frame->data[i];
-		pFrame->linesize[i] = frame->frame->linesize[i];
+/* Shows the cached frame matching transition time t, returns false if the
+ * cache isn't ready and playback has to come from the decoder instead */
+static bool render_cached_frame(struct stinger_info *s, float t)
+{
+	struct stinger_telemetry *telemetry = get_telemetry(s);
+	const struct stinger_frame_cache *cache;
+	uint64_t upload_start;
+	size_t frame;
+
+	pthread_mutex_lock(&s->cache_mutex);
+	cache = s->pack ? &s->pack->cache :
+		stinger_cache_entry_frames(s->cache_entry);
+	if (!cache) {
+		pthread_mutex_unlock(&s->cache_mutex);
+		return false;
 	}
 
-	//if (!set_obs_frame_colorprops(frame, s, obs_frame))
-	//	return false;
+	frame = (size_t)get_target_frame(s, t);
+	if (frame >= cache->frames.num)
+		frame = cache->frames.num - 1;
+
+	if (frame != s->cache_frame ||
+	    !stinger_texture_ring_current(&s->texture_ring)) {
+		upload_start = telemetry ? os_gettime_ns() : 0;
+		upload_cached_frame(s, cache, frame);
+		s->cache_frame = frame;
 
-	setNextFrameTexture(s, pFrame);
+		if (telemetry)
+			stinger_telemetry_add_time(telemetry,
+					STINGER_METRIC_UPLOAD, upload_start);
+	}
+	pthread_mutex_unlock(&s->cache_mutex);
+
+	s->curFrame = frame + 1;
+	frame_presented(s);
 	return true;
 }
 
-static bool video_frame(struct ff_frame *frame, void *opaque)
+static void start_playback_work(void *data)
 {
-	struct stinger_info *s = opaque;
+	stinger_playback_start(data);
+}
 
-	// Media ended
-	if (frame == NULL) {
-		obs_enter_graphics();
-		gs_texture_destroy(s->stinger_texture);
-		s->stinger_texture = NULL;
-		obs_leave_graphics();
-		return true;
-	}
-	AVFrame *pFrame = NULL;
+static void destroy_playback_work(void *data)
+{
+	stinger_playback_destroy(data);
+}
 
-	pFrame = av_frame_alloc();
-	if (!pFrame)
-		return false;
+/* Opening and tearing down the decoder happens on the worker, in order, so
+ * a new playback's decoder only starts once the previous one has stopped
+ * writing to the audio ring */
+static void stop_playback(struct stinger_info *s)
+{
+	if (s->playback)
+		stinger_worker_queue(destroy_playback_work, s->playback);
+	if (s->matte_playback)
+		stinger_worker_queue(destroy_playback_work, s->matte_playback);
+	s->playback = NULL;
+	s->matte_playback = NULL;
+	s->playback_primed = false;
+	stinger_matte_sync_reset(&s->matte_sync);
+}
 
-	pFrame->format = AV_PIX_FMT_BGRA;
-	pFrame->width = frame->frame->width;
-	pFrame->height = frame->frame->height;
-	
-	enum video_format format =
-		ffmpeg_to_obs_video_format(frame->frame->format);
+/* Length the transition plays for: the target duration when one is set,
+ * else the clip's own */
+static inline uint32_t get_play_duration(struct stinger_info *s,
+		uint32_t duration)
+{
+	return s->target_duration_ms ? s->target_duration_ms : duration;
+}
 
-	if (s->is_forcing_scale || format == VIDEO_FORMAT_NONE)
-		return video_frame_scale(frame, s, pFrame);
-	else if (s->is_hw_decoding)
-		return video_frame_hwaccel(frame, s, pFrame);
-	else
-		return video_frame_direct(frame, s, pFrame);
+/* How many times faster than authored the clip plays, 0 for its own speed
+ * or while its length isn't known yet */
+static double get_play_speed(struct stinger_info *s)
+{
+	uint32_t duration;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	duration = s->duration_ms;
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	return s->target_duration_ms && duration ?
+		(double)duration / (double)s->target_duration_ms : 0.0;
+}
+
+/* A clip played at another speed has its audio resampled to match, and
+ * the decoder doesn't seek past it while skipping frames */
+static inline bool plays_audio(struct stinger_info *s)
+{
+	return s->audio_ring.channels != 0;
+}
+
+/* Frame the playback stops before, 0 when nothing is trimmed off the end
+ * so a frame count that's slightly off can't cut the clip short */
+static inline int64_t get_playback_end(struct stinger_info *s)
+{
+	return s->end_frame < s->numberOfFrames ? (int64_t)s->end_frame : 0;
 }
 
-static bool audio_frame(struct ff_frame *frame, void *opaque)
+/* The matte has no audio and follows the stinger's clip numbers. It's
+ * trimmed the same, by frame rate since the index is the stinger's. */
+static void create_matte_playback(struct stinger_info *s, long clip)
 {
-	struct stinger_info *s = opaque;
+	struct stinger_playback_options options = {
+		.path = s->matte_path,
+		.hw_decoding = s->is_hw_decoding,
+		.decode_video = true,
+		.preroll_frames = s->prime_decoder ? s->preroll_frames : 0,
+		.threads = s->decoder_threads,
+		.threading = s->decoder_threading,
+		.start_frame = (int64_t)s->first_frame,
+		.end_frame = get_playback_end(s),
+		.clip = clip
+	};
+
+	get_decode_size(s, &options.max_width, &options.max_height);
+
+	s->matte_playback = stinger_playback_create(&options);
+	if (s->matte_playback)
+		stinger_worker_queue(start_playback_work, s->matte_playback);
+}
 
-	struct obs_source_audio audio_data;
-	uint64_t pts;
+static void create_playback(struct stinger_info *s, bool decode_video)
+{
+	struct stinger_playback_options options = {
+		.path = s->path,
+		.hw_decoding = s->is_hw_decoding,
+		.force_bgra = s->is_forcing_scale,
+		.decode_video = decode_video,
+		.preroll_frames = s->prime_decoder ? s->preroll_frames : 0,
+		.threads = s->decoder_threads,
+		.threading = s->decoder_threading,
+		.start_frame = (int64_t)s->first_frame,
+		.end_frame = get_playback_end(s),
+		.speed = get_play_speed(s),
+		.audio = plays_audio(s) ? &s->audio_ring : NULL,
+		.clip = ++s->last_clip,
+		.telemetry = get_telemetry(s)
+	};
+
+	get_decode_size(s, &options.max_width, &options.max_height);
+
+	/* the playback keeps its own copy of the index */
+	pthread_mutex_lock(&s->timing_mutex);
+	options.index = s->index.array;
+	options.index_size = s->index.num;
+	s->playback = stinger_playback_create(&options);
+	pthread_mutex_unlock(&s->timing_mutex);
+	if (s->playback)
+		stinger_worker_queue(start_playback_work, s->playback);
+	s->playback_clip = options.clip;
+	s->playback_video = decode_video;
+
+	if (decode_video && get_matte_layout(s) == STINGER_MATTE_FILE)
+		create_matte_playback(s, options.clip);
+}
 
-	bfree(s->audio_data);
+/* Sends the decoder back to the first frame, so the clip is decoded ahead
+ * of the transition that will show it */
+static void prime_playback(struct stinger_info *s)
+{
+	s->playback_clip = ++s->last_clip;
+	stinger_playback_rewind(s->playback, s->playback_clip);
+	if (s->matte_playback)
+		stinger_playback_rewind(s->matte_playback, s->playback_clip);
+	s->playback_primed = true;
+}
 
-	// Media ended
-	if (frame == NULL || frame->frame == NULL){
-		s->audio_data = NULL;
-		return true;
+static void start_playback(struct stinger_info *s, bool decode_video)
+{
+	if (os_atomic_set_bool(&s->reset_playback, false) ||
+	    (s->playback && s->playback_video != decode_video))
+		stop_playback(s);
+
+	if (!decode_video && !plays_audio(s)) {
+		stop_playback(s);
+		return;
 	}
-	
-	pts = (uint64_t)(frame->pts * 1000000000.0L);
 
-	int channels = av_frame_get_channels(frame->frame);
+	/* a transition that interrupts the previous one restarts the clip */
+	if (!s->playback)
+		create_playback(s, decode_video);
+	else if (!s->playback_primed)
+		prime_playback(s);
+	s->playback_primed = false;
 
-	for (int i = 0; i < channels; i++)
-		audio_data.data[i] = frame->frame->data[i];
+	if (!s->playback)
+		return;
 
-	audio_data.samples_per_sec = frame->frame->sample_rate;
-	audio_data.frames = frame->frame->nb_samples;
-	audio_data.timestamp = pts;
-	audio_data.format =
-		convert_ffmpeg_sample_format(frame->frame->format);
-	audio_data.speakers = channels;
+	/* the clip's audio starts with the current video frame */
+	os_atomic_inc_long(&s->audio_sequence);
+	s->audio_clip = s->playback_clip;
+	s->audio_start_ts = obs_get_video_frame_time();
+	os_atomic_inc_long(&s->audio_sequence);
 
-	s->audio_data = bzalloc(sizeof(audio_data));
+	s->presented_frame = -1;
+	s->scheduled_frame = -1;
+	stinger_matte_sync_reset(&s->matte_sync);
+}
 
-	memcpy(s->audio_data, &audio_data, sizeof audio_data);
+/* Keeps the decoder open and primed for the next transition if enabled */
+static void finish_playback(struct stinger_info *s)
+{
+	if (s->prime_decoder && s->playback)
+		prime_playback(s);
+	else
+		stop_playback(s);
+}
 
-	return true;
+static void upload_queued_frame(struct stinger_texture_ring *ring,
+		const struct stinger_queued_frame *queued)
+{
+	AVFrame *frame = queued->frame;
+	struct stinger_frame_props props = {
+		convert_color_space(frame->colorspace),
+		convert_color_range(frame->color_range),
+		queued->premultiplied
+	};
+
+	stinger_texture_ring_upload(ring,
+		frame->width, frame->height,
+		ffmpeg_to_obs_video_format(frame->format),
+		(const uint8_t *const *)frame->data, frame->linesize,
+		&props);
 }
 
+/* Only the luma of a matte is used, so a planar matte's chroma planes
+ * aren't uploaded at all */
+static void upload_matte_frame(struct stinger_info *s,
+		const struct stinger_queued_frame *queued)
+{
+	AVFrame *frame = queued->frame;
+	enum video_format format = ffmpeg_to_obs_video_format(frame->format);
+	struct stinger_frame_props props = {
+		convert_color_space(frame->colorspace),
+		convert_color_range(frame->color_range),
+		false
+	};
+
+	if (format == VIDEO_FORMAT_I420 || format == VIDEO_FORMAT_I444 ||
+	    format == VIDEO_FORMAT_NV12)
+		format = VIDEO_FORMAT_Y800;
+
+	stinger_texture_ring_upload(&s->matte_ring,
+		frame->width, frame->height, format,
+		(const uint8_t *const *)frame->data, frame->linesize,
+		&props);
+}
+
+/* Takes the frame scheduled for target, along with its matte when the
+ * matte comes from a separate file */
+static bool take_scheduled_frame(struct stinger_info *s, int64_t target,
+		struct stinger_queued_frame *frame)
+{
+	struct stinger_queued_frame matte;
+
+	if (get_matte_layout(s) != STINGER_MATTE_FILE)
+		return stinger_playback_take(s->playback, target, frame,
+				&s->frames_dropped);
+
+	if (!stinger_matte_sync_take(&s->matte_sync, s->playback,
+				s->matte_playback, target, frame, &matte,
+				&s->frames_dropped))
+		return false;
 
+	if (matte.frame) {
+		upload_matte_frame(s, &matte);
+		stinger_queued_frame_release(&matte);
+	}
+	return true;
+}
 
-static void ffmpeg_source_start(struct stinger_info *s)
+/* Shows the decoded frame scheduled for transition time t. When the
+ * renderer skips past frames, the ones whose time has passed are dropped;
+ * when the decoder falls behind, the previous frame is repeated (and the
+ * scheduled one counted as late) until it arrives. Past the end of the
+ * clip the last frame stays up. */
+static void render_scheduled_frame(struct stinger_info *s, float t)
 {
-	if (s->demuxer != NULL)
-		ff_demuxer_free(s->demuxer);
+	struct stinger_telemetry *telemetry = get_telemetry(s);
+	int64_t target = get_target_frame(s, t);
+	struct stinger_queued_frame frame;
+	uint64_t upload_start;
 
-	s->demuxer = ff_demuxer_init();
-	s->demuxer->options.is_hw_decoding = s->is_hw_decoding;
-	s->demuxer->options.is_looping = false;
+	s->curFrame = (size_t)target + 1;
 
-	ff_demuxer_set_callbacks(&s->demuxer->video_callbacks,
-		video_frame, NULL,
-		NULL, NULL, NULL, s);
+	if (!s->playback || target <= s->presented_frame)
+		return;
 
-	ff_demuxer_set_callbacks(&s->demuxer->audio_callbacks,
-		audio_frame, NULL,
-		NULL, NULL, NULL, s);
+	if (take_scheduled_frame(s, target, &frame)) {
+		upload_start = telemetry ? os_gettime_ns() : 0;
+		upload_queued_frame(&s->texture_ring, &frame);
+		if (telemetry)
+			stinger_telemetry_add_time(telemetry,
+					STINGER_METRIC_UPLOAD, upload_start);
+
+		s->presented_frame = frame.index;
+		s->frames_presented++;
+		stinger_queued_frame_release(&frame);
+		frame_presented(s);
+	}
 
-	ff_demuxer_open(s->demuxer, s->path, NULL);
+	if (target != s->scheduled_frame && s->presented_frame < target &&
+	    !stinger_playback_finished(s->playback))
+		s->frames_late++;
+	s->scheduled_frame = target;
 }
 
-static inline void load_error_texture(struct stinger_info *stinger)
+/* Keeps streaming playback that was started before the cache was ready
+ * moving, so its audio isn't held up by frames nobody shows */
+static void discard_scheduled_frames(struct stinger_info *s, float t)
 {
+	struct stinger_queued_frame frame;
+	uint64_t dropped = 0;
+
+	if (s->playback && stinger_playback_take(s->playback,
+				get_target_frame(s, t), &frame, &dropped))
+		stinger_queued_frame_release(&frame);
+}
+
+static void load_error_image(void *data)
+{
+	struct stinger_info *stinger = data;
 	struct dstr path = { 0 };
 
 	const char* file = obs_module_file("");
@@ -326,95 +896,521 @@ static inline void load_error_texture(struct stinger_info *stinger)
 	bfree(file);
 	dstr_cat(&path, "/NoStingerVideoLoaded.png");
 
-	obs_enter_graphics();
-	gs_image_file_free(&stinger->stinger_error_image);
-	obs_leave_graphics();
-
 	gs_image_file_init(&stinger->stinger_error_image, path.array);
 
 	obs_enter_graphics();
 	gs_image_file_init_texture(&stinger->stinger_error_image);
 	obs_leave_graphics();
-	stinger->stinger_texture = stinger->stinger_error_image.texture;
+
+	os_atomic_set_bool(&stinger->error_image_ready, true);
 	dstr_free(&path);
 }
 
-static uint32_t get_duration_ms(struct stinger_info *stinger)
+static inline void load_error_texture(struct stinger_info *stinger)
 {
-	AVCodecContext *pCodecCtx = NULL;
-	AVCodec *pCodec = NULL;
-	AVFormatContext *pFormatCtx = NULL;
+	if (!os_atomic_set_bool(&stinger->error_image_requested, true))
+		stinger_worker_queue(load_error_image, stinger);
+}
 
-	if (avformat_open_input(&pFormatCtx, stinger->path, NULL, NULL) != 0)
-	{
-		stinger->validInput = false;
-		load_error_texture(stinger);
-		return 3000; // Couldn't open file
+/* Probes on the calling thread, for as long as a background probe
+ * would be given */
+static bool probe_with_timeout(const char *path,
+		enum stinger_coverage_source coverage,
+		struct stinger_probe_info *info)
+{
+	struct stinger_probe_abort abort;
+
+	stinger_probe_abort_init(&abort);
+	return stinger_meta_cache_probe(path, coverage, &abort, info);
+}
+
+/* Until stingerPathModified has probed a newly picked file, the frame
+ * settings are still those of the previous one */
+static inline bool path_probed(obs_data_t *settings)
+{
+	return strcmp(obs_data_get_string(settings, "stingerPath"),
+			obs_data_get_string(settings, "prevPath")) == 0;
+}
+
+/* Reads the trim points, dropping them if they'd leave fewer than two
+ * frames, and keeps the cut frame between them */
+static void update_trim(struct stinger_info *s, obs_data_t *settings)
+{
+	size_t trim_start = (size_t)obs_data_get_int(settings, "trimStart");
+	size_t trim_end = (size_t)obs_data_get_int(settings, "trimEnd");
+
+	if (trim_start + trim_end + 2 > s->numberOfFrames) {
+		trim_start = 0;
+		trim_end = 0;
 	}
 
-	if (avformat_find_stream_info(pFormatCtx, NULL)<0)
-	{
-		stinger->validInput = false;
-		load_error_texture(stinger);
-		return 3000; // Couldn't find stream information
+	s->first_frame = trim_start;
+	s->end_frame = s->numberOfFrames - trim_end;
+
+	if (s->cutFrame <= s->first_frame)
+		s->cutFrame = s->first_frame + 1;
+	else if (s->cutFrame > s->end_frame)
+		s->cutFrame = s->end_frame;
+}
+
+static inline bool has_timing(const struct stinger_probe_info *info)
+{
+	return info->index.num ||
+		(info->framerate.num > 0 && info->framerate.den > 0);
+}
+
+/* Keeps the probed clip's frame times and index for playback, and returns
+ * how long the frames between the trim points take to play in ms. Called
+ * with the timing mutex held. */
+static uint32_t update_frame_times(struct stinger_info *s,
+		const struct stinger_probe_info *info)
+{
+	size_t frames = (size_t)info->frame_count;
+	size_t first = s->first_frame < frames ? s->first_frame : 0;
+	size_t end = s->end_frame <= frames ? s->end_frame : frames;
+	uint32_t duration;
+
+	if (end <= first) {
+		first = 0;
+		end = frames;
+	}
+
+	da_resize(s->frame_times, frames + 1);
+	for (size_t i = 0; i <= frames; i++)
+		s->frame_times.array[i] =
+			stinger_probe_frame_time_us(info, (int64_t)i);
+
+	if (info->index.num)
+		da_copy_array(s->index, info->index.array, info->index.num);
+	else
+		da_free(s->index);
+
+	duration = (uint32_t)((s->frame_times.array[end] -
+				s->frame_times.array[first]) / 1000);
+	return duration;
+}
+
+/* Keeps the clip's length along with the size and modification time of
+ * the file it was measured from; st is NULL if the file isn't there.
+ * Called with the timing mutex held. */
+static void set_duration(struct stinger_info *s, uint32_t duration,
+		const struct stat *st)
+{
+	s->duration_ms = duration;
+	s->duration_file_size = st ? (int64_t)st->st_size : 0;
+	s->duration_file_mtime = st ? (int64_t)st->st_mtime : 0;
+}
+
+/* The clip's length without reading the file: as saved with the settings
+ * if the file hasn't changed since, else from the probe cache, 0 if
+ * neither knows it */
+static uint32_t get_saved_duration_ms(struct stinger_info *stinger,
+		obs_data_t *settings)
+{
+	uint32_t duration = (uint32_t)obs_data_get_int(settings, "durationMs");
+	struct stinger_probe_info info;
+	struct stat st;
+
+	if (os_stat(stinger->path, &st) != 0)
+		return 0;
+
+	if (duration &&
+	    obs_data_get_int(settings, "durationFileSize") ==
+			(long long)st.st_size &&
+	    obs_data_get_int(settings, "durationFileMtime") ==
+			(long long)st.st_mtime) {
+		pthread_mutex_lock(&stinger->timing_mutex);
+		set_duration(stinger, duration, &st);
+		pthread_mutex_unlock(&stinger->timing_mutex);
+		return duration;
+	}
+
+	duration = 0;
+	if (stinger_meta_cache_lookup(stinger->path, STINGER_COVERAGE_NONE,
+				&info) && has_timing(&info)) {
+		pthread_mutex_lock(&stinger->timing_mutex);
+		duration = update_frame_times(stinger, &info);
+		set_duration(stinger, duration, &st);
+		pthread_mutex_unlock(&stinger->timing_mutex);
 	}
 
-	int videoStream = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0);
+	stinger_probe_info_free(&info);
+	return duration;
+}
 
-	pCodecCtx = pFormatCtx->streams[videoStream]->codec;
+/* Frame settings of a newly picked file the way stingerPathModified
+ * would have set them, kept for save to write back. Called with the
+ * timing mutex held. */
+static void set_probed_frames(struct stinger_info *s, int64_t frame_count)
+{
+	if (frame_count > 1) {
+		s->numberOfFrames = (size_t)frame_count;
+		if (s->cutFrame > s->numberOfFrames)
+			s->cutFrame = s->numberOfFrames / 2;
+		if (!s->cutFrame)
+			s->cutFrame = 1;
+	} else {
+		s->numberOfFrames = 1;
+		s->cutFrame = 1;
+	}
 
-	pCodec = avcodec_find_decoder(pCodecCtx->codec_id);
+	s->first_frame = 0;
+	s->end_frame = s->numberOfFrames;
+	s->pending_frames = s->numberOfFrames;
+}
 
-	if (pCodec == NULL)
-	{
-		stinger->validInput = false;
-		load_error_texture(stinger);
-		return 3000; // Codec not found
+/* Probes path for the update of the given generation and publishes what
+ * it found: the frame times, the length and the fixed duration for the
+ * UI thread to apply, and with probe_frames the frame count too. Nothing
+ * is published (and published is false) if a later update came in the
+ * meantime, or if the probe was given up on through abort. Returns
+ * whether the clip can be played. */
+/* Publishes a measurement, info being NULL if the probe failed and st if
+ * the file isn't there. Called with the timing mutex held. */
+static bool publish_measurement(struct stinger_info *s,
+		const struct stinger_probe_info *info, const struct stat *st,
+		bool probe_frames)
+{
+	uint32_t duration = 0;
+	bool valid;
+
+	if (probe_frames)
+		set_probed_frames(s, info ? info->frame_count : 1);
+
+	if (info && has_timing(info) && s->numberOfFrames > 1)
+		duration = update_frame_times(s, info);
+	valid = duration != 0;
+
+	set_duration(s, duration, valid ? st : NULL);
+	s->pending_fixed_ms = get_play_duration(s, valid ? duration : 3000);
+	os_atomic_set_bool(&s->validInput, valid);
+	os_atomic_set_bool(&s->measuring, false);
+	return valid;
+}
+
+static bool measure_clip(struct stinger_info *s, const char *path,
+		long generation, bool probe_frames,
+		struct stinger_probe_abort *abort, bool *published)
+{
+	struct stinger_probe_info info;
+	struct stat st;
+	bool probed, stat_ok;
+	bool valid = false;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	*published = s->update_generation == generation;
+	pthread_mutex_unlock(&s->timing_mutex);
+	if (!*published)
+		return false;
+
+	probed = stinger_meta_cache_probe(path, STINGER_COVERAGE_NONE, abort,
+			&info);
+	stat_ok = os_stat(path, &st) == 0;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	*published = s->update_generation == generation &&
+		!os_atomic_load_bool(&abort->cancel);
+	if (*published)
+		valid = publish_measurement(s, probed ? &info : NULL,
+				stat_ok ? &st : NULL, probe_frames);
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	stinger_probe_info_free(&info);
+	return valid;
+}
+
+/* Runs on the measure job's thread once its probe is done. The job stays
+ * until the next update replaces it, which waits for this to return. */
+static void measure_done(void *param)
+{
+	struct stinger_info *s = param;
+	struct stinger_probe_job *job;
+	struct stat st;
+	bool stat_ok;
+	bool published = false;
+	bool valid = false;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	job = s->measure_job;
+	pthread_mutex_unlock(&s->timing_mutex);
+	if (!job)
+		return;
+
+	stat_ok = os_stat(stinger_probe_job_get_path(job), &st) == 0;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	if (s->measure_job == job &&
+	    s->update_generation == s->measure_generation) {
+		published = true;
+		valid = publish_measurement(s,
+				stinger_probe_job_get_state(job) ==
+					STINGER_PROBE_JOB_SUCCEEDED ?
+				stinger_probe_job_get_info(job) : NULL,
+				stat_ok ? &st : NULL,
+				s->measure_probe_frames);
 	}
+	pthread_mutex_unlock(&s->timing_mutex);
 
-	double duration =
-		(double)stinger->numberOfFrames /
-		(double)pCodecCtx->framerate.num *
-		(double)pCodecCtx->framerate.den *
-		1000.0;
+	if (published && !valid)
+		load_error_texture(s);
+}
 
-	avcodec_close(pCodecCtx);
-	avformat_close_input(&pFormatCtx);
+/* Measures the clip on a thread of its own rather than in the update, or
+ * behind the playbacks on the worker. Until it's done the transition
+ * plays without it, as before a warm-up. */
+static void queue_measure(struct stinger_info *s, long generation,
+		bool probe_frames)
+{
+	struct stinger_probe_job *prev;
+	bool started;
+
+	os_atomic_set_bool(&s->measuring, true);
+
+	/* cancelling makes the earlier probe give up right away, and once
+	 * it's joined its measure_done can't see the new job */
+	pthread_mutex_lock(&s->timing_mutex);
+	prev = s->measure_job;
+	s->measure_job = NULL;
+	pthread_mutex_unlock(&s->timing_mutex);
+	stinger_probe_job_destroy(prev);
+
+	/* measure_done waits for the lock until the job is in place */
+	pthread_mutex_lock(&s->timing_mutex);
+	s->measure_generation = generation;
+	s->measure_probe_frames = probe_frames;
+	s->measure_job = stinger_probe_job_start(s->path,
+			STINGER_COVERAGE_NONE, measure_done, s);
+	started = stinger_probe_job_started(s->measure_job);
+	if (!started)
+		publish_measurement(s, NULL, NULL, probe_frames);
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	if (!started)
+		load_error_texture(s);
+}
+
+/* The fixed duration is only set on the UI thread, where transitions are
+ * started. Called from there: save and the properties. */
+static void apply_pending_duration(struct stinger_info *s)
+{
+	uint32_t duration;
 
-	return (uint32_t)duration;
+	pthread_mutex_lock(&s->timing_mutex);
+	duration = s->pending_fixed_ms;
+	s->pending_fixed_ms = 0;
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	if (duration)
+		obs_transition_enable_fixed(s->source, true, duration);
+}
+
+static inline bool is_warmed_up(struct stinger_info *s)
+{
+	enum stinger_warmup_state state = stinger_warmup_get_state(&s->warmup);
+
+	return state != STINGER_WARMUP_QUEUED &&
+		state != STINGER_WARMUP_RUNNING &&
+		!os_atomic_load_bool(&s->measuring);
+}
+
+/* What the warm-up needs of the settings, copied by the update that
+ * queued it: the settings' strings go away with the next update */
+struct warm_job {
+	char *path;
+	long generation;
+	bool probe_frames;
+	bool valid_input;
+	bool use_pack;
+	bool use_frame_cache;
+	bool matte_file;
+	enum stinger_cache_storage cache_storage;
+	uint32_t max_width;
+	uint32_t max_height;
+};
+
+static void free_warm_job(struct warm_job *job)
+{
+	if (job) {
+		bfree(job->path);
+		bfree(job);
+	}
+}
+
+static void queue_warm_up(struct stinger_info *s, long generation,
+		bool probe_frames)
+{
+	struct warm_job *job = bzalloc(sizeof(*job));
+	struct warm_job *prev;
+
+	job->path = bstrdup(s->path);
+	job->generation = generation;
+	job->probe_frames = probe_frames;
+	job->valid_input = s->validInput;
+	job->use_pack = s->use_pack;
+	job->use_frame_cache = s->use_frame_cache;
+	job->matte_file = get_matte_layout(s) == STINGER_MATTE_FILE;
+	job->cache_storage = s->cache_storage;
+	get_decode_size(s, &job->max_width, &job->max_height);
+
+	pthread_mutex_lock(&s->timing_mutex);
+	prev = s->warm_job;
+	s->warm_job = job;
+	pthread_mutex_unlock(&s->timing_mutex);
+	free_warm_job(prev);
+
+	os_atomic_set_bool(&s->warm_abort.cancel, false);
+	stinger_warmup_queue(&s->warmup);
+}
+
+/* Maps the pack or fills the cache the way load_frame_pack and
+ * start_frame_cache would, from the job's copy of the settings. They're
+ * swapped in under the cache mutex unless an update came in meanwhile,
+ * which sets up its own. */
+static void warm_frames(struct stinger_info *s, const struct warm_job *job,
+		bool valid)
+{
+	bool pack_wanted = job->use_pack && valid && !job->matte_file;
+	struct stinger_pack *pack = pack_wanted ? stinger_pack_open(job->path,
+			job->max_width, job->max_height) : NULL;
+	struct stinger_cache_entry *entry = NULL;
+	char *source = pack_wanted ? bstrdup(job->path) : NULL;
+
+	if (job->use_frame_cache && valid && !pack && !job->matte_file)
+		entry = stinger_cache_registry_acquire(job->path,
+				job->cache_storage, job->max_width,
+				job->max_height);
+
+	pthread_mutex_lock(&s->cache_mutex);
+	if (os_atomic_load_long(&s->update_generation) == job->generation) {
+		bfree(s->pack_source);
+		s->pack_source = source;
+		s->pack_max_width = job->max_width;
+		s->pack_max_height = job->max_height;
+		source = NULL;
+
+		pack = swap_frame_pack(s, pack);
+		entry = swap_frame_cache(s, entry);
+	}
+	pthread_mutex_unlock(&s->cache_mutex);
+
+	/* whatever was replaced, or this if it came too late */
+	stinger_pack_close(pack);
+	stinger_cache_registry_release(entry);
+	bfree(source);
+}
+
+/* The part of the set-up that reads files, deferred from loading */
+static void warm_up(void *data)
+{
+	struct stinger_info *s = data;
+	uint64_t start = os_gettime_ns();
+	struct warm_job *job;
+	bool published = true;
+	bool valid;
+
+	pthread_mutex_lock(&s->timing_mutex);
+	job = s->warm_job;
+	s->warm_job = NULL;
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	if (!job)
+		return;
+
+	/* given up on by an update, the deadline only counts from here */
+	s->warm_abort.deadline_ns = os_gettime_ns() +
+		(uint64_t)STINGER_PROBE_TIMEOUT_MS * 1000000ULL;
+
+	valid = job->valid_input;
+	if (job->probe_frames || job->valid_input)
+		valid = measure_clip(s, job->path, job->generation,
+				job->probe_frames, &s->warm_abort,
+				&published);
+
+	if (published) {
+		if (!valid)
+			load_error_texture(s);
+		warm_frames(s, job, valid);
+	}
+
+	blog(LOG_DEBUG, "stinger '%s': warmed up in %.1f ms",
+			obs_source_get_name(s->source),
+			(double)(os_gettime_ns() - start) / 1e6);
+	free_warm_job(job);
 }
 
 static void stinger_update(void *data, obs_data_t *settings)
 {
 	struct stinger_info *stinger = data;
+	bool use_frame_cache = obs_data_get_bool(settings, "preloadFrames");
+	size_t cache_budget =
+		(size_t)obs_data_get_int(settings, "cacheBudget") * 1024 * 1024;
+	bool deferred = !stinger->initialized;
+	bool probed = path_probed(settings);
+	uint32_t duration;
+	long generation;
+
+	/* the measure job works for this update from now on, whatever the
+	 * warm-up or an earlier job found for an earlier one is dropped. A
+	 * warm-up that's running gives up on its probe rather than being
+	 * waited for. */
+	if (!deferred) {
+		os_atomic_set_bool(&stinger->warm_abort.cancel, true);
+		stinger_warmup_cancel(&stinger->warmup);
+	}
+
+	pthread_mutex_lock(&stinger->timing_mutex);
+	generation = ++stinger->update_generation;
+	os_atomic_set_bool(&stinger->measuring, false);
+	set_duration(stinger, 0, NULL);
+	stinger->pending_fixed_ms = 0;
+	stinger->pending_frames = 0;
+	pthread_mutex_unlock(&stinger->timing_mutex);
 
 	bool is_local_file = obs_data_get_bool(settings, "is_local_file");
 	bool is_advanced = obs_data_get_bool(settings, "advanced");
 
 	stinger->is_hw_decoding = obs_data_get_bool(settings, "hw_decode");
-	stinger->is_forcing_scale = true;
+	stinger->prime_decoder = obs_data_get_bool(settings, "primeDecoder");
+	stinger->preroll_frames =
+		(size_t)obs_data_get_int(settings, "prerollFrames");
+	stinger->decoder_threads =
+		(int)obs_data_get_int(settings, "decoderThreads");
+	stinger->decoder_threading = (enum stinger_decoder_threading)
+		obs_data_get_int(settings, "decoderThreading");
+	stinger->is_forcing_scale = false;
+	stinger->scale_to_output =
+		obs_data_get_bool(settings, "scaleToOutput");
+	stinger->telemetry_enabled = obs_data_get_bool(settings, "telemetry");
+	stinger->target_duration_ms =
+		(uint32_t)obs_data_get_int(settings, "targetDuration");
 	stinger->lastTime = 1.0f; //to make sure it plays on first scene change
 
 	stinger->path = obs_data_get_string(settings, "stingerPath");
+	stinger->matte_layout = (enum stinger_matte_layout)
+		obs_data_get_int(settings, "matteLayout");
+	stinger->matte_path = obs_data_get_string(settings, "mattePath");
+
 	stinger->cutFrame = obs_data_get_int(settings, "cutFrame");
 	stinger->numberOfFrames = obs_data_get_int(settings, "numberOfFrames");
 
 	if (stinger->numberOfFrames > 1){
 		stinger->validInput = true;
-		//error image not needed if valid input
-		obs_enter_graphics();
-		gs_image_file_free(&stinger->stinger_error_image);
-		stinger->stinger_texture = NULL;
-		obs_leave_graphics();
+		update_trim(stinger, settings);
+
+		//until the warm-up or the measure job knows better, a guess is
+		//good enough
+		duration = get_saved_duration_ms(stinger, settings);
 
 		obs_transition_enable_fixed(stinger->source, true,
-			get_duration_ms(stinger));
+			get_play_duration(stinger, duration ? duration : 3000));
 	}
 	else
 	{
 		stinger->validInput = false;
 		stinger->cutFrame = 1;
 		stinger->numberOfFrames = 1;
+		stinger->first_frame = 0;
+		stinger->end_frame = 1;
 		obs_data_set_int(settings, "numberOfFrames", 1);
 		obs_data_set_int(settings, "cutFrame", 1);
 
@@ -423,34 +1419,146 @@ static void stinger_update(void *data, obs_data_t *settings)
 		obs_transition_enable_fixed(stinger->source, true,
 			3000);
 	}
+
+	/* the budget and the warm-up concurrency are shared by every
+	 * stinger, the last one set wins */
+	stinger_cache_registry_set_budget(cache_budget);
+	stinger_warmup_set_concurrency(
+		(int)obs_data_get_int(settings, "warmupConcurrency"));
+
+	stinger->use_frame_cache = use_frame_cache;
+	stinger->cache_storage = (enum stinger_cache_storage)
+		obs_data_get_int(settings, "cacheStorage");
+	stinger->use_pack = obs_data_get_bool(settings, "usePack");
+	stinger->pack_compressed =
+		obs_data_get_bool(settings, "packCompressed");
+
+	/* a file the properties dialog was closed before probing still has
+	 * the frame settings of the one before, it's probed along with the
+	 * rest */
+	if (deferred) {
+		queue_warm_up(stinger, generation, !probed);
+	} else {
+		if (!probed || stinger->validInput)
+			queue_measure(stinger, generation, !probed);
+		load_frame_pack(stinger);
+		start_frame_cache(stinger);
+	}
+
+	/* the render thread owns the playback, let it start over */
+	os_atomic_set_bool(&stinger->reset_playback, true);
 }
 
-static void *stinger_create(obs_data_t *settings, obs_source_t *source)
+static void get_telemetry_proc(void *data, calldata_t *cd)
 {
-	struct stinger_info *stinger;
-	char *file = obs_module_file("stinger_transition.effect");
+	struct stinger_info *s = data;
+	struct dstr json = {0};
+
+	stinger_telemetry_get_json(&s->telemetry, &json);
+	calldata_set_string(cd, "json", json.array);
+	calldata_set_bool(cd, "enabled", s->telemetry_enabled);
+	dstr_free(&json);
+}
+
+static void reset_telemetry_proc(void *data, calldata_t *cd)
+{
+	struct stinger_info *s = data;
+
+	stinger_telemetry_reset(&s->telemetry);
+	UNUSED_PARAMETER(cd);
+}
+
+static void is_warm_proc(void *data, calldata_t *cd)
+{
+	struct stinger_info *s = data;
+
+	calldata_set_bool(cd, "warm", is_warmed_up(s));
+}
+
+/* Loads the effect on the graphics thread the first time it's needed, so
+ * loading a scene collection doesn't wait for the graphics lock once per
+ * stinger. libobs keeps effects by file, only the first load compiles. */
+static bool load_effect(struct stinger_info *stinger)
+{
+	char *file;
 	gs_effect_t *effect;
 
-	obs_enter_graphics();
-	effect = gs_effect_create_from_file(file, NULL);
-	obs_leave_graphics();
+	if (stinger->effect)
+		return true;
+	if (stinger->effect_failed)
+		return false;
 
+	file = obs_module_file("stinger_transition.effect");
+	effect = gs_effect_create_from_file(file, NULL);
 	bfree(file);
 
 	if (!effect) {
 		blog(LOG_ERROR, "Could not find stinger_transition.effect");
-		return NULL;
+		stinger->effect_failed = true;
+		return false;
 	}
 
-	stinger = bzalloc(sizeof(struct stinger_info));
-
 	stinger->effect = effect;
 	stinger->ep_a_tex = gs_effect_get_param_by_name(effect, "a_tex");
 	stinger->ep_b_tex = gs_effect_get_param_by_name(effect, "b_tex");
+	stinger->ep_y_tex = gs_effect_get_param_by_name(effect, "y_tex");
+	stinger->ep_u_tex = gs_effect_get_param_by_name(effect, "u_tex");
+	stinger->ep_v_tex = gs_effect_get_param_by_name(effect, "v_tex");
+	stinger->ep_color_matrix =
+		gs_effect_get_param_by_name(effect, "color_matrix");
+	stinger->ep_color_range_min =
+		gs_effect_get_param_by_name(effect, "color_range_min");
+	stinger->ep_color_range_max =
+		gs_effect_get_param_by_name(effect, "color_range_max");
+	stinger->ep_frame_size =
+		gs_effect_get_param_by_name(effect, "frame_size");
+	stinger->ep_color_rect =
+		gs_effect_get_param_by_name(effect, "color_rect");
+	stinger->ep_matte_rect =
+		gs_effect_get_param_by_name(effect, "matte_rect");
+	stinger->ep_matte_tex =
+		gs_effect_get_param_by_name(effect, "matte_tex");
+	stinger->ep_matte_weights =
+		gs_effect_get_param_by_name(effect, "matte_weights");
+	stinger->ep_matte_levels =
+		gs_effect_get_param_by_name(effect, "matte_levels");
+	return true;
+}
+
+static void *stinger_create(obs_data_t *settings, obs_source_t *source)
+{
+	struct stinger_info *stinger;
+	struct obs_audio_info oai;
+	proc_handler_t *ph;
+
+	stinger = bzalloc(sizeof(struct stinger_info));
 
 	stinger->source = source;
 
+	stinger_telemetry_init(&stinger->telemetry);
+	ph = obs_source_get_proc_handler(source);
+	proc_handler_add(ph, "void get_telemetry(out string json, "
+			"out bool enabled)", get_telemetry_proc, stinger);
+	proc_handler_add(ph, "void reset_telemetry()",
+			reset_telemetry_proc, stinger);
+	proc_handler_add(ph, "void is_warm(out bool warm)", is_warm_proc,
+			stinger);
+	stinger_warmup_item_init(&stinger->warmup, warm_up, stinger);
+
+	pthread_mutex_init(&stinger->cache_mutex, NULL);
+	pthread_mutex_init(&stinger->timing_mutex, NULL);
+	stinger->cache_prefetch = stinger_cache_prefetch_create();
+	stinger_texture_ring_init(&stinger->texture_ring);
+	stinger_texture_ring_init(&stinger->matte_ring);
+
+	if (obs_get_audio_info(&oai))
+		stinger_audio_ring_init(&stinger->audio_ring,
+				get_audio_channels(oai.speakers),
+				STINGER_AUDIO_BUFFER_SECONDS *
+				oai.samples_per_sec);
+
 	stinger_update(stinger, settings);
+	stinger->initialized = true;
 
 	return stinger;
 }
@@ -459,69 +1567,242 @@ static void stinger_destroy(void *data)
 {
 	struct stinger_info *stinger = data;
 
-	if (stinger->demuxer)
-		ff_demuxer_free(stinger->demuxer);
-
-	if (stinger->sws_ctx != NULL)
-		sws_freeContext(stinger->sws_ctx);
-	bfree(stinger->sws_data);
-
-	bfree(stinger->audio_data);
+	/* whatever the measure job still finds is dropped, and a
+	 * running warm-up gives up before it's waited for */
+	pthread_mutex_lock(&stinger->timing_mutex);
+	stinger->update_generation++;
+	pthread_mutex_unlock(&stinger->timing_mutex);
+
+	os_atomic_set_bool(&stinger->warm_abort.cancel, true);
+	stinger_warmup_item_free(&stinger->warmup);
+	free_warm_job(stinger->warm_job);
+	stop_pack_export(stinger);
+	set_frame_pack(stinger, NULL);
+	bfree(stinger->pack_source);
+	stop_frame_cache(stinger);
+	stinger_cache_prefetch_destroy(stinger->cache_prefetch);
+	pthread_mutex_destroy(&stinger->cache_mutex);
+	stinger_probe_job_destroy(stinger->probe_job);
+	stinger_probe_job_destroy(stinger->coverage_job);
+	stinger_probe_job_destroy(stinger->measure_job);
+
+	/* the decoder and image loading may still be running on the worker */
+	stop_playback(stinger);
+	stinger_worker_flush();
+	stinger_audio_ring_free(&stinger->audio_ring);
+	stinger_telemetry_free(&stinger->telemetry);
 
 	obs_enter_graphics();
-	if (!stinger->validInput)
-	{
-		gs_image_file_free(&stinger->stinger_error_image);
-		stinger->stinger_texture = NULL;
-	}
-	if (stinger->stinger_texture != NULL){
-		gs_texture_destroy(stinger->stinger_texture);
-		stinger->stinger_texture = NULL;
-	}
+	gs_image_file_free(&stinger->stinger_error_image);
+	stinger_texture_ring_free(&stinger->texture_ring);
+	stinger_texture_ring_free(&stinger->matte_ring);
 	obs_leave_graphics();
+
+	da_free(stinger->frame_times);
+	da_free(stinger->index);
+	pthread_mutex_destroy(&stinger->timing_mutex);
 	
 	bfree(stinger);
 }
 
+/* Technique per kind of frame, then per matte: none, packed or a file */
+static const char *techniques[][3] = {
+	{"Stinger", "StingerPacked", "StingerMatte"},
+	{"StingerPlanar", "StingerPlanarPacked", "StingerPlanarMatte"},
+	{"StingerNV12", "StingerNV12Packed", "StingerNV12Matte"},
+	{"StingerY800", "StingerY800Packed", "StingerY800Matte"},
+	{"StingerYUY2", "StingerYUY2Packed", "StingerYUY2Matte"},
+	{"StingerUYVY", "StingerUYVYPacked", "StingerUYVYMatte"},
+};
+
+static size_t get_shader(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_I444: return 1;
+	case VIDEO_FORMAT_NV12: return 2;
+	case VIDEO_FORMAT_Y800: return 3;
+	case VIDEO_FORMAT_YUY2: return 4;
+	case VIDEO_FORMAT_UYVY: return 5;
+	default:                return 0;
+	}
+}
+
+static const char *get_technique(enum video_format format,
+		enum stinger_matte_layout layout)
+{
+	size_t matte = layout == STINGER_MATTE_FILE ? 2 :
+		stinger_matte_is_packed(layout) ? 1 : 0;
+
+	return techniques[get_shader(format)][matte];
+}
+
+static void set_matte_params(struct stinger_info *s,
+		enum stinger_matte_layout layout)
+{
+	const struct stinger_ring_slot *slot;
+	struct vec4 color_rect;
+	struct vec4 matte_rect;
+	struct vec3 weights;
+	struct vec2 levels;
+
+	if (stinger_matte_is_packed(layout)) {
+		stinger_matte_get_rects(layout, &color_rect, &matte_rect);
+		gs_effect_set_vec4(s->ep_color_rect, &color_rect);
+		gs_effect_set_vec4(s->ep_matte_rect, &matte_rect);
+
+	} else if (layout == STINGER_MATTE_FILE) {
+		slot = stinger_texture_ring_current(&s->matte_ring);
+		stinger_matte_get_luma(s->matte_ring.format,
+				slot ? slot->props.range : VIDEO_RANGE_DEFAULT,
+				&weights, &levels);
+		gs_effect_set_texture(s->ep_matte_tex,
+				slot ? slot->planes[0] : NULL);
+		gs_effect_set_vec3(s->ep_matte_weights, &weights);
+		gs_effect_set_vec2(s->ep_matte_levels, &levels);
+	}
+}
+
+/* Binds the displayed frame (or the error image) and returns the technique
+ * that converts it */
+static const char *set_stinger_textures(struct stinger_info *s)
+{
+	const struct stinger_ring_slot *slot;
+	enum video_format format = s->texture_ring.format;
+	enum stinger_matte_layout layout = get_matte_layout(s);
+	const char *technique = get_technique(format, layout);
+	float matrix[16];
+	float range_min[3];
+	float range_max[3];
+	struct vec2 size;
+
+	if (!s->transition_warm) {
+		gs_effect_set_texture(s->ep_b_tex, NULL);
+		return "Stinger";
+	}
+
+	if (!s->validInput) {
+		gs_effect_set_texture(s->ep_b_tex,
+				os_atomic_load_bool(&s->error_image_ready) ?
+				s->stinger_error_image.texture : NULL);
+		return "Stinger";
+	}
+
+	slot = stinger_texture_ring_current(&s->texture_ring);
+	if (!slot) {
+		gs_effect_set_texture(s->ep_b_tex, NULL);
+		return "Stinger";
+	}
+
+	set_matte_params(s, layout);
+
+	if (get_shader(format) == 0) {
+		gs_effect_set_texture(s->ep_b_tex, slot->planes[0]);
+		return layout == STINGER_MATTE_NONE &&
+			slot->props.premultiplied ?
+			"StingerPremultiplied" : technique;
+	}
+
+	video_format_get_parameters(slot->props.colorspace, slot->props.range,
+		matrix, range_min, range_max);
+	vec2_set(&size, (float)s->texture_ring.width,
+		(float)s->texture_ring.height);
+
+	gs_effect_set_texture(s->ep_y_tex, slot->planes[0]);
+	gs_effect_set_texture(s->ep_u_tex, slot->planes[1]);
+	gs_effect_set_texture(s->ep_v_tex, slot->planes[2]);
+	gs_effect_set_val(s->ep_color_matrix, matrix, sizeof(matrix));
+	gs_effect_set_val(s->ep_color_range_min, range_min, sizeof(range_min));
+	gs_effect_set_val(s->ep_color_range_max, range_max, sizeof(range_max));
+	gs_effect_set_vec2(s->ep_frame_size, &size);
+	return technique;
+}
+
+/* Records where the cut landed: how many frames past cutFrame the clock
+ * was, and how far the frame on screen trailed the clock */
+static void record_cut(struct stinger_info *s, bool cached)
+{
+	size_t shown = cached ? s->curFrame : (size_t)(s->presented_frame + 1);
+
+	s->cut_recorded = true;
+	stinger_telemetry_add(&s->telemetry, STINGER_METRIC_CUT_LATE,
+			s->curFrame - s->cutFrame);
+	stinger_telemetry_add(&s->telemetry, STINGER_METRIC_CUT_BEHIND,
+			s->curFrame > shown ? s->curFrame - shown : 0);
+}
+
 static void stinger_callback(void *data, gs_texture_t *a, gs_texture_t *b,
 		float t, uint32_t cx, uint32_t cy)
 {
 	struct stinger_info *stinger = data;
+	bool new_scene_change = t - stinger->lastTime < 0.0f;
+	uint64_t start_time = os_gettime_ns();
+	uint64_t render_time;
+	bool valid;
+	bool cached;
+
+	if (new_scene_change) {
+		stinger->transition_start_ns = start_time;
+		stinger->first_frame_pending = true;
+		stinger->cut_recorded = false;
+
+		/* started before the warm-up was done, the whole transition
+		 * goes without the clip */
+		stinger->transition_warm = is_warmed_up(stinger);
+	}
+
+	valid = stinger->transition_warm &&
+		os_atomic_load_bool(&stinger->validInput);
+	cached = valid && render_cached_frame(stinger, t);
 
-	if (stinger->validInput && t - stinger->lastTime < 0.0f) //new scene change
+	if (valid && new_scene_change)
 	{
 		//clear last frame
-		obs_enter_graphics();
-		gs_texture_destroy(stinger->stinger_texture);
-		stinger->stinger_texture = NULL;
-		obs_leave_graphics();
+		if (!cached) {
+			stinger_texture_ring_clear(&stinger->texture_ring);
+			stinger_texture_ring_clear(&stinger->matte_ring);
+		}
 
+		//cached frames still need the clip's audio
 		stinger->curFrame = 0;
-
-		if (stinger->demuxer != NULL) {
-			ff_demuxer_free(stinger->demuxer);
-			stinger->demuxer = NULL;
-		}
-		ffmpeg_source_start(stinger);
+		if (cached)
+			touch_frame_cache(stinger);
+		start_playback(stinger, !cached);
 	}
+
+	if (cached)
+		discard_scheduled_frames(stinger, t);
+	else if (valid)
+		render_scheduled_frame(stinger, t);
 	
-	if (stinger->validInput && stinger->curFrame < stinger->cutFrame)
+	if (valid && stinger->curFrame < stinger->cutFrame)
 		gs_effect_set_texture(stinger->ep_a_tex, a);
 	else
 		gs_effect_set_texture(stinger->ep_a_tex, b);
 
-	gs_effect_set_texture(stinger->ep_b_tex, stinger->stinger_texture);
+	if (stinger->telemetry_enabled && valid &&
+	    !stinger->cut_recorded && stinger->curFrame >= stinger->cutFrame)
+		record_cut(stinger, cached);
 
+	const char *technique = set_stinger_textures(stinger);
 
-	while (gs_effect_loop(stinger->effect, "Stinger"))
+	while (gs_effect_loop(stinger->effect, technique))
 		gs_draw_sprite(NULL, 0, cx, cy);
 
 	stinger->lastTime = t;
+
+	render_time = os_gettime_ns() - start_time;
+	stinger->render_time_total += render_time;
+	if (render_time > stinger->render_time_max)
+		stinger->render_time_max = render_time;
+	stinger->frames_rendered++;
 }
 
 static void stinger_video_render(void *data, gs_effect_t *effect)
 {
 	struct stinger_info *stinger = data;
+	if (!load_effect(stinger))
+		return;
 	obs_transition_video_render(stinger->source, stinger_callback);
 	UNUSED_PARAMETER(effect);
 }
@@ -538,105 +1819,409 @@ static float mix_b(void *data, float t)
 	return t;
 }
 
-bool stinger_audio(obs_source_t *transition,
-	uint64_t *ts_out, struct obs_source_audio_mix *audio,
-	uint32_t mixers, size_t channels, size_t sample_rate,
-	obs_transition_audio_mix_callback_t mix_a,
-	obs_transition_audio_mix_callback_t mix_b)
+/* Picks up a clip started by the render thread. The clip's audio starts
+ * wherever the decoder marked its beginning in the ring, and whatever was
+ * written before that belongs to an earlier clip and is skipped. Returns
+ * false while there's nothing to play. */
+static bool update_audio_clip(struct stinger_info *s)
+{
+	struct stinger_audio_ring *ring = &s->audio_ring;
+	long sequence = os_atomic_load_long(&s->audio_sequence);
+	long clip;
+	long base;
+	uint64_t start_ts;
+
+	if (sequence != s->audio_seen_sequence && (sequence & 1) == 0) {
+		clip = s->audio_clip;
+		start_ts = s->audio_start_ts;
+
+		if (os_atomic_load_long(&s->audio_sequence) == sequence) {
+			s->audio_seen_sequence = sequence;
+			s->audio_playing_clip = clip;
+			s->audio_clip_start_ts = start_ts;
+			s->audio_base_known = false;
+			s->audio_playing = true;
+		}
+	}
+
+	if (!s->audio_playing)
+		return false;
+	if (s->audio_base_known)
+		return true;
+
+	/* the decoder hasn't begun the clip yet */
+	if (os_atomic_load_long(&ring->start_clip) != s->audio_playing_clip)
+		return false;
+	base = os_atomic_load_long(&ring->start_pos);
+	if (os_atomic_load_long(&ring->start_clip) != s->audio_playing_clip)
+		return false;
+
+	s->audio_clip_base = base;
+	s->audio_base_known = true;
+
+	stinger_audio_ring_skip(ring, stinger_audio_ring_distance(
+			ring->read_pos, base));
+	return true;
+}
+
+/* Finds where the playing clip's audio ends, false if the decoder is still
+ * writing it. A clip that was abandoned for a newer one ends where the
+ * newer one begins. */
+static bool get_audio_clip_end(struct stinger_info *s, long *end)
 {
-	//transition->source not initialized?
+	struct stinger_audio_ring *ring = &s->audio_ring;
+
+	if (os_atomic_load_long(&ring->end_clip) == s->audio_playing_clip) {
+		*end = os_atomic_load_long(&ring->end_pos);
+		return true;
+	}
+
+	if (os_atomic_load_long(&ring->start_clip) != s->audio_playing_clip) {
+		*end = os_atomic_load_long(&ring->start_pos);
+		return true;
+	}
 
 	return false;
 }
 
+/* Adds the stinger's audio to the mix. The clip position of the window is
+ * derived from its timestamp, so audio stays aligned with the video even
+ * if windows are skipped or the decoder was late. */
+static void mix_stinger_audio(struct stinger_info *s, uint64_t ts,
+		struct obs_source_audio_mix *audio, uint32_t mixers,
+		size_t channels, size_t sample_rate)
+{
+	struct stinger_audio_ring *ring = &s->audio_ring;
+	float *out[MAX_AUDIO_CHANNELS] = {0};
+	size_t offset = 0;
+	size_t remaining = 0;
+	size_t wanted;
+	size_t frames;
+	bool clip_ended;
+	long end;
+
+	if (!update_audio_clip(s))
+		return;
+
+	clip_ended = get_audio_clip_end(s, &end);
+	if (clip_ended)
+		remaining = stinger_audio_ring_distance(ring->read_pos, end);
+
+	if (ts < s->audio_clip_start_ts) {
+		uint64_t lead = (s->audio_clip_start_ts - ts) * sample_rate /
+			1000000000ULL;
+		if (lead >= AUDIO_OUTPUT_FRAMES)
+			return;
+		offset = (size_t)lead;
+	} else {
+		size_t pos = (size_t)((ts - s->audio_clip_start_ts) *
+				sample_rate / 1000000000ULL);
+		size_t played = stinger_audio_ring_distance(
+				s->audio_clip_base, ring->read_pos);
+
+		if (pos > played) {
+			size_t skip = pos - played;
+
+			if (clip_ended && skip > remaining)
+				skip = remaining;
+			skip = stinger_audio_ring_skip(ring, skip);
+			if (clip_ended)
+				remaining -= skip;
+		}
+	}
+
+	if (channels > ring->channels)
+		channels = ring->channels;
+	for (size_t ch = 0; ch < channels; ch++)
+		out[ch] = s->audio_mix[ch];
+
+	wanted = AUDIO_OUTPUT_FRAMES - offset;
+	if (clip_ended && wanted > remaining)
+		wanted = remaining;
+	frames = stinger_audio_ring_read(ring, out, wanted);
+
+	if (!clip_ended && frames < wanted)
+		os_atomic_inc_long(&s->audio_underruns);
+	else if (clip_ended && frames == remaining)
+		s->audio_playing = false;
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		if ((mixers & (1 << mix)) == 0)
+			continue;
+
+		for (size_t ch = 0; ch < channels; ch++) {
+			float *dst = audio->output[mix].data[ch] + offset;
+
+			for (size_t i = 0; i < frames; i++)
+				dst[i] += s->audio_mix[ch][i];
+		}
+	}
+}
+
 static bool stinger_audio_render(void *data, uint64_t *ts_out,
 		struct obs_source_audio_mix *audio, uint32_t mixers,
 		size_t channels, size_t sample_rate)
 {
 	struct stinger_info *s = data;
 
-	return stinger_audio(s->source, ts_out,
-		audio, mixers, channels, sample_rate, mix_a, mix_b);
+	if (!obs_transition_audio_render(s->source, ts_out,
+				audio, mixers, channels, sample_rate,
+				mix_a, mix_b))
+		return false;
+
+	mix_stinger_audio(s, *ts_out, audio, mixers, channels, sample_rate);
+	return true;
 }
 
 
-static int checkInputFile(const char* file)
+/* Where the stinger's coverage is measured for a matte layout */
+static enum stinger_coverage_source get_coverage_source(
+		enum stinger_matte_layout layout)
 {
-	int numberOfFrames = 0;
+	switch (layout) {
+	case STINGER_MATTE_SIDE_BY_SIDE: return STINGER_COVERAGE_LUMA_RIGHT;
+	case STINGER_MATTE_STACKED:      return STINGER_COVERAGE_LUMA_BOTTOM;
+	case STINGER_MATTE_FILE:         return STINGER_COVERAGE_LUMA;
+	default:                         return STINGER_COVERAGE_ALPHA;
+	}
+}
 
-	if (!file)
+static inline enum stinger_matte_layout get_layout_setting(
+		obs_data_t *settings)
+{
+	return (enum stinger_matte_layout)obs_data_get_int(settings,
+			"matteLayout");
+}
+
+/* First frame (counting from 1) at which the probed file covers the
+ * configured share of the canvas, 0 if it never does */
+static int find_cut_frame(obs_data_t *settings, const char *path,
+		const struct stinger_probe_info *info, int numberOfFrames)
+{
+	int percent = (int)obs_data_get_int(settings, "cutCoverage");
+	int64_t frame = stinger_coverage_find(info->coverage.array,
+			info->coverage.num, percent);
+
+	if (frame < 0)
 		return 0;
 
-	AVFormatContext *pFormatCtx = NULL;
+	blog(LOG_INFO, "stinger: '%s' covers %d%% of the frame from frame "
+			"%lld", path, percent, (long long)frame + 1);
+	return frame < numberOfFrames ? (int)frame + 1 : numberOfFrames;
+}
 
-	if (avformat_open_input(&pFormatCtx, file, NULL, NULL) != 0)
-	{
-		blog(LOG_WARNING, "Couldn't open stinger video file");
-		return -1;
-	}
+/* Same, measured from whatever holds the stinger's alpha. The curve is
+ * cached with the probe results, so only the first call decodes. */
+static int suggest_cut_frame(obs_data_t *settings, int numberOfFrames)
+{
+	enum stinger_matte_layout layout = get_layout_setting(settings);
+	const char *path = obs_data_get_string(settings,
+			layout == STINGER_MATTE_FILE ?
+			"mattePath" : "stingerPath");
+	struct stinger_probe_info info;
+	int cutFrame = 0;
+
+	if (probe_with_timeout(path, get_coverage_source(layout), &info))
+		cutFrame = find_cut_frame(settings, path, &info,
+				numberOfFrames);
+	stinger_probe_info_free(&info);
+	return cutFrame;
+}
 
-	if (avformat_find_stream_info(pFormatCtx, NULL)<0)
-	{
-		blog(LOG_WARNING, "Couldn't find stinger video stream information");
-		return -1;
+#define STRIP_THUMBNAILS 10
+
+/* Shows the cut frame and the keyframe strip under the cut frame slider.
+ * The thumbnails are decoded in the background, whatever isn't done yet
+ * shows up the next time the description is rebuilt. True if it changed. */
+static bool update_cut_preview(obs_property_t *slider, const char *path,
+		int cutFrame, const char *note)
+{
+	struct dstr desc = { 0 };
+	struct dstr file = { 0 };
+	int64_t frame = cutFrame - 1;
+	const char *prev;
+	bool changed;
+
+	dstr_copy(&desc, "Transition at frame");
+	if (note)
+		dstr_catf(&desc, "<br><small>%s</small>", note);
+
+	if (path && *path && cutFrame > 0) {
+		stinger_thumbnails_request(path);
+
+		if (stinger_thumbnails_get_preview(path, &frame, &file)) {
+			dstr_catf(&desc, "<br><img src=\"%s\">", file.array);
+			if (frame != cutFrame - 1)
+				dstr_catf(&desc, "<br><small>keyframe %lld, "
+						"frame %d is on its way"
+						"</small>",
+						(long long)frame + 1,
+						cutFrame);
+		}
+
+		dstr_cat(&desc, "<br>");
+		stinger_thumbnails_get_strip(path, STRIP_THUMBNAILS, &desc);
 	}
 
-	AVCodecContext *pCodecCtxOrig = NULL;
-	AVCodecContext *pCodecCtx = NULL;
-	AVCodec *pCodec = NULL;
+	prev = obs_property_description(slider);
+	changed = !prev || strcmp(prev, desc.array) != 0;
+	if (changed)
+		obs_property_set_description(slider, desc.array);
 
-	int videoStream = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0);
+	dstr_free(&file);
+	dstr_free(&desc);
+	return changed;
+}
 
-	pCodecCtxOrig = pFormatCtx->streams[videoStream]->codec;
+static bool cutFrameModified(obs_properties_t *props,
+		obs_property_t *property, obs_data_t *settings)
+{
+	UNUSED_PARAMETER(props);
+	if (!path_probed(settings))
+		return false;
+	return update_cut_preview(property,
+			obs_data_get_string(settings, "stingerPath"),
+			(int)obs_data_get_int(settings, "cutFrame"), NULL);
+}
 
-	pCodec = avcodec_find_decoder(pCodecCtxOrig->codec_id);
-	if (pCodec == NULL) {
-		blog(LOG_WARNING, "Unsupported codec of stinger video");
-		return -1;
-	}
+/* Trim points leave at least two frames */
+static void set_trim_limits(obs_properties_t *props, int numberOfFrames)
+{
+	int max = numberOfFrames > 2 ? numberOfFrames - 2 : 0;
+
+	obs_property_int_set_limits(obs_properties_get(props, "trimStart"),
+			0, max, 1);
+	obs_property_int_set_limits(obs_properties_get(props, "trimEnd"),
+			0, max, 1);
+}
 
-	pCodecCtx = avcodec_alloc_context3(pCodec);
+/* Keeps the cut frame between the trim points */
+static bool trimModified(obs_properties_t *props,
+		obs_property_t *property, obs_data_t *settings)
+{
+	obs_property_t *slider = obs_properties_get(props, "cutFrame");
+	int numberOfFrames = (int)obs_data_get_int(settings, "numberOfFrames");
+	int first = (int)obs_data_get_int(settings, "trimStart") + 1;
+	int last = numberOfFrames - (int)obs_data_get_int(settings, "trimEnd");
+	int cutFrame = (int)obs_data_get_int(settings, "cutFrame");
 
-	if (avcodec_copy_context(pCodecCtx, pCodecCtxOrig) != 0)
-	{
-		blog(LOG_ERROR, "Couldn't copy codec context of stinger video");
-		return -1;
-	}
+	if (numberOfFrames <= 1 || !path_probed(settings) || last <= first)
+		return false;
 
-	if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0){
-		blog(LOG_ERROR, "Couldn't open codec of stinger video");
-		return -1;
+	obs_property_int_set_limits(slider, first, last, 1);
+	if (cutFrame < first || cutFrame > last) {
+		cutFrame = cutFrame < first ? first : last;
+		obs_data_set_int(settings, "cutFrame", cutFrame);
+		update_cut_preview(slider,
+				obs_data_get_string(settings, "stingerPath"),
+				cutFrame, NULL);
 	}
 
-	AVFrame *pFrame = NULL;
-	pFrame = av_frame_alloc();
+	UNUSED_PARAMETER(property);
+	return true;
+}
+
+static void probe_done(void *param)
+{
+	struct stinger_info *s = param;
 
-	int frameFinished;
-	AVPacket packet;
+	/* rebuilding the properties runs stingerPathModified again, which
+	 * picks the results up */
+	obs_source_update_properties(s->source);
+}
 
-	while (av_read_frame(pFormatCtx, &packet) >= 0) {
-		if (packet.stream_index == videoStream) {
-			avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
-			if (frameFinished) {
-				numberOfFrames++;
-			}
-		}
-		av_free_packet(&packet);
+/* Starts probing file in the background in the given job slot, unless
+ * that's already under way or done. A probe of any other file is
+ * cancelled. */
+static enum stinger_probe_job_state probe_in_background(
+		struct stinger_info *s, struct stinger_probe_job **job,
+		const char *file, enum stinger_coverage_source coverage)
+{
+	if (*job && !stinger_probe_job_matches(*job, file, coverage)) {
+		stinger_probe_job_destroy(*job);
+		*job = NULL;
 	}
-	av_free(pFrame);
 
-	avcodec_close(pCodecCtx);
-	avcodec_close(pCodecCtxOrig);
+	if (!*job)
+		*job = stinger_probe_job_start(file, coverage, probe_done, s);
 
-	avformat_close_input(&pFormatCtx);
+	return stinger_probe_job_get_state(*job);
+}
 
-	return numberOfFrames;
+#define CUT_FRAME_PENDING -1
 
+/* Same as suggest_cut_frame, without measuring on the calling thread: a
+ * clip that isn't in the probe cache is measured in the background, and
+ * CUT_FRAME_PENDING returned until that's done */
+static int measure_cut_frame(struct stinger_info *s, obs_data_t *settings,
+		int numberOfFrames)
+{
+	enum stinger_matte_layout layout = get_layout_setting(settings);
+	const char *path = obs_data_get_string(settings,
+			layout == STINGER_MATTE_FILE ?
+			"mattePath" : "stingerPath");
+	enum stinger_coverage_source coverage = get_coverage_source(layout);
+	struct stinger_probe_info info;
+	int cutFrame = 0;
+
+	if (!s)
+		return suggest_cut_frame(settings, numberOfFrames);
+
+	if (stinger_meta_cache_lookup(path, coverage, &info)) {
+		cutFrame = find_cut_frame(settings, path, &info,
+				numberOfFrames);
+		stinger_probe_info_free(&info);
+		return cutFrame;
+	}
+
+	switch (probe_in_background(s, &s->coverage_job, path, coverage)) {
+	case STINGER_PROBE_JOB_RUNNING:
+		return CUT_FRAME_PENDING;
+	case STINGER_PROBE_JOB_SUCCEEDED:
+		return find_cut_frame(settings, path,
+				stinger_probe_job_get_info(s->coverage_job),
+				numberOfFrames);
+	default:
+		return 0;
+	}
 }
 
+/* The cut frame is picked from the coverage whenever what it's measured
+ * by changes. A source that isn't in the probe cache yet is measured in
+ * the background, the refresh once it's done comes back here. */
+static bool coverageModified(obs_properties_t *props,
+		obs_property_t *property, obs_data_t *settings)
+{
+	struct stinger_info *s = obs_properties_get_param(props);
+	obs_property_t *slider = obs_properties_get(props, "cutFrame");
+	int numberOfFrames = (int)obs_data_get_int(settings, "numberOfFrames");
+	int cutFrame;
+
+	if (!obs_data_get_bool(settings, "autoCutFrame") ||
+	    numberOfFrames <= 1 || !path_probed(settings))
+		return false;
+
+	cutFrame = measure_cut_frame(s, settings, numberOfFrames);
+	if (cutFrame == CUT_FRAME_PENDING) {
+		obs_property_set_enabled(slider, false);
+		update_cut_preview(slider, NULL, 0, "probing the file...");
+		return true;
+	}
+
+	if (cutFrame) {
+		obs_data_set_int(settings, "cutFrame", cutFrame);
+		update_cut_preview(slider,
+				obs_data_get_string(settings, "stingerPath"),
+				cutFrame, NULL);
+	}
+
+	UNUSED_PARAMETER(property);
+	return cutFrame != 0;
+}
 
 static bool stingerPathModified(obs_properties_t *props, obs_property_t *property, obs_data_t *settings)
 {
+	struct stinger_info *s = obs_properties_get_param(props);
 	const char* prevPath = obs_data_get_string(settings, "prevPath");
 	const char* file = obs_data_get_string(settings, "stingerPath");
 	int numberOfFrames = 0;
@@ -649,18 +2234,85 @@ static bool stingerPathModified(obs_properties_t *props, obs_property_t *propert
 	{
 		numberOfFrames = obs_data_get_int(settings, "numberOfFrames");
 		obs_property_int_set_limits(slider, 1, numberOfFrames, 1);
+		set_trim_limits(props, numberOfFrames);
+		obs_property_set_enabled(slider, true);
+		update_cut_preview(slider, file,
+				(int)obs_data_get_int(settings, "cutFrame"),
+				NULL);
 		return true;
 	}
 
 	struct dstr path = { 0 };
+	struct stinger_probe_info info;
+	const struct stinger_probe_info *probed = NULL;
+	enum stinger_matte_layout layout = get_layout_setting(settings);
+	bool autoCut = obs_data_get_bool(settings, "autoCutFrame");
+	const char *note = NULL;
+	int cutFrame = 0;
 	dstr_copy(&path, file);
-	
-	numberOfFrames = checkInputFile(path.array);
+
+	//the frame count and coverage come from the same pass
+	enum stinger_coverage_source coverage =
+		autoCut && layout != STINGER_MATTE_FILE ?
+		get_coverage_source(layout) : STINGER_COVERAGE_NONE;
+
+	//anything but a cached file is probed in the background, without
+	//a transition to report back to it's probed right here
+	if (stinger_meta_cache_lookup(path.array, coverage, &info)) {
+		probed = &info;
+	} else if (!s) {
+		if (probe_with_timeout(path.array, coverage, &info))
+			probed = &info;
+	} else {
+		switch (probe_in_background(s, &s->probe_job, path.array,
+					coverage)) {
+		case STINGER_PROBE_JOB_RUNNING:
+			obs_property_set_enabled(slider, false);
+			update_cut_preview(slider, NULL, 0,
+					"probing the file...");
+			dstr_free(&path);
+			return true;
+		case STINGER_PROBE_JOB_SUCCEEDED:
+			probed = stinger_probe_job_get_info(s->probe_job);
+			break;
+		case STINGER_PROBE_JOB_FAILED:
+			note = "couldn't read the file";
+			break;
+		case STINGER_PROBE_JOB_TIMED_OUT:
+			note = "reading the file took too long";
+			break;
+		}
+	}
+
+	if (probed)
+		numberOfFrames = (int)probed->frame_count;
+
+	if (numberOfFrames > 1 && autoCut)
+		cutFrame = layout == STINGER_MATTE_FILE ?
+			measure_cut_frame(s, settings, numberOfFrames) :
+			find_cut_frame(settings, path.array, probed,
+				numberOfFrames);
+	stinger_probe_info_free(&info);
+
+	//the matte is measured in the background, once it's done the
+	//refreshed properties pick the cut frame up through the matte
+	//settings' callbacks
+	if (cutFrame == CUT_FRAME_PENDING) {
+		cutFrame = 0;
+		note = "probing the matte file...";
+	}
+
+	if (s) {
+		stinger_probe_job_destroy(s->probe_job);
+		s->probe_job = NULL;
+	}
 
 	if (numberOfFrames > 1){
+
 		obs_property_int_set_limits(slider, 1, numberOfFrames, 1);
-		//set slider in the middle
-		obs_data_set_int(settings, "cutFrame", numberOfFrames / 2);
+		//set slider in the middle unless the coverage says otherwise
+		obs_data_set_int(settings, "cutFrame",
+				cutFrame ? cutFrame : numberOfFrames / 2);
 		obs_data_set_int(settings, "numberOfFrames", numberOfFrames);
 	}
 	else{
@@ -668,7 +2320,15 @@ static bool stingerPathModified(obs_properties_t *props, obs_property_t *propert
 		obs_data_set_int(settings, "numberOfFrames", 1);
 	}
 
+	//trim points belong to the previous file
+	set_trim_limits(props, numberOfFrames);
+	obs_data_set_int(settings, "trimStart", 0);
+	obs_data_set_int(settings, "trimEnd", 0);
+
 	obs_data_set_string(settings, "prevPath", path.array);
+	obs_property_set_enabled(slider, true);
+	update_cut_preview(slider, path.array,
+			(int)obs_data_get_int(settings, "cutFrame"), note);
 
 	dstr_free(&path);
 
@@ -683,15 +2343,98 @@ static obs_properties_t *stinger_properties(void *data)
 
 	obs_properties_t *ppts = obs_properties_create();
 
+	if (stinger)
+		apply_pending_duration(stinger);
+
 	obs_properties_set_flags(ppts, OBS_PROPERTIES_DEFER_UPDATE);
+	obs_properties_set_param(ppts, stinger, NULL);
 
 	obs_property_t *pathProp = obs_properties_add_path(ppts, "stingerPath", 
 		"Path to stinger video", OBS_PATH_FILE, "", "");
 	obs_property_set_modified_callback(pathProp, stingerPathModified);
 	obs_properties_add_bool(ppts, "hw_decode",
 		obs_module_text("HardwareDecode"));
-	obs_properties_add_int_slider(ppts, "cutFrame", 
-		"Transition at frame", 1, 1, 1);
+	obs_property_t *matteProp = obs_properties_add_list(ppts,
+		"matteLayout", "Stinger transparency",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(matteProp, "Alpha channel of the video",
+		STINGER_MATTE_NONE);
+	obs_property_list_add_int(matteProp,
+		"Matte beside the video (right half)",
+		STINGER_MATTE_SIDE_BY_SIDE);
+	obs_property_list_add_int(matteProp, "Matte below the video "
+		"(bottom half)", STINGER_MATTE_STACKED);
+	obs_property_list_add_int(matteProp, "Separate matte video",
+		STINGER_MATTE_FILE);
+	obs_property_set_modified_callback(matteProp, coverageModified);
+	obs_property_t *mattePathProp = obs_properties_add_path(ppts,
+		"mattePath", "Path to matte video", OBS_PATH_FILE, "", "");
+	obs_property_set_modified_callback(mattePathProp, coverageModified);
+	obs_property_t *cutFrameProp = obs_properties_add_int_slider(ppts,
+		"cutFrame", "Transition at frame", 1, 1, 1);
+	obs_property_set_modified_callback(cutFrameProp, cutFrameModified);
+	if (stinger)
+		update_cut_preview(cutFrameProp, stinger->path,
+			(int)stinger->cutFrame, NULL);
+	obs_property_t *trimStartProp = obs_properties_add_int_slider(ppts,
+		"trimStart", "Frames trimmed off the start", 0, 0, 1);
+	obs_property_set_modified_callback(trimStartProp, trimModified);
+	obs_property_t *trimEndProp = obs_properties_add_int_slider(ppts,
+		"trimEnd", "Frames trimmed off the end", 0, 0, 1);
+	obs_property_set_modified_callback(trimEndProp, trimModified);
+	obs_property_t *durationProp = obs_properties_add_int(ppts,
+		"targetDuration",
+		"Play the stinger in (ms, 0 for its own length)", 0, 60000, 10);
+	obs_property_set_long_description(durationProp, "The stinger's audio "
+		"is sped up or slowed down along with it, which changes "
+		"its pitch.");
+	obs_property_t *autoCutProp = obs_properties_add_bool(ppts,
+		"autoCutFrame", "Transition where the stinger covers the scene");
+	obs_property_set_modified_callback(autoCutProp, coverageModified);
+	obs_property_t *coverageProp = obs_properties_add_int_slider(ppts,
+		"cutCoverage", "Covered share of the scene (%)", 10, 100, 1);
+	obs_property_set_modified_callback(coverageProp, coverageModified);
+	obs_properties_add_bool(ppts, "scaleToOutput",
+		"Decode at the output resolution");
+	obs_properties_add_bool(ppts, "preloadFrames",
+		"Preload stinger frames into memory");
+	obs_properties_add_int(ppts, "cacheBudget",
+		"Preload memory budget for all stingers (MB)", 64, 16384, 64);
+	obs_property_t *storageProp = obs_properties_add_list(ppts,
+		"cacheStorage", "Preloaded frame storage",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(storageProp, "BGRA (fastest display)",
+		STINGER_CACHE_STORE_BGRA);
+	obs_property_list_add_int(storageProp, "Planar YUV (smaller)",
+		STINGER_CACHE_STORE_PLANAR);
+	obs_property_list_add_int(storageProp, "Compressed (smallest)",
+		STINGER_CACHE_STORE_COMPRESSED);
+	obs_properties_add_bool(ppts, "usePack",
+		"Play from the exported frame pack when there is one");
+	obs_properties_add_bool(ppts, "packCompressed",
+		"Compress exported frame packs");
+	obs_properties_add_button(ppts, "exportPack", "Export frame pack",
+		export_pack_clicked);
+	obs_properties_add_bool(ppts, "primeDecoder",
+		"Keep the decoder ready between transitions");
+	obs_properties_add_int(ppts, "prerollFrames",
+		"Frames decoded ahead of a transition", 0, 120, 1);
+	obs_properties_add_int(ppts, "decoderThreads",
+		"Decoder threads (0 for one per core)", 0, 64, 1);
+	obs_property_t *threadingProp = obs_properties_add_list(ppts,
+		"decoderThreading", "Decoder threading",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(threadingProp, "Automatic",
+		STINGER_THREADING_AUTO);
+	obs_property_list_add_int(threadingProp, "Frame (most throughput)",
+		STINGER_THREADING_FRAME);
+	obs_property_list_add_int(threadingProp, "Slice (least delay)",
+		STINGER_THREADING_SLICE);
+	obs_properties_add_int(ppts, "warmupConcurrency",
+		"Stingers set up at once after loading (all stingers)", 1,
+		STINGER_WARMUP_MAX_THREADS, 1);
+	obs_properties_add_bool(ppts, "telemetry",
+		"Collect performance telemetry");
 
 	return ppts;
 }
@@ -700,7 +2443,28 @@ static void stinger_defaults(obs_data_t *settings)
 {
 	obs_data_set_default_int(settings, "cutFrame", 1);
 	obs_data_set_default_int(settings, "numberOfFrames", 1);
+	obs_data_set_default_int(settings, "trimStart", 0);
+	obs_data_set_default_int(settings, "trimEnd", 0);
+	obs_data_set_default_int(settings, "targetDuration", 0);
 	obs_data_set_default_string(settings, "stingerPath", "");
+	obs_data_set_default_int(settings, "matteLayout", STINGER_MATTE_NONE);
+	obs_data_set_default_string(settings, "mattePath", "");
+	obs_data_set_default_bool(settings, "autoCutFrame", true);
+	obs_data_set_default_int(settings, "cutCoverage", 90);
+	obs_data_set_default_bool(settings, "preloadFrames", false);
+	obs_data_set_default_bool(settings, "scaleToOutput", false);
+	obs_data_set_default_int(settings, "cacheBudget", 1024);
+	obs_data_set_default_int(settings, "warmupConcurrency", 2);
+	obs_data_set_default_int(settings, "cacheStorage",
+		STINGER_CACHE_STORE_BGRA);
+	obs_data_set_default_bool(settings, "usePack", true);
+	obs_data_set_default_bool(settings, "packCompressed", false);
+	obs_data_set_default_bool(settings, "primeDecoder", true);
+	obs_data_set_default_int(settings, "prerollFrames", 8);
+	obs_data_set_default_int(settings, "decoderThreads", 0);
+	obs_data_set_default_int(settings, "decoderThreading",
+		STINGER_THREADING_AUTO);
+	obs_data_set_default_bool(settings, "telemetry", false);
 #if defined(_WIN32)
 	obs_data_set_default_bool(settings, "hw_decode", true);
 #endif
@@ -710,46 +2474,120 @@ static void stinger_activate(void *data)
 {
 	struct stinger_info *s = data;
 
+	/* used before its turn to warm up came: it goes next, without
+	 * holding up the graphics thread, and sets up the pack and the
+	 * cache itself */
+	if (!is_warmed_up(s)) {
+		stinger_warmup_hurry(&s->warmup);
+		return;
+	}
+
 	if (!s->validInput)
 	{
 		load_error_texture(s);
 	}
+
+	drop_stale_pack(s);
+	start_frame_cache(s);
 }
 
-static void stinger_deactivate(void *data)
+static void stinger_save(void *data, obs_data_t *settings)
 {
 	struct stinger_info *s = data;
-
-	if (s->demuxer != NULL) {
-		ff_demuxer_free(s->demuxer);
-		s->demuxer = NULL;
+	uint32_t duration;
+	int64_t file_size, file_mtime;
+	size_t frames, cut_frame;
+
+	apply_pending_duration(s);
+
+	pthread_mutex_lock(&s->timing_mutex);
+	duration = s->duration_ms;
+	file_size = s->duration_file_size;
+	file_mtime = s->duration_file_mtime;
+	frames = s->pending_frames;
+	cut_frame = s->cutFrame;
+	pthread_mutex_unlock(&s->timing_mutex);
+
+	if (frames) {
+		obs_data_set_int(settings, "numberOfFrames", (long long)frames);
+		obs_data_set_int(settings, "cutFrame", (long long)cut_frame);
+		obs_data_set_int(settings, "trimStart", 0);
+		obs_data_set_int(settings, "trimEnd", 0);
+		obs_data_set_string(settings, "prevPath",
+				obs_data_get_string(settings, "stingerPath"));
 	}
 
-	if (s->sws_ctx != NULL){
-		sws_freeContext(s->sws_ctx);
-		s->sws_ctx = NULL;
+	if (duration) {
+		obs_data_set_int(settings, "durationMs", duration);
+		obs_data_set_int(settings, "durationFileSize", file_size);
+		obs_data_set_int(settings, "durationFileMtime", file_mtime);
 	}
-	bfree(s->sws_data);
-	s->sws_data = NULL;
-	s->sws_format = 0;
-	s->sws_height = 0;
-	s->sws_width = 0;
+}
 
-	bfree(s->audio_data);
+static void stinger_deactivate(void *data)
+{
+	struct stinger_info *s = data;
+
+	stop_playback(s);
 
 	obs_enter_graphics();
-	if (!s->validInput)
-	{
-		gs_image_file_free(&s->stinger_error_image);
-		s->stinger_texture = NULL;
-	}
-	if (s->stinger_texture != NULL){
-		gs_texture_destroy(s->stinger_texture);
-		s->stinger_texture = NULL;
-	}
+	stinger_texture_ring_free(&s->texture_ring);
+	stinger_texture_ring_free(&s->matte_ring);
 	obs_leave_graphics();
 }
 
+static void stinger_transition_stop(void *data)
+{
+	struct stinger_info *s = data;
+
+	const char *name = obs_source_get_name(s->source);
+	long underruns;
+
+	if (s->telemetry_enabled && s->frames_rendered) {
+		stinger_telemetry_add(&s->telemetry, STINGER_METRIC_DROPPED,
+				s->frames_dropped);
+		stinger_telemetry_add(&s->telemetry, STINGER_METRIC_REPEATED,
+				s->frames_late);
+		stinger_telemetry_finish_run(&s->telemetry, name);
+	}
+
+	if (s->frames_presented)
+		blog(LOG_INFO, "stinger '%s': presented %llu frames, "
+				"%llu late, %llu dropped", name,
+				(unsigned long long)s->frames_presented,
+				(unsigned long long)s->frames_late,
+				(unsigned long long)s->frames_dropped);
+	s->frames_presented = 0;
+	s->frames_late = 0;
+	s->frames_dropped = 0;
+
+	if (s->frames_rendered)
+		blog(LOG_INFO, "stinger '%s': %.3f ms per frame in the "
+				"plugin, %.3f ms at most", name,
+				(double)s->render_time_total /
+				(double)s->frames_rendered / 1000000.0,
+				(double)s->render_time_max / 1000000.0);
+	s->render_time_total = 0;
+	s->render_time_max = 0;
+	s->frames_rendered = 0;
+
+	underruns = os_atomic_set_long(&s->audio_underruns, 0);
+	if (underruns)
+		blog(LOG_INFO, "stinger '%s': %ld audio underruns", name,
+				underruns);
+
+	if (s->playback)
+		stinger_playback_log_stats(s->playback, name);
+	if (s->matte_playback)
+		stinger_playback_log_stats(s->matte_playback, name);
+	stinger_matte_sync_log_stats(&s->matte_sync, name);
+	stinger_cache_prefetch_log_stats(s->cache_prefetch, name);
+	stinger_texture_ring_log_stats(&s->texture_ring, name);
+	stinger_texture_ring_reset_stats(&s->texture_ring);
+
+	finish_playback(s);
+}
+
 struct obs_source_info stinger_transition = {
 	.id = "stinger_transition",
 	.type = OBS_SOURCE_TYPE_TRANSITION,
@@ -757,10 +2595,12 @@ struct obs_source_info stinger_transition = {
 	.create = stinger_create,
 	.destroy = stinger_destroy,
 	.update = stinger_update,
+	.save = stinger_save,
 	.video_render = stinger_video_render,
 	.audio_render = stinger_audio_render,
 	.get_properties = stinger_properties,
 	.get_defaults = stinger_defaults,
 	.deactivate = stinger_deactivate,
-	.activate = stinger_activate
+	.activate = stinger_activate,
+	.transition_stop = stinger_transition_stop
 };